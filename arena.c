@@ -0,0 +1,254 @@
+// See copyright notice in Copying.
+
+// For MAP_ANONYMOUS, MAP_HUGETLB, and MADV_HUGEPAGE.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#endif
+
+enum {
+    // Alignment of every allocation.
+    ARENA_ALIGN = alignof(max_align_t),
+};
+
+struct arena_chunk {
+    arena_chunk_t *prev;
+    // Size of the whole chunk, including this header.
+    size_t size;
+    // Offset of the first free byte in buf.
+    size_t pos;
+    // Whether the chunk was mapped rather than allocated from the heap.
+    bool mapped;
+    alignas(max_align_t) char buf[];
+};
+
+static size_t round_up(size_t len, size_t align) {
+    return (len + align - 1) & ~(align - 1);
+}
+
+// Get the number of bytes the chunk can hold.
+static size_t chunk_cap(const arena_chunk_t *c) {
+    return c->size - sizeof(arena_chunk_t);
+}
+
+// Try to map a chunk of the given size backed by huge pages.
+static void *map_huge(size_t size) {
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (mem != MAP_FAILED)
+        return mem;
+
+    // No huge pages are reserved, so ask for transparent ones instead.
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    madvise(mem, size, MADV_HUGEPAGE);
+
+    return mem;
+}
+
+static arena_chunk_t *chunk_alloc(const arena_t *a, size_t size) {
+    arena_chunk_t *c = NULL;
+    bool mapped = false;
+
+    if (a->flags & ARENA_HUGE_PAGES) {
+        size = round_up(size, HUGE_PAGE_SIZE);
+        c = map_huge(size);
+        mapped = c != NULL;
+    }
+
+    if (!c) {
+        c = malloc(size);
+
+        if (!c && a->oom)
+            longjmp(*a->oom, 1);
+
+        assert(c);
+    }
+
+    *c = (arena_chunk_t) {
+        .size = size,
+        .mapped = mapped,
+    };
+
+    return c;
+}
+
+static void chunk_free(arena_chunk_t *c) {
+    if (c->mapped)
+        munmap(c, c->size);
+    else
+        free(c);
+}
+
+void arena_init(arena_t *a, size_t chunk_size, unsigned flags) {
+    *a = (arena_t) {
+        .chunk_size = chunk_size,
+        .flags = flags,
+    };
+}
+
+void arena_destroy(arena_t *a) {
+    while (a->chunk) {
+        arena_chunk_t *prev = a->chunk->prev;
+        chunk_free(a->chunk);
+        a->chunk = prev;
+    }
+
+    a->last = NULL;
+}
+
+void *arena_alloc(arena_t *a, size_t len) {
+    len = round_up(len, ARENA_ALIGN);
+
+    arena_chunk_t *c = a->chunk;
+
+    if (!c || c->pos + len > chunk_cap(c)) {
+        // Chunks grow geometrically, so a long-lived arena settles into a
+        // single chunk after a reset.
+        size_t size = sizeof(arena_chunk_t) + len;
+
+        if (size < a->chunk_size)
+            size = a->chunk_size;
+
+        if (c && size < 2 * c->size)
+            size = 2 * c->size;
+
+        arena_chunk_t *next = chunk_alloc(a, size);
+        next->prev = c;
+
+        c = a->chunk = next;
+    }
+
+    void *ptr = &c->buf[c->pos];
+
+    c->pos += len;
+    a->last = ptr;
+
+    return ptr;
+}
+
+void *arena_realloc(arena_t *a, void *ptr, size_t old_len, size_t len) {
+    if (!ptr)
+        return arena_alloc(a, len);
+
+    arena_chunk_t *c = a->chunk;
+
+    if (ptr == a->last) {
+        size_t start = (size_t)((char *) ptr - c->buf);
+        size_t end = start + round_up(len, ARENA_ALIGN);
+
+        if (end <= chunk_cap(c)) {
+            c->pos = end;
+            return ptr;
+        }
+    }
+
+    if (len <= old_len)
+        return ptr;
+
+    void *next = arena_alloc(a, len);
+    memcpy(next, ptr, old_len);
+
+    return next;
+}
+
+void arena_reset(arena_t *a) {
+    arena_chunk_t *c = a->chunk;
+
+    if (!c)
+        return;
+
+    // Keep only the newest chunk, which is also the largest.
+    while (c->prev) {
+        arena_chunk_t *prev = c->prev->prev;
+        chunk_free(c->prev);
+        c->prev = prev;
+    }
+
+    c->pos = 0;
+    a->last = NULL;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_arena_alloc(void) {
+    arena_t arena;
+    arena_init(&arena, 256, 0);
+
+    char *a = arena_alloc(&arena, 3);
+    char *b = arena_alloc(&arena, 1);
+
+    ASSERT_EQ((uintptr_t) a % ARENA_ALIGN, 0);
+    ASSERT_EQ((uintptr_t) b % ARENA_ALIGN, 0);
+    ASSERT(b >= a + 3);
+
+    // The last allocation grows in place.
+    memcpy(b, "x", 1);
+    ASSERT_EQ(arena_realloc(&arena, b, 1, 64), b);
+    ASSERT_EQ(b[0], 'x');
+
+    // Others are copied.
+    memcpy(a, "abc", 3);
+    char *c = arena_realloc(&arena, a, 3, 32);
+    ASSERT(c != a);
+    ASSERT_EQ(memcmp(c, "abc", 3), 0);
+
+    // Growing past the chunk moves to a new, larger chunk.
+    char *d = arena_realloc(&arena, c, 32, 1000);
+    ASSERT_EQ(memcmp(d, "abc", 3), 0);
+    ASSERT(arena.chunk->prev);
+    ASSERT(arena.chunk->size >= 1000);
+
+    // A reset keeps the newest chunk and starts over at its beginning.
+    arena_chunk_t *chunk = arena.chunk;
+    arena_reset(&arena);
+    ASSERT_EQ(arena.chunk, chunk);
+    ASSERT(!arena.chunk->prev);
+    ASSERT_EQ(arena_alloc(&arena, 1), chunk->buf);
+
+    arena_destroy(&arena);
+    ASSERT(!arena.chunk);
+
+    PASS();
+}
+
+TEST test_arena_huge_pages(void) {
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, ARENA_HUGE_PAGES);
+
+    char *a = arena_alloc(&arena, 1 << 20);
+    memset(a, 0xa5, 1 << 20);
+
+    // Whether or not huge pages were available, the chunk is rounded up to
+    // one.
+    ASSERT(arena.chunk->size % HUGE_PAGE_SIZE == 0);
+    ASSERT_EQ(arena_alloc(&arena, 1), a + (1 << 20));
+
+    arena_destroy(&arena);
+
+    PASS();
+}
+
+SUITE(arena_suite) {
+    RUN_TEST(test_arena_alloc);
+    RUN_TEST(test_arena_huge_pages);
+}
+#endif
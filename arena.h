@@ -0,0 +1,59 @@
+// See copyright notice in Copying.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+enum {
+    // Default minimum size of each chunk.
+    ARENA_CHUNK = 1 << 16,
+};
+
+typedef enum {
+    // Back chunks with huge pages where the system allows it, falling back to
+    // normal pages.
+    ARENA_HUGE_PAGES = 1 << 0,
+} arena_flag_t;
+
+typedef struct arena_chunk arena_chunk_t;
+
+// A bump allocator. Allocations can't be freed individually: they're all
+// released at once by arena_reset, which keeps the newest chunk so later
+// allocations don't go back to the system.
+typedef struct {
+    // Chunk that allocations come from, with older chunks linked behind it.
+    arena_chunk_t *chunk;
+    // The last allocation, which can be grown in place.
+    void *last;
+    // Minimum size of each chunk.
+    size_t chunk_size;
+    unsigned flags;
+    // Where to jump if a chunk can't be allocated, or NULL to abort. Callers
+    // that set it must keep everything they allocate during the jump's reach
+    // in the arena, so nothing leaks.
+    jmp_buf *oom;
+} arena_t;
+
+// Initialize the arena to allocate chunks of at least the given size with
+// the given arena_flag_t flags. No memory is allocated until it's needed.
+void arena_init(arena_t *a, size_t chunk_size, unsigned flags);
+
+// Free every chunk held by the arena.
+void arena_destroy(arena_t *a);
+
+// Allocate len bytes aligned for any type. If out of memory, jump to the
+// arena's oom buffer if it has one, and abort otherwise.
+void *arena_alloc(arena_t *a, size_t len);
+
+// Resize the allocation at ptr from old_len to len bytes, growing it in place
+// if it's the last allocation and there's room, and otherwise copying it to a
+// new allocation. A NULL ptr makes a new allocation.
+void *arena_realloc(arena_t *a, void *ptr, size_t old_len, size_t len);
+
+// Release every allocation at once.
+void arena_reset(arena_t *a);
+
+#endif
@@ -0,0 +1,447 @@
+// See copyright notice in Copying.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch-pool.h"
+#include "batch.h"
+#include "parser.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#endif
+
+#ifdef MKBUNDLE_BENCH
+#include "bench.h"
+#endif
+
+static inline uint64_t range_pack(size_t begin, size_t end) {
+    return (uint64_t) begin | (uint64_t) end << 32;
+}
+
+static inline size_t range_begin(uint64_t r) {
+    return (size_t)(r & UINT32_MAX);
+}
+
+static inline size_t range_end(uint64_t r) {
+    return (size_t)(r >> 32);
+}
+
+// Take the next record from the front of the worker's own range.
+static bool pop(batch_worker_t *w, size_t *rec) {
+    uint64_t r = atomic_load(&w->range);
+
+    while (range_begin(r) < range_end(r)) {
+        uint64_t next = range_pack(range_begin(r) + 1, range_end(r));
+
+        if (atomic_compare_exchange_weak(&w->range, &r, next)) {
+            *rec = range_begin(r);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Move the back half of another worker's range into the thief's own, empty,
+// range. Return false if every other worker is out of records.
+static bool steal(batch_pool_t *p, batch_worker_t *thief) {
+    for (size_t i = 1; i < p->worker_count; i += 1) {
+        batch_worker_t *victim =
+            &p->workers[(thief->index + i) % p->worker_count];
+
+        uint64_t r = atomic_load(&victim->range);
+
+        while (range_begin(r) < range_end(r)) {
+            size_t begin = range_begin(r);
+            size_t end = range_end(r);
+            size_t mid = begin + (end - begin) / 2;
+
+            if (atomic_compare_exchange_weak(&victim->range, &r,
+                                             range_pack(begin, mid)))
+            {
+                // Nobody else writes to an empty range.
+                atomic_store(&thief->range, range_pack(mid, end));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Compile records until none are left in any worker's range.
+static void work(batch_pool_t *p, batch_worker_t *w) {
+    for (;;) {
+        size_t i;
+
+        if (!pop(w, &i)) {
+            if (!steal(p, w))
+                return;
+
+            continue;
+        }
+
+        const batch_rec_t *rec = &p->recs[i];
+        size_t off = w->out->pos;
+
+        bool ok = batch_compile_record(&w->batch, &p->src[rec->start],
+                                       rec->len, &w->out);
+
+        p->results[i] = (batch_result_t) {
+            .worker = (uint32_t) w->index,
+            .ok = ok,
+            .off = off,
+            .len = w->out->pos - off,
+        };
+    }
+}
+
+static void *run_thread(void *arg) {
+    batch_worker_t *w = arg;
+    batch_pool_t *p = w->pool;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+
+    for (;;) {
+        while (p->generation == seen && !p->stop)
+            pthread_cond_wait(&p->start, &p->lock);
+
+        if (p->stop)
+            break;
+
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        work(p, w);
+
+        pthread_mutex_lock(&p->lock);
+        p->pending -= 1;
+
+        if (!p->pending)
+            pthread_cond_signal(&p->done);
+    }
+
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+bool batch_pool_init(batch_pool_t *p, size_t worker_count) {
+    assert(worker_count);
+
+    *p = (batch_pool_t) {
+        .worker_count = worker_count,
+        .workers = aligned_alloc(alignof(batch_worker_t),
+                                 worker_count * sizeof(batch_worker_t)),
+        .threads = calloc(worker_count, sizeof(pthread_t)),
+    };
+
+    assert(p->workers && p->threads);
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (size_t i = 0; i < worker_count; i += 1) {
+        batch_worker_t *w = &p->workers[i];
+
+        atomic_init(&w->range, 0);
+        batch_init(&w->batch, NULL, NULL);
+        arena_init(&w->arena, ARENA_CHUNK, 0);
+        w->batch.arena = &w->arena;
+        strbuf_init(&w->out, 1 << 12);
+        w->pool = p;
+        w->index = i;
+    }
+
+    for (size_t i = 1; i < worker_count; i += 1) {
+        if (pthread_create(&p->threads[i], NULL, run_thread, &p->workers[i])) {
+            // Only join the threads that were started.
+            for (size_t j = i; j < worker_count; j += 1) {
+                strbuf_destroy(p->workers[j].out);
+                arena_destroy(&p->workers[j].arena);
+            }
+
+            p->worker_count = i;
+            batch_pool_destroy(p);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void batch_pool_destroy(batch_pool_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for (size_t i = 1; i < p->worker_count; i += 1)
+        pthread_join(p->threads[i], NULL);
+
+    for (size_t i = 0; i < p->worker_count; i += 1) {
+        strbuf_destroy(p->workers[i].out);
+        arena_destroy(&p->workers[i].arena);
+    }
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+
+    free(p->results);
+    free(p->recs);
+    free(p->threads);
+    free(p->workers);
+}
+
+// Compile the given number of records, which have been stored in recs.
+static void run_job(batch_pool_t *p, const char *src, size_t count) {
+    assert(count <= UINT32_MAX);
+
+    // Give each worker an even share up front, and let them steal from each
+    // other when the records turn out to be uneven.
+    for (size_t i = 0; i < p->worker_count; i += 1) {
+        batch_worker_t *w = &p->workers[i];
+
+        w->out->pos = 0;
+        atomic_store(&w->range, range_pack(count * i / p->worker_count,
+                                           count * (i + 1) / p->worker_count));
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->src = src;
+    p->generation += 1;
+    p->pending = p->worker_count - 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    work(p, &p->workers[0]);
+
+    pthread_mutex_lock(&p->lock);
+
+    while (p->pending)
+        pthread_cond_wait(&p->done, &p->lock);
+
+    pthread_mutex_unlock(&p->lock);
+}
+
+size_t batch_pool_compile(batch_pool_t *p, batch_t *b, const char *buf,
+                          size_t len, bool eof, strbuf_t **out)
+{
+    size_t count = 0;
+    size_t pos = 0;
+    bool partial = false;
+
+    for (;;) {
+        pos = parser_skip_space(buf, len, pos);
+
+        if (pos == len)
+            break;
+
+        size_t rec_len = parser_record_len(&buf[pos], len - pos);
+
+        if (!rec_len) {
+            partial = eof;
+            pos = eof ? len : pos;
+
+            break;
+        }
+
+        if (count == p->rec_cap) {
+            p->rec_cap = p->rec_cap ? p->rec_cap * 2 : 1 << 8;
+            p->recs = realloc(p->recs, p->rec_cap * sizeof(p->recs[0]));
+            p->results = realloc(p->results,
+                                 p->rec_cap * sizeof(p->results[0]));
+            assert(p->recs && p->results);
+        }
+
+        p->recs[count] = (batch_rec_t) {
+            .start = pos,
+            .len = rec_len,
+        };
+
+        count += 1;
+        pos += rec_len;
+    }
+
+    if (count)
+        run_job(p, buf, count);
+
+    // Merge the blocks back into input order.
+    for (size_t i = 0; i < count; i += 1) {
+        const batch_result_t *r = &p->results[i];
+
+        b->record += 1;
+
+        if (r->ok)
+            strbuf_append(out, &p->workers[r->worker].out->buf[r->off], r->len);
+        else
+            batch_fail(b);
+    }
+
+    if (partial) {
+        b->record += 1;
+        batch_fail(b);
+    }
+
+    return pos;
+}
+
+#if defined MKBUNDLE_TEST || defined MKBUNDLE_BENCH
+// Append count synthetic records, alternating between primary and extension
+// blocks, with the given number of malformed records mixed in.
+static void fill_records(strbuf_t **sb, size_t count, size_t bad_every) {
+    for (size_t i = 0; i < count; i += 1) {
+        char rec[512];
+        int len;
+
+        if (bad_every && i % bad_every == bad_every - 1) {
+            len = snprintf(rec, sizeof(rec), "\"extension\": {\"type\": 1}\n");
+        } else if (i % 2) {
+            len = snprintf(rec, sizeof(rec),
+                "\"extension\": {\"type\": %zu, \"flags\": 0,"
+                " \"payload-length\": %zu, \"ref-count\": 0, \"refs\": []}\n",
+                i % 200, i * 37);
+        } else {
+            len = snprintf(rec, sizeof(rec),
+                "\"primary\": {\"version\": 6, \"flags\": 16, \"length\": 0,"
+                " \"dest\": [0, 8], \"src\": [0, 0], \"report-to\": [0, 8],"
+                " \"custodian\": [16, 17], \"creation-ts\": %zu,"
+                " \"creation-seq\": %zu, \"lifetime\": 3600,"
+                " \"eids-size\": 21, \"eids\": [\"ipn\", \"1.2\", \"1.1\","
+                " \"dtn\", \"none\"]}\n",
+                500000000 + i, i);
+        }
+
+        assert(len > 0 && (size_t) len < sizeof(rec));
+        strbuf_append(sb, rec, (size_t) len);
+    }
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+TEST test_batch_pool_compile(void) {
+    enum { COUNT = 1000 };
+
+    strbuf_t *in;
+    strbuf_init(&in, 1 << 16);
+    fill_records(&in, COUNT, 7);
+    // A partial record.
+    strbuf_append(&in, "\"primary\": {", 12);
+
+    strbuf_t *expect;
+    strbuf_init(&expect, 1 << 16);
+
+    batch_t serial;
+    batch_init(&serial, NULL, NULL);
+    size_t used = batch_compile(&serial, in->buf, in->pos, false, &expect);
+
+    static const size_t WORKERS[] = {1, 2, 3, 8};
+
+    for (size_t i = 0; i < ASIZE(WORKERS); i += 1) {
+        batch_pool_t pool;
+        ASSERT(batch_pool_init(&pool, WORKERS[i]));
+
+        strbuf_t *out;
+        strbuf_init(&out, 1);
+
+        batch_t batch;
+        batch_init(&batch, NULL, NULL);
+
+        // Run twice to reuse the pool.
+        for (size_t round = 0; round < 2; round += 1) {
+            out->pos = 0;
+            batch.record = batch.failed = 0;
+
+            ASSERT_EQ(batch_pool_compile(&pool, &batch, in->buf, in->pos, false,
+                                         &out), used);
+            ASSERT_EQ(batch.record, COUNT);
+            ASSERT_EQ(batch.failed, serial.failed);
+            ASSERT_EQ(out->pos, expect->pos);
+            ASSERT_EQ(memcmp(out->buf, expect->buf, out->pos), 0);
+        }
+
+        ASSERT_EQ(batch_pool_compile(&pool, &batch, &in->buf[used],
+                                     in->pos - used, true, &out),
+                  in->pos - used);
+        ASSERT_EQ(batch.record, COUNT + 1);
+        ASSERT_EQ(batch.failed, serial.failed + 1);
+
+        strbuf_destroy(out);
+        batch_pool_destroy(&pool);
+    }
+
+    strbuf_destroy(expect);
+    strbuf_destroy(in);
+
+    PASS();
+}
+
+SUITE(batch_pool_suite) {
+    RUN_TEST(test_batch_pool_compile);
+}
+#endif
+
+#ifdef MKBUNDLE_BENCH
+BENCH_SUITE(batch_pool_bench) {
+    enum { COUNT = 1 << 15, ROUNDS = 8 };
+
+    strbuf_t *in;
+    strbuf_init(&in, 1 << 20);
+    fill_records(&in, COUNT, 0);
+
+    strbuf_t *out;
+    strbuf_init(&out, 1 << 20);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+    double start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        out->pos = 0;
+        batch_compile(&batch, in->buf, in->pos, true, &out);
+    }
+
+    bench_report("batch_compile", (double) COUNT * ROUNDS, "rec",
+                 bench_now() - start);
+
+    static const size_t WORKERS[] = {1, 2, 4, 8};
+
+    for (size_t i = 0; i < ASIZE(WORKERS); i += 1) {
+        batch_pool_t pool;
+
+        if (!batch_pool_init(&pool, WORKERS[i]))
+            continue;
+
+        start = bench_now();
+
+        for (size_t r = 0; r < ROUNDS; r += 1) {
+            out->pos = 0;
+            batch_pool_compile(&pool, &batch, in->buf, in->pos, true, &out);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "batch_pool_compile -j %zu", WORKERS[i]);
+        bench_report(name, (double) COUNT * ROUNDS, "rec", bench_now() - start);
+
+        batch_pool_destroy(&pool);
+    }
+
+    strbuf_destroy(out);
+    strbuf_destroy(in);
+}
+#endif
@@ -0,0 +1,87 @@
+// See copyright notice in Copying.
+
+#ifndef BATCH_POOL_H
+#define BATCH_POOL_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "strbuf.h"
+
+// A record found in the input.
+typedef struct {
+    size_t start;
+    size_t len;
+} batch_rec_t;
+
+// Where the block compiled from a record ended up.
+typedef struct {
+    uint32_t worker;
+    bool ok;
+    size_t off;
+    size_t len;
+} batch_result_t;
+
+struct batch_pool;
+
+// State owned by a single worker.
+typedef struct {
+    // Records [begin, end) still to be compiled by this worker, packed as
+    // begin | end << 32 so the owner and thieves can update both with a single
+    // compare and swap. Aligned so workers don't share cache lines.
+    alignas(64) _Atomic uint64_t range;
+
+    // Used for its parser and arena.
+    batch_t batch;
+    arena_t arena;
+    // Blocks compiled by this worker during the current job.
+    strbuf_t *out;
+
+    struct batch_pool *pool;
+    size_t index;
+} batch_worker_t;
+
+// A fixed set of threads that compile records in parallel. The calling thread
+// acts as worker 0.
+typedef struct batch_pool {
+    size_t worker_count;
+    batch_worker_t *workers;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    // Signalled when a new job is published or the pool is stopping.
+    pthread_cond_t start;
+    // Signalled when the last helper thread finishes a job.
+    pthread_cond_t done;
+    // Incremented for each job.
+    size_t generation;
+    // Number of helper threads still working on the current job.
+    size_t pending;
+    bool stop;
+
+    // The current job.
+    const char *src;
+    batch_rec_t *recs;
+    batch_result_t *results;
+    size_t rec_cap;
+} batch_pool_t;
+
+// Start a pool with the given total number of workers, including the calling
+// thread. Return false if the threads couldn't be created.
+bool batch_pool_init(batch_pool_t *p, size_t worker_count);
+
+// Stop the threads and free memory held by the pool.
+void batch_pool_destroy(batch_pool_t *p);
+
+// Like batch_compile, but spread the records across the pool. Blocks are still
+// appended in input order, and errors are reported in input order from the
+// calling thread.
+size_t batch_pool_compile(batch_pool_t *p, batch_t *b, const char *buf,
+                          size_t len, bool eof, strbuf_t **out);
+
+#endif
@@ -0,0 +1,356 @@
+// See copyright notice in Copying.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "block.h"
+#include "parser.h"
+#include "sink.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#include "test-params.h"
+#endif
+
+void batch_init(batch_t *b, batch_error_fn on_error, void *ctx) {
+    parser_init(&b->parser);
+
+    b->record = 0;
+    b->failed = 0;
+    b->arena = NULL;
+    b->on_error = on_error;
+    b->ctx = ctx;
+}
+
+// Compile a single record into the sink if given, or the strbuf otherwise.
+static bool compile_record(batch_t *b, const char *src, size_t len,
+                           strbuf_t **out, sink_t *s)
+{
+    block_t block;
+    block_init_arena(&block, b->arena);
+
+    bool ret = parser_parse(&b->parser, src, len) &&
+               block_parse(&block, &b->parser);
+
+    // A failed sink is left for its owner to notice, since the record itself
+    // was fine.
+    if (ret && s)
+        block_write(&block, s);
+    else if (ret)
+        block_encode(&block, out);
+
+    block_destroy(&block);
+
+    if (b->arena)
+        arena_reset(b->arena);
+
+    return ret;
+}
+
+bool batch_compile_record(batch_t *b, const char *src, size_t len,
+                          strbuf_t **out)
+{
+    return compile_record(b, src, len, out, NULL);
+}
+
+void batch_fail(batch_t *b) {
+    b->failed += 1;
+
+    if (b->on_error)
+        b->on_error(b->ctx, b->record);
+}
+
+static size_t compile(batch_t *b, const char *buf, size_t len, bool eof,
+                      strbuf_t **out, sink_t *s)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        pos = parser_skip_space(buf, len, pos);
+
+        if (pos == len)
+            return pos;
+
+        size_t rec_len = parser_record_len(&buf[pos], len - pos);
+
+        if (!rec_len) {
+            if (!eof)
+                return pos;
+
+            b->record += 1;
+            batch_fail(b);
+
+            return len;
+        }
+
+        b->record += 1;
+
+        if (!compile_record(b, &buf[pos], rec_len, out, s))
+            batch_fail(b);
+
+        pos += rec_len;
+    }
+}
+
+size_t batch_compile(batch_t *b, const char *buf, size_t len, bool eof,
+                     strbuf_t **out)
+{
+    return compile(b, buf, len, eof, out, NULL);
+}
+
+size_t batch_compile_sink(batch_t *b, const char *buf, size_t len, bool eof,
+                          sink_t *s)
+{
+    return compile(b, buf, len, eof, NULL, s);
+}
+
+#ifdef MKBUNDLE_TEST
+// Record the numbers of failed records.
+static void record_error(void *ctx, size_t record) {
+    strbuf_t **errors = ctx;
+    char c = (char)('0' + record);
+
+    strbuf_append(errors, &c, 1);
+}
+
+TEST test_batch_compile(void) {
+    #define EXT(type) \
+        "\"extension\": {\"type\": " #type ", \"flags\": 0," \
+        " \"payload-length\": 300, \"ref-count\": 0, \"refs\": []}"
+
+    // Concatenated, newline-delimited and malformed records.
+    static const char S[] =
+        EXT(1) EXT(2) "\n"
+        "\"extension\": {\"type\": 3}\n"
+        "  " EXT(4) "\n"
+        "\"bogus\": []\n"
+        "\"extension\": {\"type\": 5, ";
+    #undef EXT
+
+    strbuf_t *out, *errors;
+    strbuf_init(&out, 1);
+    strbuf_init(&errors, 1);
+
+    batch_t batch;
+    batch_init(&batch, record_error, &errors);
+
+    size_t used = batch_compile(&batch, S, sizeof(S) - 1, false, &out);
+    ASSERT_EQ(S[used], '"');
+    ASSERT_EQ(batch.record, 5);
+    ASSERT_EQ(batch.failed, 2);
+
+    static const uint8_t EXPECT[] = {
+        0x01, 0x00, 0x82, 0x2c,
+        0x02, 0x00, 0x82, 0x2c,
+        0x04, 0x00, 0x82, 0x2c,
+    };
+    ASSERT_EQ(out->pos, sizeof(EXPECT));
+    ASSERT_EQ(memcmp(out->buf, EXPECT, sizeof(EXPECT)), 0);
+
+    // The partial record is malformed once the stream ends.
+    ASSERT_EQ(batch_compile(&batch, &S[used], sizeof(S) - 1 - used, true, &out),
+              sizeof(S) - 1 - used);
+    ASSERT_EQ(batch.record, 6);
+    ASSERT_EQ(batch.failed, 3);
+    ASSERT_EQ(out->pos, sizeof(EXPECT));
+
+    ASSERT_EQ(errors->pos, 3);
+    ASSERT_EQ(memcmp(errors->buf, "356", 3), 0);
+
+    strbuf_destroy(errors);
+    strbuf_destroy(out);
+
+    PASS();
+}
+
+TEST test_batch_compile_resync(void) {
+    // A record missing its brace, and one with an unterminated string, each
+    // fail alone.
+    static const char S[] =
+        "\"extension\": {\"type\": 1, \"flags\": 0\n"
+        TEST_EXTENSION(2, 0, 4) "\n"
+        "\"extension\": {\"type\": \"3}\n"
+        TEST_EXTENSION(4, 0, 4) "\n"
+        TEST_EXTENSION(5, 0, 4) "\n";
+
+    strbuf_t *out, *errors;
+    strbuf_init(&out, 1);
+    strbuf_init(&errors, 1);
+
+    batch_t batch;
+    batch_init(&batch, record_error, &errors);
+
+    ASSERT_EQ(batch_compile(&batch, S, sizeof(S) - 1, true, &out),
+              sizeof(S) - 1);
+    ASSERT_EQ(batch.record, 5);
+    ASSERT_EQ(batch.failed, 2);
+    ASSERT_EQ(errors->pos, 2);
+    ASSERT_EQ(memcmp(errors->buf, "13", 2), 0);
+
+    static const uint8_t EXPECT[] = {
+        0x02, 0x00, 0x04,
+        0x04, 0x00, 0x04,
+        0x05, 0x00, 0x04,
+    };
+    ASSERT_EQ(out->pos, sizeof(EXPECT));
+    ASSERT_EQ(memcmp(out->buf, EXPECT, sizeof(EXPECT)), 0);
+
+    strbuf_destroy(errors);
+    strbuf_destroy(out);
+
+    PASS();
+}
+
+// Append count primary block records, each with different fields.
+static void append_primaries(strbuf_t **sbp, size_t count) {
+    for (size_t i = 0; i < count; i += 1) {
+        char rec[512];
+        int len = snprintf(rec, sizeof(rec),
+            "\"primary\": {\"version\": 6, \"flags\": 0, \"length\": 0,"
+            " \"dest\": [0, 2], \"src\": [4, 2], \"report-to\": [0, 0],"
+            " \"custodian\": [0, 0], \"creation-ts\": %zu,"
+            " \"creation-seq\": 1, \"lifetime\": 3600, \"eids-size\": 0,"
+            " \"eids\": [\"ipn\", \"%zu.1\", \"dtn\"]}\n",
+            i * 1000, i);
+
+        strbuf_append(sbp, rec, (size_t) len);
+    }
+}
+
+TEST test_batch_compile_arena(void) {
+    strbuf_t *src;
+    strbuf_init(&src, 1);
+    append_primaries(&src, 100);
+
+    strbuf_t *expect, *out;
+    strbuf_init(&expect, 1);
+    strbuf_init(&out, 1);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+    batch_compile(&batch, src->buf, src->pos, true, &expect);
+    ASSERT_EQ(batch.failed, 0);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    batch_init(&batch, NULL, NULL);
+    batch.arena = &arena;
+
+    // Each record reuses the memory of the one before it.
+    size_t used = batch_compile(&batch, src->buf, src->pos / 2, false, &out);
+    const arena_chunk_t *chunk = arena.chunk;
+#ifdef MKBUNDLE_FIXED
+    // Blocks hold their memory themselves.
+    ASSERT(!chunk);
+#else
+    ASSERT(chunk);
+#endif
+
+    batch_compile(&batch, &src->buf[used], src->pos - used, true, &out);
+    ASSERT_EQ(batch.failed, 0);
+    ASSERT_EQ(arena.chunk, chunk);
+
+    ASSERT_EQ(out->pos, expect->pos);
+    ASSERT_EQ(memcmp(out->buf, expect->buf, out->pos), 0);
+
+    arena_destroy(&arena);
+    strbuf_destroy(out);
+    strbuf_destroy(expect);
+    strbuf_destroy(src);
+
+    PASS();
+}
+
+TEST test_batch_compile_no_alloc(void) {
+    static const char EXTENSION[] =
+        "\"extension\": {\"type\": 1, \"flags\": 0, \"payload-length\": 4,"
+        " \"ref-count\": 1, \"refs\": [[0, 2]]}\n";
+
+    strbuf_t *src, *out;
+    strbuf_init(&src, 1);
+    append_primaries(&src, 100);
+    strbuf_append(&src, EXTENSION, sizeof(EXTENSION) - 1);
+
+    // Output space is the caller's business, so it's reserved up front.
+    strbuf_init(&out, 1 << 16);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+#ifndef MKBUNDLE_FIXED
+    // Without fixed storage, blocks only stay off the heap once an arena has
+    // grown to fit them.
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+    batch.arena = &arena;
+
+    ASSERT(batch_compile_record(&batch, src->buf,
+                                parser_record_len(src->buf, src->pos), &out));
+    out->pos = 0;
+#endif
+
+    size_t before = util_alloc_count();
+
+    ASSERT_EQ(batch_compile(&batch, src->buf, src->pos, true, &out),
+              src->pos);
+    ASSERT_EQ(batch.failed, 0);
+    ASSERT_EQ(util_alloc_count(), before);
+
+#ifndef MKBUNDLE_FIXED
+    arena_destroy(&arena);
+#endif
+    strbuf_destroy(out);
+    strbuf_destroy(src);
+
+    PASS();
+}
+
+TEST test_batch_compile_sink(void) {
+    strbuf_t *src;
+    strbuf_init(&src, 1);
+    append_primaries(&src, 10);
+    strbuf_append(&src, "\"bogus\": []\n", 12);
+
+    strbuf_t *expect, *out;
+    strbuf_init(&expect, 1);
+    strbuf_init(&out, 1);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+    batch_compile(&batch, src->buf, src->pos, true, &expect);
+
+    sink_t sink;
+    sink_init_mem(&sink, &out);
+
+    batch_init(&batch, NULL, NULL);
+    ASSERT_EQ(batch_compile_sink(&batch, src->buf, src->pos, true, &sink),
+              src->pos);
+    ASSERT_EQ(batch.failed, 1);
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    ASSERT_EQ(out->pos, expect->pos);
+    ASSERT_EQ(memcmp(out->buf, expect->buf, out->pos), 0);
+
+    strbuf_destroy(out);
+    strbuf_destroy(expect);
+    strbuf_destroy(src);
+
+    PASS();
+}
+
+SUITE(batch_suite) {
+    RUN_TEST(test_batch_compile);
+    RUN_TEST(test_batch_compile_resync);
+    RUN_TEST(test_batch_compile_arena);
+    RUN_TEST(test_batch_compile_sink);
+    RUN_TEST(test_batch_compile_no_alloc);
+}
+#endif
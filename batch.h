@@ -0,0 +1,58 @@
+// See copyright notice in Copying.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "sink.h"
+#include "strbuf.h"
+
+// Called with the number, starting at 1, of each record that fails to compile.
+typedef void (*batch_error_fn)(void *ctx, size_t record);
+
+// Compiles a stream of concatenated params records into blocks.
+typedef struct {
+    // Reused for every record.
+    parser_t parser;
+    // Number of records seen so far.
+    size_t record;
+    // Number of records that failed to compile.
+    size_t failed;
+    // Arena for the memory each record needs, reset after every record, or
+    // NULL to use the heap.
+    arena_t *arena;
+
+    batch_error_fn on_error;
+    void *ctx;
+} batch_t;
+
+// Initialize the batch to the start of a stream, with no arena. The error
+// function may be NULL.
+void batch_init(batch_t *b, batch_error_fn on_error, void *ctx);
+
+// Compile a single params record and append the block to the strbuf. Return
+// true on success and false if the record is malformed, in which case nothing
+// is appended.
+bool batch_compile_record(batch_t *b, const char *src, size_t len,
+                          strbuf_t **out);
+
+// Count the current record as failed and report it.
+void batch_fail(batch_t *b);
+
+// Compile each complete record at the start of the buffer, appending its block
+// to the strbuf, and return the number of bytes consumed. Malformed records are
+// reported and skipped. A trailing partial record is left for the next call
+// unless eof is set, in which case it's reported as malformed.
+size_t batch_compile(batch_t *b, const char *buf, size_t len, bool eof,
+                     strbuf_t **out);
+
+// Compile like batch_compile, but write the blocks to the sink. If the sink
+// fails, the rest of the blocks are dropped, which sink_flush reports.
+size_t batch_compile_sink(batch_t *b, const char *buf, size_t len, bool eof,
+                          sink_t *s);
+
+#endif
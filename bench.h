@@ -0,0 +1,41 @@
+// See copyright notice in Copying.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+// Define a group of benchmarks, like a greatest suite.
+#define BENCH_SUITE(name) void name(void)
+
+// Run the given group of benchmarks.
+#define RUN_BENCH_SUITE(name) do { \
+    printf("* Bench %s:\n", #name); \
+    name(); \
+    putchar('\n'); \
+} while (0)
+
+// Get the current time in seconds.
+static inline double bench_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Print the rate of a benchmark that processed count units in the given
+// number of seconds.
+static inline void bench_report(const char *name, double count,
+                                const char *unit, double secs)
+{
+    printf("  %-40s %10.2f M%s/s\n", name, count / secs / 1e6, unit);
+}
+
+// Keep the optimizer from discarding a computed result.
+static inline void bench_keep(uint64_t x) {
+    __asm__ volatile("" : : "r"(x) : "memory");
+}
+
+#endif
@@ -4,11 +4,13 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "block.h"
 #include "ext-block.h"
 #include "parser.h"
 #include "primary-block.h"
+#include "sink.h"
 #include "util.h"
 
 #ifdef MKBUNDLE_TEST
@@ -16,8 +18,13 @@
 #endif
 
 void block_init(block_t *b) {
+    block_init_arena(b, NULL);
+}
+
+void block_init_arena(block_t *b, arena_t *arena) {
     *b = (block_t) {
         .type = BLOCK_TYPE_INVALID,
+        .arena = arena,
     };
 }
 
@@ -66,27 +73,21 @@ TEST test_parse_block_type(void) {
 }
 #endif
 
-bool block_unserialize(block_t *b, const char *buf, size_t len) {
-    parser_t parser;
-    parser_init(&parser);
-
-    if (!parser_parse(&parser, buf, len))
-        return false;
-
-    b->type = parse_block_type(&parser);
+bool block_parse_params(block_t *b, block_type_t type, parser_t *p) {
+    b->type = type;
 
     switch (b->type) {
     case BLOCK_TYPE_PRIMARY:
-        primary_block_init(&b->primary);
+        primary_block_init_arena(&b->primary, b->arena);
 
-        if (!primary_block_unserialize(&b->primary, &parser))
+        if (!primary_block_unserialize(&b->primary, p))
             return false;
     break;
 
     case BLOCK_TYPE_EXT:
         ext_block_init(&b->ext);
 
-        if (!ext_block_unserialize(&b->ext, &parser))
+        if (!ext_block_unserialize(&b->ext, p))
             return false;
     break;
 
@@ -98,14 +99,28 @@ bool block_unserialize(block_t *b, const char *buf, size_t len) {
     return true;
 }
 
-void block_write(const block_t *b, FILE *stream) {
+bool block_parse(block_t *b, parser_t *p) {
+    return block_parse_params(b, parse_block_type(p), p);
+}
+
+bool block_unserialize(block_t *b, const char *buf, size_t len) {
+    parser_t parser;
+    parser_init(&parser);
+
+    if (!parser_parse(&parser, buf, len))
+        return false;
+
+    return block_parse(b, &parser);
+}
+
+void block_encode(const block_t *b, strbuf_t **sbp) {
     switch (b->type) {
     case BLOCK_TYPE_PRIMARY:
-        primary_block_write(&b->primary, stream);
+        primary_block_encode(&b->primary, sbp);
     break;
 
     case BLOCK_TYPE_EXT:
-        ext_block_write(&b->ext, stream);
+        ext_block_encode(&b->ext, sbp);
     break;
 
     case BLOCK_TYPE_INVALID:
@@ -113,8 +128,57 @@ void block_write(const block_t *b, FILE *stream) {
     }
 }
 
+bool block_write(const block_t *b, sink_t *s) {
+    switch (b->type) {
+    case BLOCK_TYPE_PRIMARY:
+        return primary_block_write(&b->primary, s);
+
+    case BLOCK_TYPE_EXT:
+        return ext_block_write(&b->ext, s);
+
+    case BLOCK_TYPE_INVALID:
+    break;
+    }
+
+    return !s->error;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_block_write(void) {
+    static const char J[] =
+        "\"extension\": {\"type\": 1, \"flags\": 8, \"payload-length\": 300,"
+        " \"ref-count\": 0, \"refs\": []}";
+
+    block_t block;
+    block_init(&block);
+    ASSERT(block_unserialize(&block, J, sizeof(J) - 1));
+
+    FILE *f = fopen("test", "w+");
+    fputc('x', f);
+
+    sink_t sink;
+    sink_init_stdio(&sink, f);
+    ASSERT(block_write(&block, &sink));
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    uint8_t buf[8];
+    rewind(f);
+    ASSERT_EQ(fread(buf, 1, sizeof(buf), f), 5);
+
+    static const uint8_t EXPECT[] = {'x', 0x01, 0x08, 0x82, 0x2c};
+    ASSERT_EQ(memcmp(buf, EXPECT, sizeof(EXPECT)), 0);
+
+    block_destroy(&block);
+    fclose(f);
+
+    PASS();
+}
+#endif
+
 #ifdef MKBUNDLE_TEST
 SUITE(block_suite) {
     RUN_TEST(test_parse_block_type);
+    RUN_TEST(test_block_write);
 }
 #endif
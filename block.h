@@ -8,8 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "ext-block.h"
+#include "parser.h"
 #include "primary-block.h"
+#include "sink.h"
+#include "strbuf.h"
 
 typedef enum {
     BLOCK_TYPE_PRIMARY,
@@ -21,6 +25,8 @@ typedef enum {
 // An wrapper around available block types.
 typedef struct {
     block_type_t type;
+    // Arena for any memory the block needs, or NULL to use the heap.
+    arena_t *arena;
 
     union {
         primary_block_t primary;
@@ -31,14 +37,30 @@ typedef struct {
 // Initialize the block to a default state.
 void block_init(block_t *b);
 
+// Initialize the block to a default state, allocating from the arena once its
+// type is known, or from the heap if it's NULL.
+void block_init_arena(block_t *b, arena_t *arena);
+
 // Free any memory held by the block.
 void block_destroy(block_t *b);
 
+// Parse the params object at the parser's current token into a block of the
+// given type. Return true on success and false otherwise.
+bool block_parse_params(block_t *b, block_type_t type, parser_t *p);
+
+// Parse the block key and params object at the parser's current token into a
+// specific block. Return true on success and false otherwise.
+bool block_parse(block_t *b, parser_t *p);
+
 // Parse the parameters in the buffer into a specific block. Return true on
 // success and false otherwise.
 bool block_unserialize(block_t *b, const char *buf, size_t len);
 
-// Write the binary form of the block to the file.
-void block_write(const block_t *b, FILE *stream);
+// Append the binary form of the block to the strbuf.
+void block_encode(const block_t *b, strbuf_t **sbp);
+
+// Write the binary form of the block straight into the sink. Return true on
+// success and false if the sink has failed.
+bool block_write(const block_t *b, sink_t *s);
 
 #endif
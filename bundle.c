@@ -0,0 +1,518 @@
+// See copyright notice in Copying.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "bundle.h"
+#include "common-block.h"
+#include "gather.h"
+#include "parser.h"
+#include "sink.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#include "test-params.h"
+#endif
+
+// A block in the spec along with its payload.
+typedef struct {
+    block_t block;
+    strbuf_t *payload;
+    // Regular file holding the payload instead, or -1.
+    int file;
+    size_t file_len;
+} entry_t;
+
+static void entry_init(entry_t *e, arena_t *arena) {
+    block_init_arena(&e->block, arena);
+    strbuf_init_arena(&e->payload, 1 << 6, arena);
+    e->file = -1;
+    e->file_len = 0;
+}
+
+static void entry_destroy(entry_t *e) {
+    block_destroy(&e->block);
+    strbuf_destroy(e->payload);
+
+    if (e->file >= 0)
+        close(e->file);
+}
+
+// Get the payload from the file named by the current token. If the payload is
+// only referenced and the file is a regular one, it's kept open to be copied
+// later, with its length taken from fstat. Otherwise its contents are appended
+// to the payload.
+static bool read_payload_file(entry_t *e, parser_t *p, bool ref) {
+    strbuf_t *path;
+    strbuf_init_arena(&path, 1 << 6, e->payload->arena);
+
+    bool ret = parser_parse_str(p, &path);
+    int fd = -1;
+
+    if (ret) {
+        strbuf_finish(&path);
+        fd = open(path->buf, O_RDONLY);
+        ret = fd >= 0;
+    }
+
+    strbuf_destroy(path);
+
+    if (!ret)
+        return false;
+
+    struct stat st;
+
+    if (ref && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        e->file = fd;
+        e->file_len = (size_t) st.st_size;
+
+        return true;
+    }
+
+    FILE *f = fdopen(fd, "rb");
+
+    if (!f) {
+        close(fd);
+        return false;
+    }
+
+    collect(&e->payload, f);
+    ret = !ferror(f);
+    fclose(f);
+
+    return ret;
+}
+
+// Parse an element of the spec, which must hold a block of the given type,
+// with the given bundle_flag_t flags. Payload files are only referenced if ref
+// is set.
+static bool parse_entry(parser_t *p, entry_t *e, block_type_t type,
+                        unsigned flags, bool ref, const char *src, size_t len)
+{
+    enum {
+        SYM_PRIMARY,
+        SYM_EXTENSION,
+        SYM_PAYLOAD,
+        SYM_PAYLOAD_FILE,
+    };
+
+    static const char *MAP[] = {
+        [SYM_PRIMARY] = "primary",
+        [SYM_EXTENSION] = "extension",
+        [SYM_PAYLOAD] = "payload",
+        [SYM_PAYLOAD_FILE] = "payload-file",
+    };
+
+    if (!parser_parse(p, src, len) || p->cur->type != JSMN_OBJECT)
+        return false;
+
+    int pair_count = p->cur->size / 2;
+
+    if (!parser_advance(p))
+        return false;
+
+    uint32_t symbols = 0;
+
+    for (int i = 0; i < pair_count; i += 1) {
+        uint32_t sym = parser_parse_sym(p, MAP, ASIZE(MAP));
+
+        if (sym == SYM_INVALID || symbols & 1u << sym)
+            return false;
+
+        symbols |= 1u << sym;
+
+        switch (sym) {
+        case SYM_PRIMARY:
+            if (type != BLOCK_TYPE_PRIMARY ||
+                !block_parse_params(&e->block, type, p))
+            {
+                return false;
+            }
+        break;
+
+        case SYM_EXTENSION:
+            if (type != BLOCK_TYPE_EXT ||
+                !block_parse_params(&e->block, type, p))
+            {
+                return false;
+            }
+        break;
+
+        case SYM_PAYLOAD:
+            if (!parser_parse_str(p, &e->payload))
+                return false;
+        break;
+
+        case SYM_PAYLOAD_FILE:
+            if (flags & BUNDLE_NO_FILES || !read_payload_file(e, p, ref))
+                return false;
+        break;
+        }
+    }
+
+    // The primary block has no payload.
+    if (type == BLOCK_TYPE_PRIMARY)
+        return symbols == 1u << SYM_PRIMARY;
+
+    return (symbols & 1u << SYM_EXTENSION) &&
+           !(symbols & 1u << SYM_PAYLOAD && symbols & 1u << SYM_PAYLOAD_FILE);
+}
+
+// Write the binary form of the entry and its payload to the gather list if
+// there is one, or the sink otherwise.
+static void emit_entry(sink_t *s, gather_t *g, entry_t *e, bool last) {
+    if (e->block.type == BLOCK_TYPE_EXT) {
+        ext_block_t *ext = &e->block.ext;
+
+        ext->length = e->file >= 0 ? e->file_len : e->payload->pos;
+        ext->flags = (uint8_t)(last ? ext->flags | FLAG_LAST_BLOCK :
+                                      ext->flags & ~FLAG_LAST_BLOCK);
+    }
+
+    if (g)
+        block_encode(&e->block, g->sbp);
+    else
+        block_write(&e->block, s);
+
+    // Files are only kept open when gathering, and the list closes them once
+    // they're written.
+    if (e->file >= 0) {
+        gather_ref_file(g, e->file, 0, e->file_len);
+        e->file = -1;
+        return;
+    }
+
+    if (g)
+        gather_ref(g, e->payload->buf, e->payload->pos);
+    else
+        sink_write(s, e->payload->buf, e->payload->pos);
+}
+
+// Build the bundle as described for bundle_build and bundle_gather, leaving
+// the arena as it is.
+static bool build(parser_t *p, arena_t *arena, sink_t *s, gather_t *g,
+                  const char *spec, size_t len, unsigned flags)
+{
+    size_t pos = parser_skip_space(spec, len, 0);
+
+    if (pos == len || spec[pos] != '[')
+        return false;
+
+    pos = parser_skip_space(spec, len, pos + 1);
+
+    // Each entry is held back until the next one is parsed, so the last block
+    // can be flagged. Entries take turns in two slots instead of being copied,
+    // since a fixed block points into itself.
+    entry_t entries[2];
+    entry_t *prev = NULL;
+    size_t count = 0;
+    bool ret = true;
+
+    while (ret && pos < len && spec[pos] != ']') {
+        if (count) {
+            if (spec[pos] != ',') {
+                ret = false;
+                break;
+            }
+
+            pos = parser_skip_space(spec, len, pos + 1);
+        }
+
+        size_t doc_len = parser_doc_len(&spec[pos], len - pos);
+
+        entry_t *e = &entries[count % 2];
+        entry_init(e, arena);
+
+        ret = doc_len && parse_entry(p, e,
+            count ? BLOCK_TYPE_EXT : BLOCK_TYPE_PRIMARY, flags, g != NULL,
+            &spec[pos], doc_len);
+
+        if (!ret) {
+            entry_destroy(e);
+            break;
+        }
+
+        if (prev) {
+            emit_entry(s, g, prev, false);
+            entry_destroy(prev);
+        }
+
+        prev = e;
+        count += 1;
+        pos = parser_skip_space(spec, len, pos + doc_len);
+    }
+
+    // The spec must be terminated and hold at least the primary block.
+    ret = ret && pos < len && count;
+
+    if (prev) {
+        if (ret)
+            emit_entry(s, g, prev, true);
+
+        entry_destroy(prev);
+    }
+
+    return ret;
+}
+
+bool bundle_build(parser_t *p, arena_t *arena, strbuf_t **sbp,
+                  const char *spec, size_t len, unsigned flags)
+{
+    sink_t s;
+    sink_init_mem(&s, sbp);
+
+    // A memory sink can't fail.
+    bool ret = bundle_build_sink(p, arena, &s, spec, len, flags);
+    sink_flush(&s);
+    sink_destroy(&s);
+
+    return ret;
+}
+
+bool bundle_build_sink(parser_t *p, arena_t *arena, sink_t *s,
+                       const char *spec, size_t len, unsigned flags)
+{
+    bool ret = build(p, arena, s, NULL, spec, len, flags);
+
+    if (arena)
+        arena_reset(arena);
+
+    return ret;
+}
+
+bool bundle_gather(parser_t *p, arena_t *arena, gather_t *g,
+                   const char *spec, size_t len)
+{
+    // Payloads must outlive their entries.
+    assert(arena);
+
+    return build(p, arena, NULL, g, spec, len, 0);
+}
+
+#ifdef MKBUNDLE_TEST
+// Params of an extension block with the given type and flags, whose payload
+// length is filled in by the build.
+#define EXTENSION(type, flags) TEST_EXTENSION(type, flags, 0)
+
+TEST test_bundle_build(void) {
+    static const char SPEC[] =
+        "[\n"
+        "  " TEST_PRIMARY ",\n"
+        "  {" EXTENSION(5, 24) ", \"payload\": \"ipn:1.0\\u0000\"},\n"
+        "  {\"payload\": \"test\", " EXTENSION(1, 0) "}\n"
+        "]\n";
+
+    parser_t parser;
+    parser_init(&parser);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    ASSERT(bundle_build(&parser, &arena, &sb, SPEC, sizeof(SPEC) - 1, 0));
+
+    static const uint8_t EXPECT[] = {
+        // Primary block.
+        0x06, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x01, 0x02, 0x03, 0x00,
+        // PHIB without last-block.
+        0x05, 0x10, 0x08, 'i', 'p', 'n', ':', '1', '.', '0', 0x00,
+        // Payload with last-block.
+        0x01, 0x08, 0x04, 't', 'e', 's', 't',
+    };
+
+    ASSERT_EQ(sb->pos, sizeof(EXPECT));
+    ASSERT_EQ(memcmp(sb->buf, EXPECT, sizeof(EXPECT)), 0);
+
+    strbuf_destroy(sb);
+    arena_destroy(&arena);
+
+    PASS();
+}
+
+TEST test_bundle_build_payload_file(void) {
+    FILE *f = fopen("test", "w");
+    fputs("abc", f);
+    fclose(f);
+
+    static const char SPEC[] =
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"payload-file\": \"test\"}]";
+
+    parser_t parser;
+    parser_init(&parser);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    ASSERT(bundle_build(&parser, NULL, &sb, SPEC, sizeof(SPEC) - 1, 0));
+    ASSERT_EQ(sb->pos, 15 + 6);
+    ASSERT_EQ(memcmp(&sb->buf[15], "\x01\x08\x03" "abc", 6), 0);
+
+    // Files can be refused.
+    sb->pos = 0;
+    ASSERT(!bundle_build(&parser, NULL, &sb, SPEC, sizeof(SPEC) - 1,
+                         BUNDLE_NO_FILES));
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_bundle_build_invalid(void) {
+    static const char *SPECS[] = {
+        "",
+        "[]",
+        "{" EXTENSION(1, 0) "}",
+        "[{" EXTENSION(1, 0) "}]",
+        "[" TEST_PRIMARY ", " TEST_PRIMARY "]",
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) "}",
+        "[" TEST_PRIMARY " {" EXTENSION(1, 0) "}]",
+        "[" TEST_PRIMARY ", {\"payload\": \"a\"}]",
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"payload\": 1}]",
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"other\": \"a\"}]",
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"payload-file\": \"\"}]",
+    };
+
+    parser_t parser;
+    parser_init(&parser);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    for (size_t i = 0; i < ASIZE(SPECS); i += 1)
+        ASSERT(!bundle_build(&parser, &arena, &sb, SPECS[i],
+                             strlen(SPECS[i]), 0));
+
+    strbuf_destroy(sb);
+    arena_destroy(&arena);
+
+    PASS();
+}
+
+TEST test_bundle_gather(void) {
+    // A payload big enough to be gathered by reference, and a small one.
+    static const char START[] =
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"payload\": \"";
+    static const char END[] =
+        "\"}, {" EXTENSION(5, 0) ", \"payload\": \"a\"}]";
+
+    strbuf_t *spec;
+    strbuf_init(&spec, 1);
+    strbuf_append(&spec, START, sizeof(START) - 1);
+
+    for (size_t i = 0; i < 2 * GATHER_REF_MIN; i += 1)
+        strbuf_append(&spec, "x", 1);
+
+    strbuf_append(&spec, END, sizeof(END) - 1);
+
+    parser_t parser;
+    parser_init(&parser);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    strbuf_t *expect, *sb;
+    strbuf_init(&expect, 1);
+    strbuf_init(&sb, 1);
+
+    ASSERT(bundle_build(&parser, &arena, &expect, spec->buf, spec->pos,
+                         0));
+
+    gather_t g;
+    gather_init(&g, &sb);
+    ASSERT(bundle_gather(&parser, &arena, &g, spec->buf, spec->pos));
+
+    // Only the big payload is left out of the strbuf.
+    ASSERT_EQ(sb->pos, expect->pos - 2 * GATHER_REF_MIN);
+    ASSERT_EQ(gather_len(&g), expect->pos);
+
+    FILE *f = fopen("test", "w+");
+    ASSERT(gather_write(&g, fileno(f)));
+    arena_reset(&arena);
+
+    strbuf_t *got;
+    strbuf_init(&got, 1);
+    rewind(f);
+    collect(&got, f);
+    fclose(f);
+
+    ASSERT_EQ(got->pos, expect->pos);
+    ASSERT_EQ(memcmp(got->buf, expect->buf, got->pos), 0);
+
+    strbuf_destroy(got);
+    gather_destroy(&g);
+    strbuf_destroy(sb);
+    strbuf_destroy(expect);
+    arena_destroy(&arena);
+    strbuf_destroy(spec);
+
+    PASS();
+}
+
+TEST test_bundle_gather_file(void) {
+    FILE *f = fopen("test", "w");
+    fputs("abc", f);
+    fclose(f);
+
+    static const char SPEC[] =
+        "[" TEST_PRIMARY ", {" EXTENSION(1, 0) ", \"payload-file\": \"test\"}]";
+
+    parser_t parser;
+    parser_init(&parser);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    gather_t g;
+    gather_init(&g, &sb);
+    ASSERT(bundle_gather(&parser, &arena, &g, SPEC, sizeof(SPEC) - 1));
+
+    // The file is referenced, so only the blocks are in the strbuf.
+    ASSERT_EQ(sb->pos, 15 + 3);
+    ASSERT_EQ(memcmp(&sb->buf[15], "\x01\x08\x03", 3), 0);
+    ASSERT_EQ(gather_len(&g), 15 + 6);
+
+    FILE *out = tmpfile();
+    ASSERT(gather_write(&g, fileno(out)));
+
+    char got[8] = {0};
+    ASSERT_EQ(fseek(out, 15 + 3, SEEK_SET), 0);
+    ASSERT_EQ(fread(got, 1, sizeof(got), out), 3);
+    ASSERT_STR_EQ(got, "abc");
+
+    fclose(out);
+    gather_destroy(&g);
+    strbuf_destroy(sb);
+    arena_destroy(&arena);
+
+    PASS();
+}
+
+SUITE(bundle_suite) {
+    RUN_TEST(test_bundle_build);
+    RUN_TEST(test_bundle_build_payload_file);
+    RUN_TEST(test_bundle_build_invalid);
+    RUN_TEST(test_bundle_gather);
+    RUN_TEST(test_bundle_gather_file);
+}
+#endif
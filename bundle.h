@@ -0,0 +1,56 @@
+// See copyright notice in Copying.
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "gather.h"
+#include "parser.h"
+#include "sink.h"
+#include "strbuf.h"
+
+typedef enum {
+    // Refuse payload files, for specs from untrusted sources, which could
+    // otherwise read any file this process can.
+    BUNDLE_NO_FILES = 1 << 0,
+} bundle_flag_t;
+
+// Assemble the bundle described by the given spec and append its binary form
+// to the strbuf. The spec is a JSON array whose first element holds the params
+// of a primary block and whose other elements hold the params of extension
+// blocks, like
+//
+//   [
+//     {"primary": {...}},
+//     {"extension": {...}, "payload": "ipn:1.0\u0000"},
+//     {"extension": {...}, "payload-file": "data.bin"}
+//   ]
+//
+// Each extension block is followed by its payload, which is empty if not
+// given. The payload length and last-block flag of each extension block are
+// set automatically. The parser is reused for each element. Blocks and
+// payloads are held in the arena, which is reset before returning, or on the
+// heap if it's NULL. The strbuf must not be in the arena. The build is
+// controlled by the given bundle_flag_t flags. Return true on success and
+// false otherwise.
+bool bundle_build(parser_t *p, arena_t *arena, strbuf_t **sbp,
+                  const char *spec, size_t len, unsigned flags);
+
+// Like bundle_build, but write the bundle to the sink. If the sink fails, the
+// rest of the bundle is dropped, which sink_flush reports.
+bool bundle_build_sink(parser_t *p, arena_t *arena, sink_t *s,
+                       const char *spec, size_t len, unsigned flags);
+
+// Like bundle_build, but add the bundle to the gather list: block headers and
+// small payloads are appended to its strbuf, and larger payloads are added by
+// reference instead of being copied. Payload files that are regular files are
+// added by reference too, with their lengths taken from fstat. The payloads
+// live in the arena, which must not be NULL and must not be reset until the
+// list has been written.
+bool bundle_gather(parser_t *p, arena_t *arena, gather_t *g,
+                   const char *spec, size_t len);
+
+#endif
@@ -9,6 +9,7 @@
 #include "eid.h"
 #include "ext-block.h"
 #include "parser.h"
+#include "sink.h"
 #include "util.h"
 
 #ifdef MKBUNDLE_TEST
@@ -25,9 +26,9 @@ void ext_block_init(ext_block_t *b) {
     eid_refs_init(&b->refs);
 }
 
-static void serialize_refs(const ext_block_t *b, FILE *stream) {
+static void serialize_refs(const ext_block_t *b, sink_t *s) {
     for (size_t i = 0; i < b->refs.len; i += 1) {
-        fprintf(stream,
+        sink_printf(s,
             "    [%" PRIu32 ", %" PRIu32 "]"
             ,
             b->refs.slots[i].scheme,
@@ -35,26 +36,35 @@ static void serialize_refs(const ext_block_t *b, FILE *stream) {
         );
 
         if (i < b->refs.len - 1)
-            fputc(',', stream);
+            sink_putc(s, ',');
 
-        fputc('\n', stream);
+        sink_putc(s, '\n');
     }
 }
 
 #ifdef MKBUNDLE_TEST
+// Serialize the refs into the strbuf, replacing its contents, and terminate
+// it.
+static void serialize_refs_str(const ext_block_t *b, strbuf_t **out) {
+    (*out)->pos = 0;
+
+    sink_t sink;
+    sink_init_mem(&sink, out);
+    serialize_refs(b, &sink);
+    sink_flush(&sink);
+
+    strbuf_finish(out);
+}
+
 TEST test_serialize_refs(void) {
     ext_block_t block;
     ext_block_init(&block);
 
-    FILE *f = fopen("test", "w+");
-    char buf[256] = {0};
-
-    rewind(f);
-    serialize_refs(&block, f);
+    strbuf_t *out;
+    strbuf_init(&out, 1);
 
-    rewind(f);
-    fread(buf, sizeof(buf[0]), sizeof(buf), f);
-    ASSERT_STR_EQ(buf, "");
+    serialize_refs_str(&block, &out);
+    ASSERT_STR_EQ(out->buf, "");
 
     {
         eid_t *eid = eid_refs_push(&block.refs);
@@ -62,12 +72,8 @@ TEST test_serialize_refs(void) {
         eid->ssp = 84;
     }
 
-    rewind(f);
-    serialize_refs(&block, f);
-
-    rewind(f);
-    fread(buf, sizeof(char), sizeof(buf), f);
-    ASSERT_STR_EQ(buf, "    [42, 84]\n");
+    serialize_refs_str(&block, &out);
+    ASSERT_STR_EQ(out->buf, "    [42, 84]\n");
 
     {
         eid_t *eid = eid_refs_push(&block.refs);
@@ -75,27 +81,23 @@ TEST test_serialize_refs(void) {
         eid->ssp = 4294967295u;
     }
 
-    rewind(f);
-    serialize_refs(&block, f);
-
-    rewind(f);
-    fread(buf, sizeof(char), sizeof(buf), f);
-    ASSERT_STR_EQ(buf,
+    serialize_refs_str(&block, &out);
+    ASSERT_STR_EQ(out->buf,
         "    [42, 84],\n"
         "    [4294967295, 4294967295]\n");
 
-    fclose(f);
+    strbuf_destroy(out);
 
     PASS();
 }
 #endif
 
-void ext_block_serialize(const ext_block_t *b, FILE *stream) {
-    fprintf(stream,
+void ext_block_serialize(const ext_block_t *b, sink_t *s) {
+    sink_printf(s,
         "\"extension\": {\n"
         "  \"type\": %" PRIu8 ",\n"
         "  \"flags\": %" PRIu8 ",\n"
-        "  \"payload-length\": %" PRIu32 ",\n"
+        "  \"payload-length\": %" PRIu64 ",\n"
         "  \"ref-count\": %" PRIu32 ",\n"
         "  \"refs\": [\n"
         ,
@@ -105,13 +107,11 @@ void ext_block_serialize(const ext_block_t *b, FILE *stream) {
         b->ref_count
     );
 
-    serialize_refs(b, stream);
+    serialize_refs(b, s);
 
-    fputs(
+    sink_puts(s,
         "  ]\n"
         "}\n"
-        ,
-        stream
     );
 }
 
@@ -177,12 +177,19 @@ bool ext_block_unserialize(ext_block_t *b, parser_t *p) {
         [SYM_REFS] = "refs",
     };
 
+    if (p->cur->type != JSMN_OBJECT)
+        return false;
+
+    // Only visit this object's keys, so it can be embedded in a larger
+    // document. The object size counts both keys and values.
+    int pair_count = p->cur->size / 2;
+
     if (!parser_advance(p))
         return false;
 
     uint32_t symbols = 0;
 
-    while (parser_more(p)) {
+    for (int i = 0; i < pair_count; i += 1) {
         uint32_t sym = parser_parse_sym(p, MAP, ASIZE(MAP));
         symbols |= 1u << sym;
 
@@ -196,7 +203,7 @@ bool ext_block_unserialize(ext_block_t *b, parser_t *p) {
         break;
 
         case SYM_LENGTH:
-            b->length = parser_parse_u32(p);
+            b->length = parser_parse_u64(p);
         break;
 
         case SYM_REF_COUNT:
@@ -220,20 +227,82 @@ bool ext_block_unserialize(ext_block_t *b, parser_t *p) {
     return symbols == SYM_MASK;
 }
 
-void ext_block_write(const ext_block_t *b, FILE *stream) {
-    WRITE(stream, &b->type, sizeof(b->type));
-    WRITE_SDNV(stream, b->flags);
+// Get the most bytes the block can encode to: the type byte, flags, ref count,
+// refs and length.
+static inline size_t encoded_max(const ext_block_t *b) {
+    return 1 + SDNV_MAX_U64 * (3 + 2 * b->refs.len);
+}
+
+// Encode the block at the cursor, which must have room for encoded_max bytes,
+// and return the cursor past it.
+static uint8_t *put_block(const ext_block_t *b, uint8_t *cur) {
+    *cur++ = b->type;
+    PUT_SDNV(cur, b->flags);
 
     if (b->ref_count) {
-        WRITE_SDNV(stream, SWAP32(b->ref_count));
+        PUT_SDNV(cur, b->ref_count);
 
         for (size_t i = 0; i < b->refs.len; i += 1)
-            WRITE_EID(stream, &b->refs.slots[i]);
+            PUT_EID(cur, &b->refs.slots[i]);
     }
 
-    WRITE_SDNV(stream, SWAP32(b->length));
+    PUT_SDNV(cur, b->length);
+
+    return cur;
+}
+
+void ext_block_encode(const ext_block_t *b, strbuf_t **sbp) {
+    strbuf_expect(sbp, encoded_max(b));
+
+    uint8_t *start = STRBUF_CURSOR(*sbp);
+    (*sbp)->pos += (size_t)(put_block(b, start) - start);
 }
 
+bool ext_block_write(const ext_block_t *b, sink_t *s) {
+    uint8_t *start = sink_reserve(s, encoded_max(b));
+
+    if (!start)
+        return false;
+
+    sink_commit(s, (size_t)(put_block(b, start) - start));
+
+    return true;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_ext_block_encode(void) {
+    ext_block_t block;
+    ext_block_init(&block);
+
+    block.type = EXT_BLOCK_PAYLOAD;
+    block.flags = 0x08;
+    block.length = UINT64_C(5) << 32;
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+    ext_block_encode(&block, &sb);
+
+    static const uint8_t EXPECT[] = {0x01, 0x08, 0xd0, 0x80, 0x80, 0x80, 0x00};
+    ASSERT_EQ(sb->pos, sizeof(EXPECT));
+    ASSERT_EQ(memcmp(sb->buf, EXPECT, sizeof(EXPECT)), 0);
+
+    block.ref_count = 1;
+    ASSERT(ext_block_add_ref(&block, "4:200"));
+    block.length = 1;
+
+    sb->pos = 0;
+    ext_block_encode(&block, &sb);
+
+    static const uint8_t REFS[] = {0x01, 0x08, 0x01, 0x04, 0x81, 0x48, 0x01};
+    ASSERT_EQ(sb->pos, sizeof(REFS));
+    ASSERT_EQ(memcmp(sb->buf, REFS, sizeof(REFS)), 0);
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+#endif
+
 static bool parse_ref(eid_t *e, const char *str) {
     const char *sep = strchr(str, ':');
 
@@ -314,5 +383,6 @@ SUITE(ext_block_suite) {
     RUN_TEST(test_parse_refs);
     RUN_TEST(test_parse_ref);
     RUN_TEST(test_ext_block_add_ref);
+    RUN_TEST(test_ext_block_encode);
 }
 #endif
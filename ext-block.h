@@ -9,6 +9,8 @@
 
 #include "eid.h"
 #include "parser.h"
+#include "sink.h"
+#include "strbuf.h"
 
 #define ALIST_RESET
 #include "alist.h"
@@ -31,18 +33,21 @@ typedef enum {
 typedef struct {
     uint8_t type;
     uint8_t flags;
-    uint32_t length;
+    uint64_t length;
     uint32_t ref_count;
     eid_refs_t refs;
 } ext_block_t;
 
 void ext_block_init(ext_block_t *b);
 
-void ext_block_serialize(const ext_block_t *b, FILE *stream);
+void ext_block_serialize(const ext_block_t *b, sink_t *s);
 
 bool ext_block_unserialize(ext_block_t *b, parser_t *p);
 
-void ext_block_write(const ext_block_t *b, FILE *stream);
+void ext_block_encode(const ext_block_t *b, strbuf_t **sbp);
+
+// Encode the block into the sink. Return false if the sink has failed.
+bool ext_block_write(const ext_block_t *b, sink_t *s);
 
 bool ext_block_add_ref(ext_block_t *b, const char *str);
 
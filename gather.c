@@ -0,0 +1,400 @@
+// See copyright notice in Copying.
+
+// For IOV_MAX and copy_file_range.
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "gather.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include <fcntl.h>
+#include <stdio.h>
+
+#include "greatest.h"
+#endif
+
+void gather_init(gather_t *g, strbuf_t **sbp) {
+    *g = (gather_t) {
+        .sbp = sbp,
+        .mark = (*sbp)->pos,
+    };
+}
+
+enum {
+    // Size of the buffer files are copied through when the kernel can't copy
+    // them itself. It lives on the caller's stack, so keep it small.
+    COPY_BUF = 1 << 14,
+};
+
+// Close the files referenced by the list.
+static void close_files(gather_t *g) {
+    for (size_t i = 0; i < g->seg_count; i += 1)
+        if (g->segs[i].fd >= 0)
+            close(g->segs[i].fd);
+}
+
+void gather_destroy(gather_t *g) {
+    close_files(g);
+    free(g->segs);
+    g->segs = NULL;
+}
+
+void gather_reset(gather_t *g) {
+    close_files(g);
+    g->seg_count = 0;
+    g->mark = (*g->sbp)->pos;
+}
+
+static void add_seg(gather_t *g, const char *base, int fd, size_t off,
+                    size_t len)
+{
+    if (!len) {
+        if (fd >= 0)
+            close(fd);
+
+        return;
+    }
+
+    if (g->seg_count == g->seg_cap) {
+        g->seg_cap = g->seg_cap ? 2 * g->seg_cap : 16;
+        g->segs = realloc(g->segs, g->seg_cap * sizeof(gather_seg_t));
+        assert(g->segs);
+    }
+
+    g->segs[g->seg_count++] = (gather_seg_t) {
+        .base = base,
+        .fd = fd,
+        .off = off,
+        .len = len,
+    };
+}
+
+// Cover bytes appended to the strbuf since the last segment.
+static void close_span(gather_t *g) {
+    size_t pos = (*g->sbp)->pos;
+    assert(pos >= g->mark);
+
+    gather_seg_t *last = g->seg_count ? &g->segs[g->seg_count - 1] : NULL;
+
+    // Spans of the strbuf always end at the mark, so a new one can extend the
+    // last segment if it's a span too.
+    if (last && !last->base && last->fd < 0)
+        last->len += pos - g->mark;
+    else
+        add_seg(g, NULL, -1, g->mark, pos - g->mark);
+
+    g->mark = pos;
+}
+
+void gather_ref(gather_t *g, const void *buf, size_t len) {
+    if (len < GATHER_REF_MIN) {
+        strbuf_append(g->sbp, buf, len);
+        return;
+    }
+
+    close_span(g);
+    add_seg(g, buf, -1, 0, len);
+}
+
+void gather_ref_file(gather_t *g, int fd, size_t off, size_t len) {
+    close_span(g);
+    add_seg(g, NULL, fd, off, len);
+}
+
+size_t gather_len(gather_t *g) {
+    close_span(g);
+
+    size_t len = 0;
+
+    for (size_t i = 0; i < g->seg_count; i += 1)
+        len += g->segs[i].len;
+
+    return len;
+}
+
+// Copy len bytes of the file starting at the offset to the file descriptor.
+// The kernel copies between files with copy_file_range, and to anything else,
+// like a pipe or socket, with sendfile. Only if it can do neither are the bytes
+// read and written here.
+static bool copy_file(int out, int in, size_t off, size_t len) {
+    off_t pos = (off_t) off;
+    bool range = true;
+    bool send = true;
+
+    while (len) {
+        ssize_t ret;
+
+        if (range)
+            ret = copy_file_range(in, &pos, out, NULL, len, 0);
+        else if (send)
+            ret = sendfile(out, in, &pos, len);
+        else {
+            char buf[COPY_BUF];
+            ret = pread(in, buf, len < sizeof(buf) ? len : sizeof(buf), pos);
+
+            if (ret > 0 && !write_all(out, buf, (size_t) ret))
+                return false;
+
+            if (ret > 0)
+                pos += ret;
+        }
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // These files can't be copied this way, so try the next one.
+            if (range && (errno == EXDEV || errno == EINVAL ||
+                          errno == EBADF || errno == ENOSYS ||
+                          errno == EOPNOTSUPP))
+            {
+                range = false;
+                continue;
+            }
+
+            if (!range && send && (errno == EINVAL || errno == ENOSYS)) {
+                send = false;
+                continue;
+            }
+
+            return false;
+        }
+
+        // The file is shorter than it was said to be.
+        if (!ret)
+            return false;
+
+        len -= (size_t) ret;
+    }
+
+    return true;
+}
+
+bool gather_write(gather_t *g, int fd) {
+    close_span(g);
+
+    struct iovec iov[IOV_MAX];
+    size_t seg = 0;
+    // Bytes of the current segment already written.
+    size_t done = 0;
+
+    while (seg < g->seg_count) {
+        if (g->segs[seg].fd >= 0) {
+            const gather_seg_t *s = &g->segs[seg];
+
+            if (!copy_file(fd, s->fd, s->off, s->len))
+                return false;
+
+            seg += 1;
+            continue;
+        }
+
+        size_t count = 0;
+
+        for (size_t i = seg; i < g->seg_count && count < ASIZE(iov) &&
+                             g->segs[i].fd < 0; i += 1)
+        {
+            const gather_seg_t *s = &g->segs[i];
+            const char *base = s->base ? s->base : &(*g->sbp)->buf[s->off];
+            size_t skip = i == seg ? done : 0;
+
+            iov[count++] = (struct iovec) {
+                .iov_base = (void *)(uintptr_t)(base + skip),
+                .iov_len = s->len - skip,
+            };
+        }
+
+        ssize_t ret = writev(fd, iov, (int) count);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        // Skip past whatever was written, which can end mid-segment.
+        size_t left = (size_t) ret;
+
+        while (left && seg < g->seg_count) {
+            size_t rest = g->segs[seg].len - done;
+
+            if (left < rest) {
+                done += left;
+                break;
+            }
+
+            left -= rest;
+            seg += 1;
+            done = 0;
+        }
+    }
+
+    return true;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_gather(void) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+    strbuf_append(&sb, "skip", 4);
+
+    gather_t g;
+    gather_init(&g, &sb);
+
+    static char big[2 * GATHER_REF_MIN];
+    memset(big, 'b', sizeof(big));
+
+    strbuf_append(&sb, "head", 4);
+    gather_ref(&g, big, sizeof(big));
+
+    // Small references are copied and join the span before them.
+    strbuf_append(&sb, "mid", 3);
+    gather_ref(&g, "dle", 3);
+    gather_ref(&g, big, sizeof(big));
+    strbuf_append(&sb, "tail", 4);
+
+    ASSERT_EQ(gather_len(&g), 4 + 6 + 4 + 2 * sizeof(big));
+    ASSERT_EQ(g.seg_count, 5);
+    ASSERT_EQ(sb->pos, 4 + 4 + 6 + 4);
+
+    FILE *f = fopen("test", "w+");
+    ASSERT(gather_write(&g, fileno(f)));
+
+    static char expect[4 + 6 + 4 + 2 * sizeof(big)];
+    char *cur = expect;
+    PUT(cur, "head", 4);
+    PUT(cur, big, sizeof(big));
+    PUT(cur, "middle", 6);
+    PUT(cur, big, sizeof(big));
+    PUT(cur, "tail", 4);
+
+    static char got[sizeof(expect) + 1];
+    rewind(f);
+    ASSERT_EQ(fread(got, 1, sizeof(got), f), sizeof(expect));
+    ASSERT_EQ(memcmp(got, expect, sizeof(expect)), 0);
+
+    fclose(f);
+
+    // A reset starts over after what's in the strbuf.
+    gather_reset(&g);
+    ASSERT_EQ(gather_len(&g), 0);
+
+    gather_destroy(&g);
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_gather_many(void) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    gather_t g;
+    gather_init(&g, &sb);
+
+    static char bufs[2][GATHER_REF_MIN];
+    memset(bufs[0], 'x', sizeof(bufs[0]));
+    memset(bufs[1], 'y', sizeof(bufs[1]));
+
+    // More segments than fit in one writev.
+    enum { COUNT = IOV_MAX };
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        strbuf_append(&sb, i % 2 ? "1" : "0", 1);
+        gather_ref(&g, bufs[i % 2], sizeof(bufs[i % 2]));
+    }
+
+    FILE *f = fopen("test", "w+");
+    ASSERT(gather_write(&g, fileno(f)));
+
+    rewind(f);
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        char rec[1 + GATHER_REF_MIN];
+        ASSERT_EQ(fread(rec, 1, sizeof(rec), f), sizeof(rec));
+        ASSERT_EQ(rec[0], i % 2 ? '1' : '0');
+        ASSERT_EQ(memcmp(&rec[1], bufs[i % 2], GATHER_REF_MIN), 0);
+    }
+
+    ASSERT_EQ(fgetc(f), EOF);
+
+    fclose(f);
+    gather_destroy(&g);
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_gather_file(void) {
+    FILE *f = fopen("test", "w");
+    fputs("0123456789", f);
+    fclose(f);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    gather_t g;
+    gather_init(&g, &sb);
+
+    strbuf_append(&sb, "<", 1);
+    gather_ref_file(&g, open("test", O_RDONLY), 2, 5);
+    strbuf_append(&sb, ">", 1);
+
+    // An empty file is closed right away.
+    gather_ref_file(&g, open("test", O_RDONLY), 0, 0);
+    ASSERT_EQ(g.seg_count, 3);
+    ASSERT_EQ(gather_len(&g), 7);
+
+    // Copied by the kernel between files, and to a pipe.
+    FILE *out = tmpfile();
+    ASSERT(gather_write(&g, fileno(out)));
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT(gather_write(&g, fds[1]));
+    close(fds[1]);
+
+    char got[8] = {0};
+    rewind(out);
+    ASSERT_EQ(fread(got, 1, sizeof(got), out), 7);
+    ASSERT_STR_EQ(got, "<23456>");
+
+    memset(got, 0, sizeof(got));
+    ASSERT_EQ(read(fds[0], got, sizeof(got)), 7);
+    ASSERT_STR_EQ(got, "<23456>");
+
+    close(fds[0]);
+    fclose(out);
+
+    // A file shorter than its segment fails the write.
+    gather_reset(&g);
+    gather_ref_file(&g, open("test", O_RDONLY), 5, 10);
+    out = tmpfile();
+    ASSERT(!gather_write(&g, fileno(out)));
+    fclose(out);
+
+    gather_destroy(&g);
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+SUITE(gather_suite) {
+    RUN_TEST(test_gather);
+    RUN_TEST(test_gather_many);
+    RUN_TEST(test_gather_file);
+}
+#endif
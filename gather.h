@@ -0,0 +1,72 @@
+// See copyright notice in Copying.
+
+#ifndef GATHER_H
+#define GATHER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "strbuf.h"
+
+enum {
+    // References shorter than this are copied into the strbuf, which is
+    // cheaper than writing them as a segment of their own.
+    GATHER_REF_MIN = 1 << 9,
+};
+
+// A piece of the output: a span of the strbuf, outside memory, or part of a
+// file.
+typedef struct {
+    // Outside memory, or NULL for a span of the strbuf or a file.
+    const char *base;
+    // File to copy from, or -1.
+    int fd;
+    // Offset of the span in the strbuf, which can move as it grows, or in the
+    // file.
+    size_t off;
+    size_t len;
+} gather_seg_t;
+
+// Output assembled from bytes appended to a strbuf, like encoded block
+// headers, and references to outside buffers and files, like payloads, which
+// are written in order with a single writev instead of being copied together.
+// Files are copied by the kernel without passing through user space.
+typedef struct {
+    // Strbuf that holds the copied bytes.
+    strbuf_t **sbp;
+    // Bytes of the strbuf before this are covered by segments.
+    size_t mark;
+
+    gather_seg_t *segs;
+    size_t seg_count;
+    size_t seg_cap;
+} gather_t;
+
+// Initialize the list to gather bytes appended to the strbuf starting from
+// its current position.
+void gather_init(gather_t *g, strbuf_t **sbp);
+
+// Free the list and close its files. The strbuf and referenced buffers are
+// left alone.
+void gather_destroy(gather_t *g);
+
+// Add the buffer after everything appended to the strbuf so far. The buffer
+// must stay valid until the list is written.
+void gather_ref(gather_t *g, const void *buf, size_t len);
+
+// Add len bytes of the file starting at the offset after everything added so
+// far. The list takes ownership of the file descriptor.
+void gather_ref_file(gather_t *g, int fd, size_t off, size_t len);
+
+// Get the total length of the list.
+size_t gather_len(gather_t *g);
+
+// Write the whole list to the file descriptor, retrying on partial writes.
+// Return true on success and false otherwise.
+bool gather_write(gather_t *g, int fd);
+
+// Close the list's files and start an empty list over the strbuf's current
+// position.
+void gather_reset(gather_t *g);
+
+#endif
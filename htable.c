@@ -34,6 +34,7 @@
 #define HTABLE_C_COMMON
 
 #define HTABLE_ALLOC NAME(alloc)
+#define HTABLE_FREE NAME(free)
 #define HTABLE_SEARCH_SLOTS NAME(search_slots)
 #define HTABLE_FIND_SLOT NAME(find_slot)
 #define HTABLE_FIND_SWAP NAME(find_swap)
@@ -68,8 +69,9 @@ typedef struct {
 #endif
 
 #if !defined HTABLE_FIXED
-// Allocate a table to hold the given number of slots.
-static HTABLE_T *HTABLE_ALLOC(HTABLE_T *ht, size_t size) {
+// Allocate a table to hold the given number of slots, from the given arena_t
+// if HTABLE_ARENA is defined and it isn't NULL.
+static HTABLE_T *HTABLE_ALLOC(HTABLE_T *ht, size_t size, void *arena) {
   // Size must be greater than HTABLE_BUCKET_SIZE, so the table can hold at
   // least one full bucket.
   assert(size >= HTABLE_BUCKET_SIZE);
@@ -77,7 +79,21 @@ static HTABLE_T *HTABLE_ALLOC(HTABLE_T *ht, size_t size) {
   // Size in bytes of all slots
   size_t nbytes = size * sizeof(HTABLE_SLOT_T);
 
+#if defined HTABLE_ARENA
+  if (arena) {
+    size_t old = ht ? sizeof(HTABLE_T) + ht->size * sizeof(HTABLE_SLOT_T) : 0;
+    ht = arena_realloc(arena, ht, old, sizeof(HTABLE_T) + nbytes);
+  } else {
+    ht = realloc(ht, sizeof(HTABLE_T) + nbytes);
+  }
+
+  ht->arena = arena;
+#else
+  (void) arena;
   ht = realloc(ht, sizeof(HTABLE_T) + nbytes);
+#endif
+
+  assert(ht);
   ht->size = size;
 
   // Because size is always a power of two, subtracting one creates a bitmap
@@ -97,12 +113,28 @@ static HTABLE_T *HTABLE_ALLOC(HTABLE_T *ht, size_t size) {
 }
 
 void HTABLE_INIT(HTABLE_T **htp) {
-  *htp = HTABLE_ALLOC(NULL, (HTABLE_DEFAULT_SIZE));
+  *htp = HTABLE_ALLOC(NULL, (HTABLE_DEFAULT_SIZE), NULL);
 }
 
-void HTABLE_DESTROY(HTABLE_T *ht) {
+#if defined HTABLE_ARENA
+void HTABLE_INIT_ARENA(HTABLE_T **htp, arena_t *arena) {
+  *htp = HTABLE_ALLOC(NULL, (HTABLE_DEFAULT_SIZE), arena);
+}
+#endif
+
+// Free the table unless it's held by an arena.
+static void HTABLE_FREE(HTABLE_T *ht) {
+#if defined HTABLE_ARENA
+  if (ht->arena)
+    return;
+#endif
+
   free(ht);
 }
+
+void HTABLE_DESTROY(HTABLE_T *ht) {
+  HTABLE_FREE(ht);
+}
 #endif
 
 // Search for a slot that hashes to the given key starting at the hash bucket.
@@ -142,7 +174,8 @@ HTABLE_DATA_TYPE *HTABLE_REMOVE(HTABLE_T *ht, const HTABLE_KEY_TYPE key) {
   // Mark slot as empty.
   ht->slots[search.slot].hash = 0;
   // Disassociate slot from hash bucket.
-  ht->slots[search.bucket].fwd ^= 1u << HTABLE_CLAMP(search.slot - search.bucket);
+  ht->slots[search.bucket].fwd ^=
+    (htable_fwd_t) 1 << HTABLE_CLAMP(search.slot - search.bucket);
 
   return &ht->slots[search.slot].data;
 }
@@ -181,7 +214,7 @@ static bool HTABLE_FIND_SWAP(htable_cursor_t *swap, const HTABLE_T *ht,
 #define SWAP_LOOKBACK (HTABLE_BUCKET_SIZE - 1)
 // Ensures the number of bits in the fwd bitmap doesn't extend past the given
 // slot
-#define SWAP_MASK_INIT ((1UL << SWAP_LOOKBACK) - 1)
+#define SWAP_MASK_INIT (((htable_fwd_t) 1 << SWAP_LOOKBACK) - 1)
 
   htable_fwd_t mask, fwd;
 
@@ -225,9 +258,11 @@ HTABLE_DATA_TYPE *HTABLE_ADD_HASH(HTABLE_T *ht, htable_hash_t h) {
       ht->slots[dest.slot].data = ht->slots[swap.slot].data;
 
       // Disassociate old slot from swap hash bucket.
-      ht->slots[swap.bucket].fwd ^= 1u << HTABLE_CLAMP(swap.slot - swap.bucket);
+      ht->slots[swap.bucket].fwd ^=
+        (htable_fwd_t) 1 << HTABLE_CLAMP(swap.slot - swap.bucket);
       // Associate new slot with swap hash bucket.
-      ht->slots[swap.bucket].fwd |= 1u << HTABLE_CLAMP(dest.slot - swap.bucket);
+      ht->slots[swap.bucket].fwd |=
+        (htable_fwd_t) 1 << HTABLE_CLAMP(dest.slot - swap.bucket);
 
       // Continue swapping if still not in hash bucket.
       dest.slot = swap.slot;
@@ -241,7 +276,8 @@ HTABLE_DATA_TYPE *HTABLE_ADD_HASH(HTABLE_T *ht, htable_hash_t h) {
   // Mark slot as taken.
   ht->slots[dest.slot].hash = h;
   // Associate slot with hash bucket.
-  ht->slots[dest.bucket].fwd |= 1u << HTABLE_CLAMP(dest.slot - dest.bucket);
+  ht->slots[dest.bucket].fwd |=
+    (htable_fwd_t) 1 << HTABLE_CLAMP(dest.slot - dest.bucket);
 
   return &ht->slots[dest.slot].data;
 }
@@ -274,13 +310,21 @@ static bool HTABLE_REHASH(HTABLE_T *ht, HTABLE_T *nht) {
 // not.
 static HTABLE_T *HTABLE_GROW(HTABLE_T *ht) {
   HTABLE_T *nht = NULL;
+  size_t size = HTABLE_SIZE(ht);
+
+#if defined HTABLE_ARENA
+  void *arena = ht->arena;
+#else
+  void *arena = NULL;
+#endif
 
   for (;;) {
-    ht->size *= 2;
-    nht = HTABLE_ALLOC(nht, ht->size);
+    // The old table keeps its size, since it's still being rehashed from.
+    size *= 2;
+    nht = HTABLE_ALLOC(nht, size, arena);
 
     if (HTABLE_REHASH(ht, nht)) {
-      free(ht);
+      HTABLE_FREE(ht);
       return nht;
     }
   }
@@ -304,6 +348,11 @@ HTABLE_DATA_TYPE *HTABLE_ADD(HTABLE_T **htp, const HTABLE_KEY_TYPE key) {
   }
 }
 #else
+void HTABLE_INIT(HTABLE_T *ht) {
+  // Zero all hashes so the table appears empty.
+  memset(ht->slots, 0, sizeof(ht->slots));
+}
+
 HTABLE_DATA_TYPE *HTABLE_ADD(HTABLE_T *ht, const HTABLE_KEY_TYPE key) {
   return HTABLE_ADD_HASH(ht, HTABLE_HASH_KEY(key));
 }
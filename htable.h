@@ -25,6 +25,7 @@
 //     HTABLE_DEFAULT_SIZE
 //     HTABLE_FIXED
 //     HTABLE_STATIC
+//     HTABLE_ARENA (arena_t must be declared)
 
 // Example usage:
 //
@@ -58,6 +59,7 @@
 #undef HTABLE_DEFAULT_SIZE
 #undef HTABLE_FIXED
 #undef HTABLE_STATIC
+#undef HTABLE_ARENA
 
 // Undefine H file functions
 #undef NAME
@@ -74,6 +76,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 #ifndef static_assert
@@ -107,6 +110,7 @@ static_assert(!(HTABLE_DEFAULT_SIZE & (HTABLE_DEFAULT_SIZE - 1)),
 #define HTABLE_SLOT_T NAME(slot_t)
 
 #define HTABLE_INIT NAME(init)
+#define HTABLE_INIT_ARENA NAME(init_arena)
 #define HTABLE_DESTROY NAME(destroy)
 #define HTABLE_LOOKUP NAME(lookup)
 #define HTABLE_ADD NAME(add)
@@ -137,6 +141,10 @@ typedef struct {
 #if !defined HTABLE_FIXED
   size_t size;
   htable_hash_t mask;
+#if defined HTABLE_ARENA
+  // Arena the table is allocated from, or NULL if on the heap
+  arena_t *arena;
+#endif
   HTABLE_SLOT_T slots[];
 #else
   HTABLE_SLOT_T slots[HTABLE_DEFAULT_SIZE];
@@ -147,6 +155,12 @@ typedef struct {
 // Allocate and initialized the table.
 HTABLE_FN
 void HTABLE_INIT(HTABLE_T **htp);
+#if defined HTABLE_ARENA
+// Allocate and initialize the table in the arena, or on the heap if arena is
+// NULL. The table grows within the same arena.
+HTABLE_FN
+void HTABLE_INIT_ARENA(HTABLE_T **htp, arena_t *arena);
+#endif
 // Deallocate the table. This doesn't deallocate the data in the individual
 // slots! Use an iterator to do that before destroying the table.
 HTABLE_FN
@@ -160,10 +174,15 @@ typedef struct {
   HTABLE_DATA_TYPE data;
 } HTABLE_PAIR_T;
 
+// Initialize the table in place.
+HTABLE_FN
+void HTABLE_INIT(HTABLE_T *ht);
+// Add data for key: O(1). Return NULL if the table is full.
 HTABLE_FN
 HTABLE_DATA_TYPE *HTABLE_ADD(HTABLE_T *ht, const HTABLE_KEY_TYPE key);
+// Add each pair. Return false if the table fills up.
 HTABLE_FN
-void HTABLE_ADD_PAIRS(HTABLE_T *ht, const HTABLE_PAIR_T *pairs, size_t npairs);
+bool HTABLE_ADD_PAIRS(HTABLE_T *ht, const HTABLE_PAIR_T *pairs, size_t npairs);
 #endif
 
 // Lookup data for key: O(1). Return NULL if no data matches key.
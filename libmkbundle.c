@@ -0,0 +1,291 @@
+// See copyright notice in Copying.
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "bundle.h"
+#include "libmkbundle.h"
+#include "sink.h"
+
+#ifdef MKBUNDLE_TEST
+#include <pthread.h>
+
+#include "greatest.h"
+#include "test-params.h"
+#include "util.h"
+#endif
+
+struct mkbundle {
+    // Holds the parser reused for every call.
+    batch_t batch;
+    // Holds the blocks of each call, released when the call returns.
+    arena_t arena;
+    // Where the arena jumps back to if it runs out of memory. Everything a
+    // call allocates, other than the sink's spill buffer, is in the arena.
+    jmp_buf oom;
+    // Fills the caller's buffer. It's kept between calls so its spill buffer
+    // can be reused, and so it's still valid after a jump.
+    sink_t sink;
+    size_t error_record;
+};
+
+static void note_error(void *ctx, size_t record) {
+    mkbundle_t *m = ctx;
+
+    if (!m->error_record)
+        m->error_record = record;
+}
+
+bool mkbundle_init(mkbundle_t **mp) {
+    mkbundle_t *m = malloc(sizeof(mkbundle_t));
+
+    if (!m)
+        return false;
+
+    batch_init(&m->batch, note_error, m);
+    arena_init(&m->arena, ARENA_CHUNK, 0);
+    m->arena.oom = &m->oom;
+    m->batch.arena = &m->arena;
+    sink_init_buf(&m->sink, NULL, 0);
+    m->error_record = 0;
+
+    *mp = m;
+
+    return true;
+}
+
+void mkbundle_destroy(mkbundle_t *m) {
+    sink_destroy(&m->sink);
+    arena_destroy(&m->arena);
+    free(m);
+}
+
+// Release what the call left behind after running out of memory.
+static mkbundle_status_t fail_oom(mkbundle_t *m, size_t *out_len) {
+    arena_reset(&m->arena);
+    *out_len = 0;
+
+    return MKBUNDLE_ENOMEM;
+}
+
+// Report the length of the output if it was created successfully, and whether
+// it fit in the caller's buffer.
+static mkbundle_status_t finish(mkbundle_t *m, bool ok, size_t *out_len) {
+    // Only allocating the spill buffer can fail the sink.
+    if (!sink_flush(&m->sink)) {
+        *out_len = 0;
+        return MKBUNDLE_ENOMEM;
+    }
+
+    if (!ok) {
+        *out_len = 0;
+        return MKBUNDLE_EINVAL;
+    }
+
+    *out_len = sink_len(&m->sink);
+
+    return *out_len <= m->sink.dest_cap ? MKBUNDLE_OK : MKBUNDLE_ENOSPC;
+}
+
+mkbundle_status_t mkbundle_compile(mkbundle_t *m, const char *params,
+                                   size_t len, void *out, size_t cap,
+                                   size_t *out_len)
+{
+    m->batch.record = 0;
+    m->batch.failed = 0;
+    m->error_record = 0;
+    sink_reset_buf(&m->sink, out, cap);
+
+    if (setjmp(m->oom))
+        return fail_oom(m, out_len);
+
+    batch_compile_sink(&m->batch, params, len, true, &m->sink);
+
+    return finish(m, !m->batch.failed, out_len);
+}
+
+mkbundle_status_t mkbundle_build(mkbundle_t *m, const char *spec, size_t len,
+                                 void *out, size_t cap, size_t *out_len)
+{
+    m->error_record = 0;
+    sink_reset_buf(&m->sink, out, cap);
+
+    if (setjmp(m->oom))
+        return fail_oom(m, out_len);
+
+    bool ok = bundle_build_sink(&m->batch.parser, &m->arena, &m->sink, spec,
+                                len, 0);
+
+    return finish(m, ok, out_len);
+}
+
+size_t mkbundle_error_record(const mkbundle_t *m) {
+    return m->error_record;
+}
+
+#ifdef MKBUNDLE_TEST
+// A param file record of an extension block with the given type.
+#define EXTENSION(type) TEST_EXTENSION(type, 0, 4) "\n"
+
+TEST test_mkbundle_compile(void) {
+    mkbundle_t *m;
+    ASSERT(mkbundle_init(&m));
+
+    static const char PARAMS[] = EXTENSION(1) EXTENSION(2);
+
+    uint8_t out[16];
+    size_t len;
+
+    ASSERT_EQ(mkbundle_compile(m, PARAMS, sizeof(PARAMS) - 1, out,
+                               sizeof(out), &len), MKBUNDLE_OK);
+    ASSERT_EQ(len, 6);
+    ASSERT_EQ(memcmp(out, "\x01\x00\x04\x02\x00\x04", 6), 0);
+    ASSERT_EQ(mkbundle_error_record(m), 0);
+
+    // Blocks are encoded in place, so once the arena has a chunk nothing more
+    // is allocated, even when the buffer is only just big enough.
+    memset(out, 0, sizeof(out));
+    size_t before = util_alloc_count();
+
+    ASSERT_EQ(mkbundle_compile(m, PARAMS, sizeof(PARAMS) - 1, out, 6, &len),
+              MKBUNDLE_OK);
+    ASSERT_EQ(util_alloc_count(), before);
+    ASSERT_EQ(len, 6);
+    ASSERT_EQ(memcmp(out, "\x01\x00\x04\x02\x00\x04", 6), 0);
+
+    // The needed length is reported when the buffer is too small.
+    ASSERT_EQ(mkbundle_compile(m, PARAMS, sizeof(PARAMS) - 1, NULL, 0, &len),
+              MKBUNDLE_ENOSPC);
+    ASSERT_EQ(len, 6);
+
+    static const char INVALID[] = EXTENSION(1) "\"extension\": {}";
+
+    ASSERT_EQ(mkbundle_compile(m, INVALID, sizeof(INVALID) - 1, out,
+                               sizeof(out), &len), MKBUNDLE_EINVAL);
+    ASSERT_EQ(mkbundle_error_record(m), 2);
+
+    mkbundle_destroy(m);
+
+    PASS();
+}
+
+TEST test_mkbundle_build(void) {
+    mkbundle_t *m;
+    ASSERT(mkbundle_init(&m));
+
+    static const char SPEC[] =
+        "[" TEST_PRIMARY ", {" EXTENSION(1) ", \"payload\": \"test\"}]";
+
+    uint8_t out[32];
+    size_t len;
+
+    ASSERT_EQ(mkbundle_build(m, SPEC, sizeof(SPEC) - 1, out, sizeof(out),
+                             &len), MKBUNDLE_OK);
+    ASSERT_EQ(len, 15 + 3 + 4);
+    ASSERT_EQ(memcmp(&out[15], "\x01\x08\x04" "test", 7), 0);
+
+    ASSERT_EQ(mkbundle_build(m, SPEC, sizeof(SPEC) - 1, out, 21, &len),
+              MKBUNDLE_ENOSPC);
+    ASSERT_EQ(len, 22);
+
+    ASSERT_EQ(mkbundle_build(m, "[]", 2, out, sizeof(out), &len),
+              MKBUNDLE_EINVAL);
+
+    mkbundle_destroy(m);
+
+    PASS();
+}
+
+TEST test_mkbundle_enomem(void) {
+    mkbundle_t *m;
+    ASSERT(mkbundle_init(&m));
+
+    // A fresh context has nothing in its arena, and every block needs some.
+    static const char SPEC[] = "[" TEST_PRIMARY "]";
+
+    uint8_t out[32];
+    size_t len;
+
+    util_fail_allocs(true);
+    mkbundle_status_t ret = mkbundle_build(m, SPEC, sizeof(SPEC) - 1, out,
+                                           sizeof(out), &len);
+    util_fail_allocs(false);
+
+    ASSERT_EQ(ret, MKBUNDLE_ENOMEM);
+    ASSERT_EQ(len, 0);
+
+    // The context recovers once memory is back.
+    ASSERT_EQ(mkbundle_build(m, SPEC, sizeof(SPEC) - 1, out, sizeof(out),
+                             &len), MKBUNDLE_OK);
+    ASSERT_EQ(len, 15);
+
+    mkbundle_destroy(m);
+
+    PASS();
+}
+
+enum { THREADS = 4 };
+
+static const char THREAD_PARAMS[] =
+    EXTENSION(1) EXTENSION(200) EXTENSION(3) EXTENSION(40) EXTENSION(5);
+
+// Compile the params many times with a context of its own and check each
+// output against the expected output in arg.
+static void *compile_many(void *arg) {
+    const uint8_t *expect = arg;
+    mkbundle_t *m;
+
+    if (!mkbundle_init(&m))
+        return NULL;
+
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < 2000; i += 1) {
+        uint8_t out[32];
+        size_t len;
+
+        ok = mkbundle_compile(m, THREAD_PARAMS, sizeof(THREAD_PARAMS) - 1,
+                              out, sizeof(out), &len) == MKBUNDLE_OK &&
+             len == 15 && !memcmp(out, expect, len);
+    }
+
+    mkbundle_destroy(m);
+
+    return ok ? arg : NULL;
+}
+
+TEST test_mkbundle_threads(void) {
+    // Not const so it can be passed to the threads.
+    static uint8_t expect[] = {
+        0x01, 0x00, 0x04,
+        0xc8, 0x00, 0x04,
+        0x03, 0x00, 0x04,
+        0x28, 0x00, 0x04,
+        0x05, 0x00, 0x04,
+    };
+
+    pthread_t threads[THREADS];
+
+    for (size_t i = 0; i < THREADS; i += 1)
+        ASSERT_EQ(pthread_create(&threads[i], NULL, compile_many, expect), 0);
+
+    for (size_t i = 0; i < THREADS; i += 1) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        ASSERT_EQ(ret, expect);
+    }
+
+    PASS();
+}
+
+SUITE(libmkbundle_suite) {
+    RUN_TEST(test_mkbundle_compile);
+    RUN_TEST(test_mkbundle_build);
+    RUN_TEST(test_mkbundle_enomem);
+    RUN_TEST(test_mkbundle_threads);
+}
+#endif
@@ -0,0 +1,58 @@
+// See copyright notice in Copying.
+
+#ifndef LIBMKBUNDLE_H
+#define LIBMKBUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Marks the functions the shared library exports. Everything else in it is
+// hidden.
+#ifdef __GNUC__
+#define MKBUNDLE_API __attribute__((visibility("default")))
+#else
+#define MKBUNDLE_API
+#endif
+
+// Compiles block params and bundle specs in memory. Contexts share no state,
+// so each thread can use its own context without locking. Nothing in the
+// library exits the process or writes to stdio.
+typedef struct mkbundle mkbundle_t;
+
+typedef enum {
+    MKBUNDLE_OK,
+    // The params or spec are malformed.
+    MKBUNDLE_EINVAL,
+    // The output doesn't fit in the given buffer.
+    MKBUNDLE_ENOSPC,
+    // Memory ran out. The context can still be used.
+    MKBUNDLE_ENOMEM,
+} mkbundle_status_t;
+
+// Allocate a context. Return true on success and false if out of memory.
+MKBUNDLE_API bool mkbundle_init(mkbundle_t **mp);
+
+// Free the context.
+MKBUNDLE_API void mkbundle_destroy(mkbundle_t *m);
+
+// Compile a buffer of params records, like those output by the primary and
+// extension commands, into the binary form of each block. The blocks are
+// encoded straight into the output buffer, and on success their length is
+// stored in out_len. If the buffer is too small, out_len holds the length
+// needed and the buffer's contents are unspecified.
+MKBUNDLE_API mkbundle_status_t mkbundle_compile(mkbundle_t *m,
+                                                const char *params, size_t len,
+                                                void *out, size_t cap,
+                                                size_t *out_len);
+
+// Build the bundle described by the spec, like the build command, with the
+// output handled as in mkbundle_compile.
+MKBUNDLE_API mkbundle_status_t mkbundle_build(mkbundle_t *m, const char *spec,
+                                              size_t len, void *out,
+                                              size_t cap, size_t *out_len);
+
+// Get the number, starting at 1, of the first record that failed in the last
+// call to mkbundle_compile, or 0 if none did.
+MKBUNDLE_API size_t mkbundle_error_record(const mkbundle_t *m);
+
+#endif
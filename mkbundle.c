@@ -1,24 +1,42 @@
 // See copyright notice in Copying.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef MKBUNDLE_TEST
 #include "greatest.h"
 #endif
 
+#ifdef MKBUNDLE_BENCH
+#include "bench.h"
+#endif
+
+#include "arena.h"
+#include "batch-pool.h"
+#include "batch.h"
 #include "block.h"
+#include "bundle.h"
 #include "common-block.h"
+#include "gather.h"
+#include "parser.h"
+#include "pipeline.h"
 #include "primary-block.h"
+#include "server.h"
+#include "sink.h"
 #include "strbuf.h"
 #include "ui.h"
 #include "util.h"
 
-#ifndef MKBUNDLE_TEST
+#if !defined MKBUNDLE_TEST && !defined MKBUNDLE_BENCH
 // Print the given formatted string and exit.
 #define DIEF(fmt, ...) do { \
     fprintf(stderr, "error: " fmt "\n", __VA_ARGS__); \
@@ -63,6 +81,26 @@ static FILE *try_open(const char *path, const char *mode) {
     return file;
 }
 
+// Parse an unsigned decimal option argument into val. Unlike a bare strtoull,
+// reject a sign, trailing garbage, and values that don't fit.
+static bool parse_u64(const char *str, uint64_t *val) {
+    char *end;
+
+    // strtoull skips leading space and silently negates negative numbers.
+    if (*str < '0' || *str > '9')
+        return false;
+
+    errno = 0;
+    unsigned long long n = strtoull(str, &end, 10);
+
+    if (*end != '\0' || errno == ERANGE)
+        return false;
+
+    *val = (uint64_t) n;
+
+    return true;
+}
+
 static void help_primary(const char *name) {
     fprintf(stderr,
         "usage: %s primary [OPTION...]\n"
@@ -93,6 +131,10 @@ static void help_primary(const char *name) {
         "          set the creation sequence number\n"
         "  --lifetime LIFETIME-OFFSET\n"
         "          set the lifetime offset\n"
+        "  --fixed-width FIELD:WIDTH\n"
+        "          encode FIELD with exactly WIDTH bytes, so it can be\n"
+        "          patched in place in the compiled block (can be\n"
+        "          specified multiple times)\n"
         "FLAGS\n"
         "  bundle-is-fragment  bundle is a fragment\n"
         "  admin-record        application data unit is an administrative record\n"
@@ -110,11 +152,40 @@ static void help_primary(const char *name) {
         "  forwarding  request reporting of bundle forwarding\n"
         "  delivery    request reporting of bundle delivery\n"
         "  deletion    request reporting of bundle deletion\n"
+        "FIELDS\n"
+        "  creation-ts   creation timestamp\n"
+        "  creation-seq  creation sequence number\n"
+        "  lifetime      lifetime offset\n"
         ,
         name
     );
 }
 
+// Parse a FIELD:WIDTH string and set the width on the block.
+static bool parse_fixed_width(primary_block_t *b, const char *str) {
+    const char *sep = strchr(str, ':');
+
+    if (!sep)
+        return false;
+
+    char field[32];
+    size_t len = (size_t)(sep - str);
+
+    if (len >= sizeof(field))
+        return false;
+
+    memcpy(field, str, len);
+    field[len] = '\0';
+
+    char *end;
+    unsigned long width = strtoul(sep + 1, &end, 10);
+
+    if (end == sep + 1 || *end)
+        return false;
+
+    return primary_block_set_width(b, parse_primary_field(field), width);
+}
+
 static void cmd_primary(const char *name, int argc, char **argv) {
     enum {
         OPT_HELP,
@@ -129,6 +200,7 @@ static void cmd_primary(const char *name, int argc, char **argv) {
         OPT_CREATION_TS,
         OPT_CREATION_SEQ,
         OPT_LIFETIME,
+        OPT_FIXED_WIDTH,
     };
 
     static const struct option OPTIONS[] = {
@@ -144,6 +216,7 @@ static void cmd_primary(const char *name, int argc, char **argv) {
         {"creation-ts", required_argument, NULL, OPT_CREATION_TS},
         {"creation-seq", required_argument, NULL, OPT_CREATION_SEQ},
         {"lifetime", required_argument, NULL, OPT_LIFETIME},
+        {"fixed-width", required_argument, NULL, OPT_FIXED_WIDTH},
         {0, 0, 0 ,0},
     };
 
@@ -216,34 +289,42 @@ static void cmd_primary(const char *name, int argc, char **argv) {
         break;
 
         case OPT_CREATION_TS:
-            block.creation_ts = (uint32_t) strtoul(optarg, &end, 10);
-
-            if (end == optarg)
+            if (!parse_u64(optarg, &block.creation_ts))
                 DIEF("invalid creation timestamp '%s'", optarg);
         break;
 
         case OPT_CREATION_SEQ:
-            block.creation_seq = (uint32_t) strtoul(optarg, &end, 10);
-
-            if (end == optarg)
+            if (!parse_u64(optarg, &block.creation_seq))
                 DIEF("invalid creation sequence '%s'", optarg);
         break;
 
         case OPT_LIFETIME:
-            block.lifetime = (uint32_t) strtoul(optarg, &end, 10);
-
-            if (end == optarg)
+            if (!parse_u64(optarg, &block.lifetime))
                 DIEF("invalid lifetime '%s'", optarg);
         break;
 
+        case OPT_FIXED_WIDTH:
+            if (!parse_fixed_width(&block, optarg))
+                DIEF("invalid fixed width '%s'", optarg);
+        break;
+
         default:
             handle_opt(ret, OPTIONS, argv);
         break;
         }
     }
 
-    primary_block_serialize(&block, out);
+    if (!primary_block_check_widths(&block))
+        DIES("field doesn't fit in its fixed width");
+
+    sink_t sink;
+    sink_init_stdio(&sink, out);
+    primary_block_serialize(&block, &sink);
+
+    if (!sink_flush(&sink))
+        DIES("unable to write params");
 
+    sink_destroy(&sink);
     primary_block_destroy(&block);
     fclose(out);
 }
@@ -263,6 +344,8 @@ static void help_extension(const char *name) {
         "         add an EID reference to the block\n"
         "  --payload-length PAYLOAD-LENGTH\n"
         "         set the payload length of the block\n"
+        "  --payload-file FILE\n"
+        "         set the payload length of the block to the size of FILE\n"
         "FLAGS\n"
         "  replicate        block must be replicated in every fragment\n"
         "  transmit-status  transmit status report if block can't be processed\n"
@@ -286,6 +369,7 @@ static void cmd_extension(const char *name, int argc, char **argv) {
         OPT_REF,
         OPT_REF_COUNT,
         OPT_PAYLOAD_LENGTH,
+        OPT_PAYLOAD_FILE,
     };
 
     static const struct option OPTIONS[] = {
@@ -294,12 +378,14 @@ static void cmd_extension(const char *name, int argc, char **argv) {
         {"flag", required_argument, NULL, OPT_FLAG},
         {"ref", required_argument, NULL, OPT_REF},
         {"payload-length", required_argument, NULL, OPT_PAYLOAD_LENGTH},
+        {"payload-file", required_argument, NULL, OPT_PAYLOAD_FILE},
         {0, 0, 0, 0},
     };
 
     FILE *out = stdout;
     int ret;
     char *end;
+    struct stat st;
 
     ext_block_t block;
     ext_block_init(&block);
@@ -341,19 +427,31 @@ static void cmd_extension(const char *name, int argc, char **argv) {
         break;
 
         case OPT_PAYLOAD_LENGTH:
-            block.length = (uint32_t) strtoul(optarg, &end, 10);
-
-            if (end == optarg)
+            if (!parse_u64(optarg, &block.length))
                 DIEF("invalid payload length '%s'", optarg);
         break;
 
+        case OPT_PAYLOAD_FILE:
+            if (stat(optarg, &st) != 0)
+                DIEF("unable to stat '%s': %s", optarg, strerror(errno));
+
+            block.length = (uint64_t) st.st_size;
+        break;
+
         default:
             handle_opt(ret, OPTIONS, argv);
         break;
         }
     }
 
-    ext_block_serialize(&block, out);
+    sink_t sink;
+    sink_init_stdio(&sink, out);
+    ext_block_serialize(&block, &sink);
+
+    if (!sink_flush(&sink))
+        DIES("unable to write params");
+
+    sink_destroy(&sink);
 
     fclose(out);
 }
@@ -361,31 +459,184 @@ static void cmd_extension(const char *name, int argc, char **argv) {
 static void help_compile(const char *name) {
     fprintf(stderr,
         "usage: %s compile OPTION...\n"
+        "Compile a stream of concatenated or newline-delimited param files\n"
+        "into a block each. Malformed param files are reported and skipped.\n"
         "OPTIONS\n"
         "  -i FILE\n"
         "         read params from FILE instead of stdin\n"
         "  -o FILE\n"
         "         output to FILE instead of stdout\n"
+        "  -j JOBS\n"
+        "         compile with JOBS parallel workers, keeping the output in\n"
+        "         input order\n"
+        "  --pipeline\n"
+        "         run reading, parsing, encoding and writing in separate\n"
+        "         threads with bounded memory, for long-running streams\n"
+        "  --stats\n"
+        "         print queue occupancy stats for --pipeline on exit\n"
+        "  --huge-pages\n"
+        "         back the memory used for each record with huge pages where\n"
+        "         available\n"
+        "  --io-uring\n"
+        "         write output through io_uring in the background while the\n"
+        "         next blocks are compiled, where the kernel supports it\n"
         ,
         name
     );
 }
 
+enum {
+    // Amount of params to read at a time.
+    COMPILE_CHUNK = 1 << 16,
+    COMPILE_CHUNK_PARALLEL = 1 << 20,
+    // Maximum number of parallel jobs.
+    COMPILE_JOBS_MAX = 256,
+};
+
+// Report a record that failed to compile.
+static void report_record(void *ctx, size_t record) {
+    (void) ctx;
+    fprintf(stderr, "error: record %zu: unable to unserialize block\n", record);
+}
+
+// Compile the complete records at the start of the buffer into the sink, on
+// the pool if there's more than one job, and return the number of bytes used.
+static size_t compile_window(batch_t *batch, batch_pool_t *pool,
+                             unsigned long jobs, strbuf_t **blocks,
+                             sink_t *sink, const char *buf, size_t len,
+                             bool eof)
+{
+    size_t used;
+
+    if (jobs > 1) {
+        used = batch_pool_compile(pool, batch, buf, len, eof, blocks);
+        sink_take(sink, blocks);
+    } else {
+        used = batch_compile_sink(batch, buf, len, eof, sink);
+    }
+
+    if (sink->error)
+        DIES("unable to write blocks");
+
+    return used;
+}
+
+// Compile the input a chunk at a time, optionally spreading each chunk across
+// a pool of jobs. A regular file is mapped and compiled in place, and anything
+// else is read.
+static void compile_chunks(FILE *in, FILE *out, batch_t *batch,
+                           unsigned long jobs, bool uring)
+{
+    // Parallel jobs need bigger chunks to amortize handing them out.
+    size_t chunk = jobs > 1 ? COMPILE_CHUNK_PARALLEL : COMPILE_CHUNK;
+
+    // Blocks compiled in parallel are gathered before going to the sink.
+    strbuf_t *blocks;
+    strbuf_init(&blocks, jobs > 1 ? chunk : 1);
+
+    sink_t sink;
+
+    if (uring)
+        sink_init_uring(&sink, out);
+    else
+        sink_init_stdio(&sink, out);
+
+    batch_pool_t pool;
+
+    if (jobs > 1 && !batch_pool_init(&pool, jobs))
+        DIES("unable to start jobs");
+
+    mapped_t map;
+
+    if (map_input(&map, in)) {
+        size_t window = chunk;
+
+        for (size_t pos = 0; pos < map.len;) {
+            size_t len = map.len - pos < window ? map.len - pos : window;
+            size_t used = compile_window(batch, &pool, jobs, &blocks, &sink,
+                                         &map.buf[pos], len,
+                                         pos + len == map.len);
+
+            // A record bigger than the window needs a bigger one.
+            window = used ? chunk : 2 * window;
+            pos += used;
+        }
+
+        unmap_input(&map);
+    } else {
+        strbuf_t *buf;
+        strbuf_init(&buf, chunk);
+
+        for (bool eof = false; !eof;) {
+            strbuf_expect(&buf, chunk);
+
+            buf->pos += fread(&buf->buf[buf->pos], sizeof(char), chunk, in);
+            eof = feof(in) || ferror(in);
+
+            strbuf_discard(buf, compile_window(batch, &pool, jobs, &blocks,
+                                               &sink, buf->buf, buf->pos,
+                                               eof));
+        }
+
+        strbuf_destroy(buf);
+
+        if (ferror(in))
+            DIES("unable to read params");
+    }
+
+    if (!sink_flush(&sink))
+        DIES("unable to write blocks");
+
+    if (jobs > 1)
+        batch_pool_destroy(&pool);
+
+    sink_destroy(&sink);
+    strbuf_destroy(blocks);
+}
+
+// Compile the input with a thread for each stage.
+static void compile_pipeline(FILE *in, FILE *out, batch_t *batch, bool stats) {
+    static pipeline_t pipeline;
+    pipeline_init(&pipeline, batch);
+
+    if (!pipeline_run(&pipeline, fileno(in), out))
+        DIES("unable to compile params");
+
+    if (stats)
+        pipeline_print_stats(&pipeline, stderr);
+
+    pipeline_destroy(&pipeline);
+}
+
 static void cmd_compile(const char *name, int argc, char **argv) {
     enum {
         OPT_HELP,
+        OPT_PIPELINE,
+        OPT_STATS,
+        OPT_HUGE_PAGES,
+        OPT_IO_URING,
     };
 
     static const struct option OPTIONS[] = {
         {"help", no_argument, NULL, OPT_HELP},
+        {"pipeline", no_argument, NULL, OPT_PIPELINE},
+        {"stats", no_argument, NULL, OPT_STATS},
+        {"huge-pages", no_argument, NULL, OPT_HUGE_PAGES},
+        {"io-uring", no_argument, NULL, OPT_IO_URING},
         {0, 0, 0, 0},
     };
 
     FILE *in = stdin;
     FILE *out = stdout;
+    unsigned long jobs = 1;
+    bool pipeline = false;
+    bool stats = false;
+    bool uring = false;
+    unsigned arena_flags = 0;
+    char *end;
     int ret;
 
-    while ((ret = getopt_long(argc, argv, ":hi:o:", OPTIONS, NULL)) >= 0) {
+    while ((ret = getopt_long(argc, argv, ":hi:o:j:", OPTIONS, NULL)) >= 0) {
         switch (ret) {
         case 'h':
         case OPT_HELP:
@@ -401,30 +652,239 @@ static void cmd_compile(const char *name, int argc, char **argv) {
             out = try_open(optarg, "w");
         break;
 
+        case 'j':
+            jobs = strtoul(optarg, &end, 10);
+
+            if (end == optarg || *end || !jobs || jobs > COMPILE_JOBS_MAX)
+                DIEF("invalid job count '%s'", optarg);
+        break;
+
+        case OPT_PIPELINE:
+            pipeline = true;
+        break;
+
+        case OPT_STATS:
+            stats = true;
+        break;
+
+        case OPT_HUGE_PAGES:
+            arena_flags |= ARENA_HUGE_PAGES;
+        break;
+
+        case OPT_IO_URING:
+            uring = true;
+        break;
+
         default:
             handle_opt(ret, OPTIONS, argv);
         break;
         }
     }
 
-    strbuf_t *buf;
-    strbuf_init(&buf, 256);
-    collect(&buf, in);
+    if (pipeline && jobs > 1)
+        DIES("--pipeline can't be combined with -j");
+
+    if (stats && !pipeline)
+        DIES("--stats requires --pipeline");
+
+    if (uring && pipeline)
+        DIES("--io-uring can't be combined with --pipeline");
 
-    block_t block;
-    block_init(&block);
+    batch_t batch;
+    batch_init(&batch, report_record, NULL);
 
-    if (!block_unserialize(&block, buf->buf, buf->pos))
-        DIES("unable to unserialize block");
+    // Every record's temporaries come from one chunk, reused for the next
+    // record.
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, arena_flags);
+    batch.arena = &arena;
 
-    block_write(&block, out);
+    if (pipeline)
+        compile_pipeline(in, out, &batch, stats);
+    else
+        compile_chunks(in, out, &batch, jobs, uring);
 
-    block_destroy(&block);
-    strbuf_destroy(buf);
+    if (batch.failed)
+        DIEF("%zu of %zu records failed", batch.failed, batch.record);
+
+    arena_destroy(&arena);
     fclose(out);
     fclose(in);
 }
 
+static void help_build(const char *name) {
+    fprintf(stderr,
+        "usage: %s build OPTION...\n"
+        "OPTIONS\n"
+        "  -i FILE\n"
+        "         read the bundle spec from FILE instead of stdin\n"
+        "  -o FILE\n"
+        "         output to FILE instead of stdout\n"
+        "SPEC\n"
+        "  A JSON array with an object for each block. The first object holds\n"
+        "  the params of the primary block under a \"primary\" key, and the\n"
+        "  rest hold the params of extension blocks under an \"extension\" key.\n"
+        "  An extension block's payload is given inline as a \"payload\" string\n"
+        "  or read from the file named by \"payload-file\". Payload lengths and\n"
+        "  the last-block flag are set automatically. Payload files that are\n"
+        "  regular files are copied to the output by the kernel.\n"
+        ,
+        name
+    );
+}
+
+static void cmd_build(const char *name, int argc, char **argv) {
+    enum {
+        OPT_HELP,
+    };
+
+    static const struct option OPTIONS[] = {
+        {"help", no_argument, NULL, OPT_HELP},
+        {0, 0, 0, 0},
+    };
+
+    FILE *in = stdin;
+    FILE *out = stdout;
+    int ret;
+
+    while ((ret = getopt_long(argc, argv, ":hi:o:", OPTIONS, NULL)) >= 0) {
+        switch (ret) {
+        case 'h':
+        case OPT_HELP:
+            help_build(name);
+            exit(EXIT_SUCCESS);
+        break;
+
+        case 'i':
+            in = try_open(optarg, "r");
+        break;
+
+        case 'o':
+            out = try_open(optarg, "w");
+        break;
+
+        default:
+            handle_opt(ret, OPTIONS, argv);
+        break;
+        }
+    }
+
+    strbuf_t *spec;
+    strbuf_init(&spec, 1 << 10);
+    collect(&spec, in);
+
+    strbuf_t *bundle;
+    strbuf_init(&bundle, 1 << 10);
+
+    parser_t parser;
+    parser_init(&parser);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    // Payloads are written straight from where they were read instead of
+    // being copied in with the block headers.
+    gather_t gather;
+    gather_init(&gather, &bundle);
+
+    if (!bundle_gather(&parser, &arena, &gather, spec->buf, spec->pos))
+        DIES("unable to build bundle");
+
+    if (fflush(out) != 0 || !gather_write(&gather, fileno(out)))
+        DIES("unable to write bundle");
+
+    gather_destroy(&gather);
+    arena_destroy(&arena);
+    strbuf_destroy(bundle);
+    strbuf_destroy(spec);
+    fclose(out);
+    fclose(in);
+}
+
+static void help_serve(const char *name) {
+    fprintf(stderr,
+        "usage: %s serve OPTION...\n"
+        "OPTIONS\n"
+        "  -s PATH\n"
+        "         listen on a Unix socket created at PATH\n"
+        "PROTOCOL\n"
+        "  Each request is a 4-byte big-endian length followed by a param\n"
+        "  file, which is compiled, or a bundle spec, which is built. Each\n"
+        "  response is a status byte (0 for success, 1 for error), a 4-byte\n"
+        "  big-endian length, and then the binary output or an error\n"
+        "  message. Clients can send any number of requests per connection.\n"
+        "  Bundle specs can't use \"payload-file\", since the server would\n"
+        "  read the file for the client.\n"
+        ,
+        name
+    );
+}
+
+// The server to stop on a signal.
+static server_t *serving;
+
+static void stop_serving(int sig) {
+    (void) sig;
+    server_stop(serving);
+}
+
+static void cmd_serve(const char *name, int argc, char **argv) {
+    enum {
+        OPT_HELP,
+    };
+
+    static const struct option OPTIONS[] = {
+        {"help", no_argument, NULL, OPT_HELP},
+        {0, 0, 0, 0},
+    };
+
+    const char *path = NULL;
+    int ret;
+
+    while ((ret = getopt_long(argc, argv, ":hs:", OPTIONS, NULL)) >= 0) {
+        switch (ret) {
+        case 'h':
+        case OPT_HELP:
+            help_serve(name);
+            exit(EXIT_SUCCESS);
+        break;
+
+        case 's':
+            path = optarg;
+        break;
+
+        default:
+            handle_opt(ret, OPTIONS, argv);
+        break;
+        }
+    }
+
+    if (!path)
+        DIES("no socket path given");
+
+    static server_t server;
+
+    if (!server_init(&server, path))
+        DIEF("unable to listen on '%s': %s", path, strerror(errno));
+
+    serving = &server;
+
+    struct sigaction action = {
+        .sa_handler = stop_serving,
+    };
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    bool ok = server_run(&server);
+
+    server_destroy(&server);
+    unlink(path);
+
+    if (!ok)
+        DIES("unable to serve requests");
+}
+
 static void help_main(const char *name) {
     fprintf(stderr,
         "usage: %s COMMAND [OPTION...]\n"
@@ -433,6 +893,8 @@ static void help_main(const char *name) {
         "  primary    create a primary block param file\n"
         "  extension  create an extension block param file\n"
         "  compile    compile a param file into binary\n"
+        "  build      build a complete bundle from a bundle spec\n"
+        "  serve      compile param files and bundle specs over a socket\n"
         "See the help for each command for more informantion on specific\n"
         "options.\n"
         ,
@@ -446,6 +908,8 @@ static void cmd_help(const char *name, int argc, char **argv) {
         [CMD_PRIMARY] = help_primary,
         [CMD_EXTENSION] = help_extension,
         [CMD_COMPILE] = help_compile,
+        [CMD_BUILD] = help_build,
+        [CMD_SERVE] = help_serve,
     };
 
     if (argc < 2) {
@@ -467,6 +931,8 @@ int main(int argc, char **argv) {
         [CMD_PRIMARY] = cmd_primary,
         [CMD_EXTENSION] = cmd_extension,
         [CMD_COMPILE] = cmd_compile,
+        [CMD_BUILD] = cmd_build,
+        [CMD_SERVE] = cmd_serve,
     };
 
     opterr = 0;
@@ -482,13 +948,26 @@ int main(int argc, char **argv) {
     // Run the command and strip off the initial argument.
     CMDS[cmd](argv[0], argc - 1, &argv[1]);
 }
-#else
+#elif defined MKBUNDLE_TEST
+extern SUITE(arena_suite);
+extern SUITE(strbuf_suite);
 extern SUITE(sdnv_suite);
+extern SUITE(sink_suite);
+extern SUITE(sdnv_batch_suite);
 extern SUITE(parser_suite);
 extern SUITE(util_suite);
 extern SUITE(primary_block_suite);
 extern SUITE(ext_block_suite);
 extern SUITE(block_suite);
+extern SUITE(batch_suite);
+extern SUITE(batch_pool_suite);
+extern SUITE(spsc_suite);
+extern SUITE(pipeline_suite);
+extern SUITE(bundle_suite);
+extern SUITE(gather_suite);
+extern SUITE(uring_suite);
+extern SUITE(server_suite);
+extern SUITE(libmkbundle_suite);
 extern SUITE(ui_suite);
 
 GREATEST_MAIN_DEFS();
@@ -496,14 +975,41 @@ GREATEST_MAIN_DEFS();
 int main(int argc, char **argv) {
     GREATEST_MAIN_BEGIN();
 
+    RUN_SUITE(arena_suite);
+    RUN_SUITE(strbuf_suite);
     RUN_SUITE(sdnv_suite);
+    RUN_SUITE(sink_suite);
+    RUN_SUITE(sdnv_batch_suite);
     RUN_SUITE(parser_suite);
     RUN_SUITE(util_suite);
     RUN_SUITE(primary_block_suite);
     RUN_SUITE(ext_block_suite);
     RUN_SUITE(block_suite);
+    RUN_SUITE(batch_suite);
+    RUN_SUITE(batch_pool_suite);
+    RUN_SUITE(spsc_suite);
+    RUN_SUITE(pipeline_suite);
+    RUN_SUITE(bundle_suite);
+    RUN_SUITE(gather_suite);
+    RUN_SUITE(uring_suite);
+    RUN_SUITE(server_suite);
+    RUN_SUITE(libmkbundle_suite);
     RUN_SUITE(ui_suite);
 
     GREATEST_MAIN_END();
 }
+#else
+extern BENCH_SUITE(sdnv_bench);
+extern BENCH_SUITE(sdnv_batch_bench);
+extern BENCH_SUITE(batch_pool_bench);
+extern BENCH_SUITE(sink_bench);
+extern BENCH_SUITE(strbuf_bench);
+
+int main(void) {
+    RUN_BENCH_SUITE(sdnv_bench);
+    RUN_BENCH_SUITE(sdnv_batch_bench);
+    RUN_BENCH_SUITE(batch_pool_bench);
+    RUN_BENCH_SUITE(sink_bench);
+    RUN_BENCH_SUITE(strbuf_bench);
+}
 #endif
@@ -1,6 +1,7 @@
 // See copyright notice in Copying.
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -9,6 +10,7 @@
 #include "eid.h"
 #include "jsmn.h"
 #include "parser.h"
+#include "strbuf.h"
 #include "util.h"
 
 #ifdef MKBUNDLE_TEST
@@ -34,6 +36,7 @@ bool parser_parse(parser_t *p, const char *src, size_t len) {
     p->token = 0;
     p->token_count = (size_t) ret;
     p->src = src;
+    p->error = false;
 
     parser_advance(p);
 
@@ -114,7 +117,8 @@ TEST test_cur(void) {
 }
 #endif
 
-uint32_t parser_parse_sym(parser_t *p, const char **syms, size_t sym_count) {
+uint32_t parser_parse_sym(parser_t *p, const char *const *syms,
+                          size_t sym_count) {
     if (p->cur->type != JSMN_STRING) {
         p->error = true;
         return 0;
@@ -162,7 +166,7 @@ TEST test_parse_sym(void) {
 }
 #endif
 
-uint32_t parser_parse_u32(parser_t *p) {
+uint64_t parser_parse_u64(parser_t *p) {
     if (p->cur->type != JSMN_PRIMITIVE) {
         p->error = true;
         return 0;
@@ -171,15 +175,66 @@ uint32_t parser_parse_u32(parser_t *p) {
     const char *start = parser_cur_str(p);
     char *end;
 
+    // strtoull silently negates negative numbers.
+    if (*start == '-') {
+        p->error = true;
+        return 0;
+    }
+
+    errno = 0;
     unsigned long long val = strtoull(start, &end, 10);
 
-    if (end == start || val > UINT32_MAX) {
+    if (end == start || errno == ERANGE) {
         p->error = true;
         return 0;
     }
 
     parser_advance(p);
 
+    return (uint64_t) val;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_parse_u64(void) {
+    parser_t parser;
+    parser_init(&parser);
+
+    static const char J[] =
+        "{\"a\": 4294967296, \"b\": -1, \"c\": 18446744073709551616,"
+        " \"d\": 18446744073709551615}";
+    ASSERT(parser_parse(&parser, J, sizeof(J) - 1));
+
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_advance(&parser));
+    ASSERT_EQ(parser_parse_u64(&parser), UINT64_C(4294967296));
+
+    ASSERT(parser_advance(&parser));
+    parser_parse_u64(&parser);
+    ASSERT(parser.error);
+    parser.error = false;
+
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_advance(&parser));
+    parser_parse_u64(&parser);
+    ASSERT(parser.error);
+    parser.error = false;
+
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_advance(&parser));
+    ASSERT_EQ(parser_parse_u64(&parser), UINT64_MAX);
+
+    PASS();
+}
+#endif
+
+uint32_t parser_parse_u32(parser_t *p) {
+    uint64_t val = parser_parse_u64(p);
+
+    if (val > UINT32_MAX) {
+        p->error = true;
+        return 0;
+    }
+
     return (uint32_t) val;
 }
 
@@ -277,14 +332,277 @@ TEST test_parse_eid(void) {
 }
 #endif
 
+// Get the value of the given hex digit, which jsmn has already validated.
+static inline uint32_t hex_val(char c) {
+    if (c >= 'a')
+        return (uint32_t)(c - 'a' + 10);
+
+    if (c >= 'A')
+        return (uint32_t)(c - 'A' + 10);
+
+    return (uint32_t)(c - '0');
+}
+
+// Append the code point to the strbuf as UTF-8.
+static void append_utf8(strbuf_t **sbp, uint32_t cp) {
+    char bytes[3];
+    size_t len;
+
+    if (cp < 0x80) {
+        bytes[0] = (char) cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = (char)(0xc0 | cp >> 6);
+        bytes[1] = (char)(0x80 | (cp & 0x3f));
+        len = 2;
+    } else {
+        bytes[0] = (char)(0xe0 | cp >> 12);
+        bytes[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+        bytes[2] = (char)(0x80 | (cp & 0x3f));
+        len = 3;
+    }
+
+    strbuf_append(sbp, bytes, len);
+}
+
+bool parser_parse_str(parser_t *p, strbuf_t **sbp) {
+    if (p->cur->type != JSMN_STRING)
+        return false;
+
+    const char *str = parser_cur_str(p);
+    size_t len = parser_cur_len(p);
+
+    for (size_t i = 0; i < len; i += 1) {
+        if (str[i] != '\\') {
+            // Copy the run of unescaped characters at once.
+            size_t run = i;
+
+            while (run < len && str[run] != '\\')
+                run += 1;
+
+            strbuf_append(sbp, &str[i], run - i);
+            i = run - 1;
+
+            continue;
+        }
+
+        // jsmn has already validated the escape sequence.
+        i += 1;
+
+        switch (str[i]) {
+        case 'b': strbuf_append(sbp, "\b", 1); break;
+        case 'f': strbuf_append(sbp, "\f", 1); break;
+        case 'n': strbuf_append(sbp, "\n", 1); break;
+        case 'r': strbuf_append(sbp, "\r", 1); break;
+        case 't': strbuf_append(sbp, "\t", 1); break;
+
+        case 'u':
+            if (i + 4 >= len)
+                return false;
+
+            append_utf8(sbp, hex_val(str[i + 1]) << 12 |
+                             hex_val(str[i + 2]) << 8 |
+                             hex_val(str[i + 3]) << 4 |
+                             hex_val(str[i + 4]));
+            i += 4;
+        break;
+
+        default:
+            strbuf_append(sbp, &str[i], 1);
+        break;
+        }
+    }
+
+    parser_advance(p);
+
+    return true;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_parse_str(void) {
+    parser_t parser;
+    parser_init(&parser);
+
+    static const char J[] =
+        "{\"a\": \"ipn:1.0\\u0000\", \"b\": \"\\\"\\\\\\/\\n\\u00e9\", \"c\": 1}";
+    ASSERT(parser_parse(&parser, J, sizeof(J) - 1));
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_parse_str(&parser, &sb));
+    ASSERT_EQ(sb->pos, 8);
+    ASSERT_EQ(memcmp(sb->buf, "ipn:1.0\0", 8), 0);
+
+    sb->pos = 0;
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_parse_str(&parser, &sb));
+    ASSERT_EQ(sb->pos, 6);
+    ASSERT_EQ(memcmp(sb->buf, "\"\\/\n\xc3\xa9", 6), 0);
+
+    ASSERT(parser_advance(&parser));
+    ASSERT(!parser_parse_str(&parser, &sb));
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+#endif
+
+size_t parser_skip_space(const char *src, size_t len, size_t pos) {
+    while (pos < len && (src[pos] == ' ' || src[pos] == '\t' ||
+                         src[pos] == '\r' || src[pos] == '\n'))
+    {
+        pos += 1;
+    }
+
+    return pos;
+}
+
+// Check if the line starts with a record's key, which only ever appears at
+// the top level.
+static bool starts_record(const char *src, size_t len) {
+    static const char *KEYS[] = {"\"primary\"", "\"extension\""};
+
+    size_t pos = 0;
+
+    while (pos < len && (src[pos] == ' ' || src[pos] == '\t'))
+        pos += 1;
+
+    for (size_t k = 0; k < ASIZE(KEYS); k += 1) {
+        size_t key_len = strlen(KEYS[k]);
+
+        if (len - pos < key_len || memcmp(&src[pos], KEYS[k], key_len) != 0)
+            continue;
+
+        size_t end = parser_skip_space(src, len, pos + key_len);
+
+        return end < len && src[end] == ':';
+    }
+
+    return false;
+}
+
+// Get the length of the record or document, resynchronizing at the next
+// record's key if resync is set.
+static size_t record_len(const char *src, size_t len, bool resync) {
+    size_t depth = 0;
+    bool in_str = false;
+
+    for (size_t i = 0; i < len; i += 1) {
+        char c = src[i];
+
+        // Strings can't hold raw newlines, so this is still a line start even
+        // in an unterminated one.
+        if (c == '\n' && resync && (depth || in_str) &&
+            starts_record(&src[i + 1], len - i - 1))
+        {
+            return i + 1;
+        }
+
+        if (in_str) {
+            if (c == '\\')
+                i += 1;
+            else if (c == '"')
+                in_str = false;
+
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            in_str = true;
+        break;
+
+        case '{':
+        case '[':
+            depth += 1;
+        break;
+
+        case '}':
+        case ']':
+            // Stray closing brackets are left for the parser to reject.
+            if (!depth)
+                break;
+
+            depth -= 1;
+
+            if (!depth)
+                return i + 1;
+        break;
+        }
+    }
+
+    return 0;
+}
+
+size_t parser_record_len(const char *src, size_t len) {
+    return record_len(src, len, true);
+}
+
+size_t parser_doc_len(const char *src, size_t len) {
+    if (!len || (src[0] != '{' && src[0] != '['))
+        return 0;
+
+    // Documents can have these keys anywhere.
+    return record_len(src, len, false);
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_doc_len(void) {
+    ASSERT_EQ(parser_doc_len("", 0), 0);
+    ASSERT_EQ(parser_doc_len("1", 1), 0);
+    ASSERT_EQ(parser_doc_len("{}", 2), 2);
+    ASSERT_EQ(parser_doc_len("{\"a\": [1]} {}", 13), 10);
+    ASSERT_EQ(parser_doc_len("{\"a\": \"}\\\"}\"}", 13), 13);
+    ASSERT_EQ(parser_doc_len("{\"a\": {}", 8), 0);
+    ASSERT_EQ(parser_doc_len("\"a\": {}", 7), 0);
+
+    PASS();
+}
+
+TEST test_record_len(void) {
+    static const char R[] = "\"primary\": {\"a\": \"{\"}\n\"extension\": {}";
+    ASSERT_EQ(parser_record_len(R, sizeof(R) - 1), 21);
+    ASSERT_EQ(parser_record_len(&R[21], sizeof(R) - 22), 16);
+    ASSERT_EQ(parser_record_len(R, 20), 0);
+    ASSERT_EQ(parser_record_len("] {}", 4), 4);
+    ASSERT_EQ(parser_record_len("abc", 3), 0);
+
+    // Records left open end where the next one starts.
+    static const char BAD[] =
+        "\"extension\": {\"type\": 1\n"
+        "\"primary\": {\"a\": \"b\n"
+        "  \"extension\" : {}\n";
+    ASSERT_EQ(parser_record_len(BAD, sizeof(BAD) - 1), 24);
+    ASSERT_EQ(parser_record_len(&BAD[24], sizeof(BAD) - 25), 20);
+    ASSERT_EQ(parser_record_len(&BAD[44], sizeof(BAD) - 45), 18);
+
+    // The key as a value doesn't count, and documents have no records.
+    static const char EIDS[] = "\"primary\": {\"eids\": [\n\"extension\"]}";
+    ASSERT_EQ(parser_record_len(EIDS, sizeof(EIDS) - 1), sizeof(EIDS) - 1);
+
+    static const char DOC[] = "{\"a\": 1,\n\"extension\": {}}";
+    ASSERT_EQ(parser_doc_len(DOC, sizeof(DOC) - 1), sizeof(DOC) - 1);
+
+    PASS();
+}
+#endif
+
 #ifdef MKBUNDLE_TEST
 SUITE(parser_suite) {
     RUN_TEST(test_parse);
     RUN_TEST(test_advance);
     RUN_TEST(test_cur);
     RUN_TEST(test_parse_sym);
+    RUN_TEST(test_parse_u64);
     RUN_TEST(test_parse_u32);
     RUN_TEST(test_parse_u8);
     RUN_TEST(test_parse_eid);
+    RUN_TEST(test_parse_str);
+    RUN_TEST(test_doc_len);
+    RUN_TEST(test_record_len);
 }
 #endif
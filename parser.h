@@ -9,6 +9,7 @@
 
 #include "eid.h"
 #include "jsmn.h"
+#include "strbuf.h"
 
 typedef struct {
     jsmntok_t tokens[256];
@@ -23,7 +24,8 @@ typedef struct {
 // Initialize the parser to a default state.
 void parser_init(parser_t *p);
 
-// Parse the given JSON. The parser takes ownership of the buffer.
+// Parse the given JSON. The parser takes ownership of the buffer. A parser
+// can be reused for any number of documents.
 bool parser_parse(parser_t *p, const char *src, size_t len);
 
 // Check if there are more tokens to visit.
@@ -41,6 +43,9 @@ const char *parser_cur_str(const parser_t *p);
 // Get the length of the string referenced by the current token.
 size_t parser_cur_len(const parser_t *p);
 
+// Parse the current token as a uint64_t. Abort on parse error.
+uint64_t parser_parse_u64(parser_t *p);
+
 // Parse the current token as a uint32_t. Abort on parse error.
 uint32_t parser_parse_u32(parser_t *p);
 
@@ -49,9 +54,28 @@ uint8_t parser_parse_u8(parser_t *p);
 
 // Parse the current token as one of the symbols in the syms array. Return
 // SYM_INVALID on parse error.
-uint32_t parser_parse_sym(parser_t *p, const char **syms, size_t sym_count);
+uint32_t parser_parse_sym(parser_t *p, const char *const *syms,
+                          size_t sym_count);
 
 // Parse the current token as an EID. Abort on parse error.
 bool parser_parse_eid(parser_t *p, eid_t *e);
 
+// Unescape the current string token and append it to the strbuf. Escaped code
+// points are written as UTF-8. Return false if the token isn't a string.
+bool parser_parse_str(parser_t *p, strbuf_t **sbp);
+
+// Get the position of the first non-whitespace character at or after pos.
+size_t parser_skip_space(const char *src, size_t len, size_t pos);
+
+// Get the length of the record at the start of src: everything up to and
+// including the first complete top-level object or array. Return 0 if src ends
+// before the record does. Only brackets and strings are inspected, so the
+// contents still need to be parsed. A record left open where a line starts
+// with a "primary" or "extension" key ends before that line, so a malformed
+// record doesn't swallow the ones after it.
+size_t parser_record_len(const char *src, size_t len);
+
+// Like parser_record_len, but src must start with the object or array.
+size_t parser_doc_len(const char *src, size_t len);
+
 #endif
@@ -0,0 +1,451 @@
+// See copyright notice in Copying.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "block.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "spsc.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#include "test-params.h"
+#endif
+
+void pipeline_init(pipeline_t *p, batch_t *b) {
+    p->batch = b;
+    p->in = -1;
+    p->out = NULL;
+    p->read_error = false;
+    p->write_error = false;
+
+    spsc_init(&p->inputs, PIPELINE_BUFS);
+    spsc_init(&p->free_inputs, PIPELINE_BUFS);
+    spsc_init(&p->blocks, PIPELINE_BUFS);
+    spsc_init(&p->free_blocks, PIPELINE_BUFS);
+    spsc_init(&p->outputs, PIPELINE_BUFS);
+    spsc_init(&p->free_outputs, PIPELINE_BUFS);
+
+    for (size_t i = 0; i < PIPELINE_BUFS; i += 1) {
+        strbuf_init(&p->input_bufs[i].buf, PIPELINE_CHUNK);
+        strbuf_init(&p->output_bufs[i].buf, PIPELINE_CHUNK);
+    }
+}
+
+void pipeline_destroy(pipeline_t *p) {
+    for (size_t i = 0; i < PIPELINE_BUFS; i += 1) {
+        strbuf_destroy(p->output_bufs[i].buf);
+        strbuf_destroy(p->input_bufs[i].buf);
+    }
+
+    spsc_destroy(&p->free_outputs);
+    spsc_destroy(&p->outputs);
+    spsc_destroy(&p->free_blocks);
+    spsc_destroy(&p->blocks);
+    spsc_destroy(&p->free_inputs);
+    spsc_destroy(&p->inputs);
+}
+
+// Get an empty input buffer, starting with the unused tail of the given
+// buffer.
+static pipeline_input_t *next_input(pipeline_t *p, const pipeline_input_t *prev,
+                                    size_t used)
+{
+    pipeline_input_t *in = spsc_pop(&p->free_inputs);
+
+    in->buf->pos = 0;
+    in->rec_count = 0;
+    in->eof = false;
+    in->partial = false;
+
+    if (prev)
+        strbuf_append(&in->buf, &prev->buf->buf[used], prev->buf->pos - used);
+
+    return in;
+}
+
+// Read into the buffer. Return false at the end of input or on error.
+static bool read_input(pipeline_t *p, pipeline_input_t *in) {
+    strbuf_expect(&in->buf, PIPELINE_CHUNK);
+
+    ssize_t len;
+
+    do {
+        len = read(p->in, &in->buf->buf[in->buf->pos], PIPELINE_CHUNK);
+    } while (len < 0 && errno == EINTR);
+
+    if (len <= 0) {
+        p->read_error = len < 0;
+        return false;
+    }
+
+    in->buf->pos += (size_t) len;
+
+    return true;
+}
+
+// Split off as many complete records as fit, starting at used, and return the
+// position after the last one.
+static size_t split_input(pipeline_input_t *in, size_t used) {
+    const char *buf = in->buf->buf;
+    size_t len = in->buf->pos;
+
+    while (in->rec_count < PIPELINE_RECS) {
+        size_t pos = parser_skip_space(buf, len, used);
+        size_t rec_len = parser_record_len(&buf[pos], len - pos);
+
+        if (!rec_len)
+            break;
+
+        in->recs[in->rec_count] = (batch_rec_t) {
+            .start = pos,
+            .len = rec_len,
+        };
+
+        in->rec_count += 1;
+        used = pos + rec_len;
+    }
+
+    return used;
+}
+
+static void run_reader(pipeline_t *p) {
+    pipeline_input_t *in = next_input(p, NULL, 0);
+    // End of the records already split off.
+    size_t used = 0;
+    bool eof = false;
+
+    for (;;) {
+        // The tail carried over from the last buffer can hold a whole batch
+        // of small records. Reading more then would grow the tail by a chunk
+        // every time, so only read once the buffer can't fill a batch.
+        used = split_input(in, used);
+
+        if (!eof && in->rec_count < PIPELINE_RECS) {
+            eof = !read_input(p, in);
+            used = split_input(in, used);
+        }
+
+        // Give up on a record too long to buffer. It's reported as partial.
+        if (!in->rec_count && in->buf->pos - used > PIPELINE_REC_MAX)
+            eof = true;
+
+        if (eof && in->rec_count < PIPELINE_RECS) {
+            in->eof = true;
+            in->partial =
+                parser_skip_space(in->buf->buf, in->buf->pos, used) <
+                in->buf->pos;
+
+            spsc_push(&p->inputs, in);
+
+            return;
+        }
+
+        // Wait for a complete record.
+        if (!in->rec_count)
+            continue;
+
+        // Only block on the next buffer once this one is done, so reading
+        // overlaps with parsing the previous buffer.
+        pipeline_input_t *next = next_input(p, in, used);
+        spsc_push(&p->inputs, in);
+
+        in = next;
+        used = 0;
+    }
+}
+
+static void *run_parser(void *arg) {
+    pipeline_t *p = arg;
+    batch_t *b = p->batch;
+
+    for (;;) {
+        pipeline_input_t *in = spsc_pop(&p->inputs);
+        pipeline_blocks_t *blocks = spsc_pop(&p->free_blocks);
+
+        blocks->block_count = in->rec_count;
+        blocks->eof = in->eof;
+
+        for (size_t i = 0; i < in->rec_count; i += 1) {
+            const batch_rec_t *rec = &in->recs[i];
+            block_t *block = &blocks->blocks[i];
+
+            b->record += 1;
+            block_init(block);
+
+            if (parser_parse(&b->parser, &in->buf->buf[rec->start], rec->len) &&
+                block_parse(block, &b->parser))
+            {
+                continue;
+            }
+
+            batch_fail(b);
+            block_destroy(block);
+            block_init(block);
+        }
+
+        if (in->partial) {
+            b->record += 1;
+            batch_fail(b);
+        }
+
+        spsc_push(&p->free_inputs, in);
+        spsc_push(&p->blocks, blocks);
+
+        if (blocks->eof)
+            return NULL;
+    }
+}
+
+static void *run_encoder(void *arg) {
+    pipeline_t *p = arg;
+
+    for (;;) {
+        pipeline_blocks_t *blocks = spsc_pop(&p->blocks);
+        pipeline_output_t *out = spsc_pop(&p->free_outputs);
+
+        out->buf->pos = 0;
+        out->eof = blocks->eof;
+
+        for (size_t i = 0; i < blocks->block_count; i += 1) {
+            block_encode(&blocks->blocks[i], &out->buf);
+            block_destroy(&blocks->blocks[i]);
+        }
+
+        spsc_push(&p->free_blocks, blocks);
+        spsc_push(&p->outputs, out);
+
+        if (out->eof)
+            return NULL;
+    }
+}
+
+static void *run_writer(void *arg) {
+    pipeline_t *p = arg;
+
+    for (;;) {
+        pipeline_output_t *out = spsc_pop(&p->outputs);
+        bool eof = out->eof;
+
+        // Keep draining after an error so the other stages can finish.
+        if (!p->write_error && out->buf->pos) {
+            p->write_error =
+                !write_stream(p->out, out->buf->buf, out->buf->pos);
+        }
+
+        spsc_push(&p->free_outputs, out);
+
+        if (eof)
+            return NULL;
+    }
+}
+
+bool pipeline_run(pipeline_t *p, int in, FILE *out) {
+    typedef void *(*stage_fn)(void *arg);
+
+    static const stage_fn STAGES[] = {
+        run_parser,
+        run_encoder,
+        run_writer,
+    };
+
+    p->in = in;
+    p->out = out;
+
+    for (size_t i = 0; i < PIPELINE_BUFS; i += 1) {
+        spsc_push(&p->free_inputs, &p->input_bufs[i]);
+        spsc_push(&p->free_blocks, &p->block_bufs[i]);
+        spsc_push(&p->free_outputs, &p->output_bufs[i]);
+    }
+
+    pthread_t threads[ASIZE(STAGES)];
+    size_t started = 0;
+
+    while (started < ASIZE(STAGES) &&
+           !pthread_create(&threads[started], NULL, STAGES[started], p))
+    {
+        started += 1;
+    }
+
+    if (started < ASIZE(STAGES)) {
+        // Send an empty input through so the started stages finish. Buffers
+        // are left in the queues, so the pipeline can only be destroyed.
+        pipeline_input_t *last = next_input(p, NULL, 0);
+        last->eof = true;
+        spsc_push(&p->inputs, last);
+
+        for (size_t i = 0; i < started; i += 1)
+            pthread_join(threads[i], NULL);
+
+        return false;
+    }
+
+    run_reader(p);
+
+    for (size_t i = 0; i < ASIZE(STAGES); i += 1)
+        pthread_join(threads[i], NULL);
+
+    // Take the empty buffers back so the pipeline can be run again.
+    for (size_t i = 0; i < PIPELINE_BUFS; i += 1) {
+        spsc_pop(&p->free_inputs);
+        spsc_pop(&p->free_blocks);
+        spsc_pop(&p->free_outputs);
+    }
+
+    return !p->read_error && !p->write_error;
+}
+
+void pipeline_print_stats(const pipeline_t *p, FILE *stream) {
+    fprintf(stream, "%-14s %4s %10s %6s %4s %10s %11s\n",
+        "queue", "cap", "pushes", "mean", "max", "full-waits", "empty-waits");
+
+    spsc_print_stats(&p->inputs, "read->parse", stream);
+    spsc_print_stats(&p->blocks, "parse->encode", stream);
+    spsc_print_stats(&p->outputs, "encode->write", stream);
+    spsc_print_stats(&p->free_inputs, "parse->read", stream);
+    spsc_print_stats(&p->free_blocks, "encode->parse", stream);
+    spsc_print_stats(&p->free_outputs, "write->encode", stream);
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_pipeline_run(void) {
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+
+    // Enough records to cycle through every buffer several times, with some
+    // malformed ones and a trailing partial record.
+    enum { COUNT = 5000 };
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        if (i % 97 == 3) {
+            fputs("\"extension\": {\"type\": 1}\n", in);
+            continue;
+        }
+
+        fprintf(in,
+            "\"extension\": {\"type\": %zu, \"flags\": 0, \"payload-length\":"
+            " %zu, \"ref-count\": 0, \"refs\": []}\n",
+            i % 200, i * 1009);
+    }
+
+    fputs("\"extension\": {", in);
+    fflush(in);
+
+    strbuf_t *src;
+    strbuf_init(&src, 1 << 16);
+    rewind(in);
+    collect(&src, in);
+
+    strbuf_t *expect;
+    strbuf_init(&expect, 1 << 16);
+
+    batch_t serial;
+    batch_init(&serial, NULL, NULL);
+    batch_compile(&serial, src->buf, src->pos, true, &expect);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+    pipeline_t pipeline;
+    pipeline_init(&pipeline, &batch);
+
+    // Run twice to reuse the pipeline.
+    for (size_t round = 0; round < 2; round += 1) {
+        batch.record = batch.failed = 0;
+        ASSERT_EQ(lseek(fileno(in), 0, SEEK_SET), 0);
+        ASSERT_EQ(ftruncate(fileno(out), 0), 0);
+        rewind(out);
+
+        ASSERT(pipeline_run(&pipeline, fileno(in), out));
+        ASSERT_EQ(batch.record, serial.record);
+        ASSERT_EQ(batch.failed, serial.failed);
+
+        strbuf_t *got;
+        strbuf_init(&got, 1 << 16);
+        rewind(out);
+        collect(&got, out);
+
+        ASSERT_EQ(got->pos, expect->pos);
+        ASSERT_EQ(memcmp(got->buf, expect->buf, got->pos), 0);
+
+        strbuf_destroy(got);
+    }
+
+    ASSERT(pipeline.inputs.push_count > 2 * PIPELINE_BUFS);
+    ASSERT(pipeline.inputs.occupancy_max <= PIPELINE_BUFS);
+
+    pipeline_destroy(&pipeline);
+    strbuf_destroy(expect);
+    strbuf_destroy(src);
+    fclose(out);
+    fclose(in);
+
+    PASS();
+}
+
+TEST test_pipeline_small_records(void) {
+    // Records so small that each chunk read holds several batches.
+    static const char REC[] = TEST_EXTENSION(1, 0, 4) "\n";
+    static_assert(sizeof(REC) * PIPELINE_RECS < PIPELINE_CHUNK / 2,
+                  "records must be small");
+
+    enum { COUNT = 1 << 14 };
+
+    FILE *in = tmpfile();
+    FILE *out = fopen("/dev/null", "w");
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+    pipeline_t pipeline;
+    pipeline_init(&pipeline, &batch);
+
+    size_t allocs[2];
+
+    // The second stream is longer, but runs in buffers already grown by the
+    // first, so it needs no allocations at all.
+    for (size_t round = 0; round < 2; round += 1) {
+        ASSERT_EQ(ftruncate(fileno(in), 0), 0);
+        rewind(in);
+
+        for (size_t i = 0; i < (size_t) COUNT << 2 * round; i += 1)
+            fputs(REC, in);
+
+        fflush(in);
+        ASSERT_EQ(lseek(fileno(in), 0, SEEK_SET), 0);
+
+        size_t before = util_alloc_count();
+        ASSERT(pipeline_run(&pipeline, fileno(in), out));
+        allocs[round] = util_alloc_count() - before;
+    }
+
+    ASSERT_EQ(allocs[1], 0);
+    ASSERT_EQ(batch.failed, 0);
+
+    for (size_t i = 0; i < PIPELINE_BUFS; i += 1)
+        ASSERT(pipeline.input_bufs[i].buf->cap <= 2 * PIPELINE_CHUNK);
+
+    pipeline_destroy(&pipeline);
+    fclose(out);
+    fclose(in);
+
+    PASS();
+}
+
+SUITE(pipeline_suite) {
+    RUN_TEST(test_pipeline_run);
+    RUN_TEST(test_pipeline_small_records);
+}
+#endif
@@ -0,0 +1,89 @@
+// See copyright notice in Copying.
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "batch-pool.h"
+#include "batch.h"
+#include "block.h"
+#include "spsc.h"
+#include "strbuf.h"
+
+enum {
+    // Number of buffers circulating between each pair of stages. This bounds
+    // the memory used no matter how long the stream runs.
+    PIPELINE_BUFS = 4,
+    // Maximum number of records handed between stages at once.
+    PIPELINE_RECS = 256,
+    // Amount of input to read at a time.
+    PIPELINE_CHUNK = 1 << 16,
+    // Longest record the reader buffers. A longer one fails and ends the
+    // stream, so an input buffer never grows past this and a chunk.
+    PIPELINE_REC_MAX = 1 << 24,
+};
+
+// A chunk of input split into records.
+typedef struct {
+    strbuf_t *buf;
+    batch_rec_t recs[PIPELINE_RECS];
+    size_t rec_count;
+    // Whether the input ended after this chunk, and whether it ended in the
+    // middle of a record, or one too long to buffer.
+    bool eof;
+    bool partial;
+} pipeline_input_t;
+
+// Blocks parsed from a chunk of input. Malformed records are left as
+// BLOCK_TYPE_INVALID.
+typedef struct {
+    block_t blocks[PIPELINE_RECS];
+    size_t block_count;
+    bool eof;
+} pipeline_blocks_t;
+
+// Encoded blocks waiting to be written.
+typedef struct {
+    strbuf_t *buf;
+    bool eof;
+} pipeline_output_t;
+
+// Compiles a stream of params records with a separate thread for each stage:
+// the reader (the calling thread) splits input into records, the parser
+// unserializes them into blocks, the encoder encodes them, and the writer
+// flushes the encoded blocks. Each pair of stages is connected by a queue of
+// filled buffers going forward and a queue of empty buffers coming back.
+typedef struct {
+    batch_t *batch;
+    int in;
+    FILE *out;
+    bool read_error;
+    bool write_error;
+
+    spsc_t inputs, free_inputs;
+    spsc_t blocks, free_blocks;
+    spsc_t outputs, free_outputs;
+
+    pipeline_input_t input_bufs[PIPELINE_BUFS];
+    pipeline_blocks_t block_bufs[PIPELINE_BUFS];
+    pipeline_output_t output_bufs[PIPELINE_BUFS];
+} pipeline_t;
+
+// Initialize the pipeline to report records through the given batch.
+void pipeline_init(pipeline_t *p, batch_t *b);
+
+// Free memory held by the pipeline.
+void pipeline_destroy(pipeline_t *p);
+
+// Compile every record read from the file descriptor and write the blocks to
+// the stream. Return false if the threads couldn't be started or reading or
+// writing failed.
+bool pipeline_run(pipeline_t *p, int in, FILE *out);
+
+// Write the occupancy stats of every queue in the pipeline.
+void pipeline_print_stats(const pipeline_t *p, FILE *stream);
+
+#endif
@@ -11,6 +11,7 @@
 #include "parser.h"
 #include "primary-block.h"
 #include "sdnv.h"
+#include "sink.h"
 #include "strbuf.h"
 #include "util.h"
 
@@ -35,16 +36,56 @@ static htable_hash_t fnv(const eid_table_str_t *key) {
 
 #include "htable.c"
 
+// Get a pointer to the EID table of the block.
+#ifdef MKBUNDLE_FIXED
+#define EID_MAP(b) (&(b)->eid_map)
+#else
+#define EID_MAP(b) ((b)->eid_map)
+#endif
+
 enum { BUNDLE_VERSION_DEFAULT = 0x06 };
 
-static inline uint32_t calc_length(const primary_block_t *b) {
-    return (uint32_t) (
-        SDNV_LEN(SWAP32(b->dest.scheme)) + SDNV_LEN(SWAP32(b->dest.ssp)) +
-        SDNV_LEN(SWAP32(b->src.scheme)) + SDNV_LEN(SWAP32(b->src.ssp)) +
-        SDNV_LEN(SWAP32(b->report_to.scheme)) + SDNV_LEN(SWAP32(b->report_to.ssp)) +
-        SDNV_LEN(SWAP32(b->custodian.scheme)) + SDNV_LEN(SWAP32(b->custodian.ssp)) +
-        SDNV_LEN(SWAP32(b->creation_ts)) + SDNV_LEN(SWAP32(b->creation_seq)) +
-        SDNV_LEN(SWAP32(b->lifetime)) + SDNV_LEN(SWAP64(b->eid_buf->pos)) +
+const char *const primary_field_names[PRIMARY_FIELD_MAX] = {
+    [PRIMARY_FIELD_CREATION_TS] = "creation-ts",
+    [PRIMARY_FIELD_CREATION_SEQ] = "creation-seq",
+    [PRIMARY_FIELD_LIFETIME] = "lifetime",
+};
+
+// Get the value of a fixed-width field.
+static inline uint64_t field_val(const primary_block_t *b, primary_field_t f) {
+    switch (f) {
+    case PRIMARY_FIELD_CREATION_TS:
+        return b->creation_ts;
+
+    case PRIMARY_FIELD_CREATION_SEQ:
+        return b->creation_seq;
+
+    case PRIMARY_FIELD_LIFETIME:
+        return b->lifetime;
+
+    case PRIMARY_FIELD_INVALID:
+    break;
+    }
+
+    assert(false);
+
+    return 0;
+}
+
+// Get the encoded length of a fixed-width field.
+static inline size_t field_len(const primary_block_t *b, primary_field_t f) {
+    return b->widths[f] ? b->widths[f] : sdnv_len_u64(field_val(b, f));
+}
+
+static inline uint64_t calc_length(const primary_block_t *b) {
+    return (uint64_t) (
+        sdnv_len_u32(b->dest.scheme) + sdnv_len_u32(b->dest.ssp) +
+        sdnv_len_u32(b->src.scheme) + sdnv_len_u32(b->src.ssp) +
+        sdnv_len_u32(b->report_to.scheme) + sdnv_len_u32(b->report_to.ssp) +
+        sdnv_len_u32(b->custodian.scheme) + sdnv_len_u32(b->custodian.ssp) +
+        field_len(b, PRIMARY_FIELD_CREATION_TS) +
+        field_len(b, PRIMARY_FIELD_CREATION_SEQ) +
+        field_len(b, PRIMARY_FIELD_LIFETIME) + sdnv_len_u64(b->eid_buf->pos) +
         b->eid_buf->pos
     );
 }
@@ -73,6 +114,13 @@ TEST test_calc_length(void) {
     strbuf_finish(&block.eid_buf);
     ASSERT_EQ(calc_length(&block), 15);
 
+    ASSERT(primary_block_set_width(&block, PRIMARY_FIELD_CREATION_TS, 5));
+    ASSERT(primary_block_set_width(&block, PRIMARY_FIELD_LIFETIME, 2));
+    ASSERT_EQ(calc_length(&block), 19);
+
+    block.creation_seq = UINT64_C(1) << 35;
+    ASSERT_EQ(calc_length(&block), 24);
+
     primary_block_destroy(&block);
 
     PASS();
@@ -80,80 +128,101 @@ TEST test_calc_length(void) {
 #endif
 
 // Serialize the strings in the buffer into a JSON array.
-static void serialize_eids(const strbuf_t *eids, FILE *stream) {
+static void serialize_eids(const strbuf_t *eids, sink_t *s) {
     size_t pos = 0;
 
     while (pos < eids->pos) {
         const char *eid = &eids->buf[pos];
-        fprintf(stream, "    \"%s\"", eid);
+        sink_printf(s, "    \"%s\"", eid);
 
         // Move to the next string.
         pos += strlen(eid) + 1;
 
         // JSON doesn't support trailing commas.
         if (pos < eids->pos)
-            fputc(',', stream);
+            sink_putc(s, ',');
 
-        fputc('\n', stream);
+        sink_putc(s, '\n');
     }
 }
 
 #ifdef MKBUNDLE_TEST
-TEST test_serialize_eids(void) {
-    strbuf_t *sb;
-    strbuf_init(&sb, 16);
+// Serialize the EIDs into the strbuf, replacing its contents, and terminate
+// it.
+static void serialize_eids_str(const strbuf_t *eids, strbuf_t **out) {
+    (*out)->pos = 0;
 
-    FILE *f = fopen("test", "w+");
-    char buf[256] = {0};
+    sink_t sink;
+    sink_init_mem(&sink, out);
+    serialize_eids(eids, &sink);
+    sink_flush(&sink);
 
-    rewind(f);
-    serialize_eids(sb, f);
+    strbuf_finish(out);
+}
 
-    rewind(f);
-    fread(buf, sizeof(buf[0]), ASIZE(buf), f);
-    ASSERT_STR_EQ(buf, "");
+TEST test_serialize_eids(void) {
+    strbuf_t *sb, *out;
+    strbuf_init(&sb, 16);
+    strbuf_init(&out, 1);
 
-    strbuf_append(&sb, "a", 2);
+    serialize_eids_str(sb, &out);
+    ASSERT_STR_EQ(out->buf, "");
 
-    rewind(f);
-    serialize_eids(sb, f);
+    strbuf_append(&sb, "a", 2);
 
-    rewind(f);
-    fread(buf, sizeof(buf[0]), ASIZE(buf), f);
-    ASSERT_STR_EQ(buf, "    \"a\"\n");
+    serialize_eids_str(sb, &out);
+    ASSERT_STR_EQ(out->buf, "    \"a\"\n");
 
     strbuf_append(&sb, "b", 2);
     strbuf_append(&sb, "c", 2);
 
-    rewind(f);
-    serialize_eids(sb, f);
-
-    rewind(f);
-    fread(buf, sizeof(buf[0]), ASIZE(buf), f);
-    ASSERT_STR_EQ(buf, "    \"a\",\n"
-                       "    \"b\",\n"
-                       "    \"c\"\n");
+    serialize_eids_str(sb, &out);
+    ASSERT_STR_EQ(out->buf, "    \"a\",\n"
+                            "    \"b\",\n"
+                            "    \"c\"\n");
 
+    strbuf_destroy(out);
     strbuf_destroy(sb);
-    fclose(f);
 
     PASS();
 }
 #endif
 
-void primary_block_serialize(const primary_block_t *b, FILE *stream) {
-    fprintf(stream,
+// Serialize any fixed widths into a JSON object key. Nothing is written if all
+// fields are minimal.
+static void serialize_widths(const primary_block_t *b, sink_t *s) {
+    bool first = true;
+
+    for (size_t f = 0; f < PRIMARY_FIELD_MAX; f += 1) {
+        if (!b->widths[f])
+            continue;
+
+        sink_printf(s, "%s\"%s\": %" PRIu8,
+            first ? ",\n  \"widths\": {" : ", ",
+            primary_field_names[f],
+            b->widths[f]
+        );
+
+        first = false;
+    }
+
+    if (!first)
+        sink_putc(s, '}');
+}
+
+void primary_block_serialize(const primary_block_t *b, sink_t *s) {
+    sink_printf(s,
         "\"primary\": {\n"
         "  \"version\": %" PRIu8 ",\n"
         "  \"flags\": %" PRIu32 ",\n"
-        "  \"length\": %" PRIu32 ",\n"
+        "  \"length\": %" PRIu64 ",\n"
         "  \"dest\": [%" PRIu32 ", %" PRIu32 "],\n"
         "  \"src\": [%" PRIu32 ", %" PRIu32 "],\n"
         "  \"report-to\": [%" PRIu32 ", %" PRIu32 "],\n"
         "  \"custodian\": [%" PRIu32 ", %" PRIu32 "],\n"
-        "  \"creation-ts\": %" PRIu32 ",\n"
-        "  \"creation-seq\": %" PRIu32 ",\n"
-        "  \"lifetime\": %" PRIu32 ",\n"
+        "  \"creation-ts\": %" PRIu64 ",\n"
+        "  \"creation-seq\": %" PRIu64 ",\n"
+        "  \"lifetime\": %" PRIu64 ",\n"
         "  \"eids-size\": %zu,\n"
         "  \"eids\": [\n"
         ,
@@ -170,13 +239,14 @@ void primary_block_serialize(const primary_block_t *b, FILE *stream) {
         b->eid_buf->pos
     );
 
-    serialize_eids(b->eid_buf, stream);
+    serialize_eids(b->eid_buf, s);
+    sink_puts(s, "  ]");
+
+    serialize_widths(b, s);
 
-    fputs(
-        "  ]\n"
+    sink_puts(s,
+        "\n"
         "}\n"
-        ,
-        stream
     );
 }
 
@@ -186,12 +256,20 @@ static bool parse_eids(strbuf_t **eids, parser_t *p) {
 
     int eid_count = p->cur->size;
 
+    // The strings take up less room in the dictionary than the array does in
+    // the source, so room for all of them can be made at once.
+    if (!(*eids)->fixed)
+        strbuf_reserve(eids, (size_t)(p->cur->end - p->cur->start));
+
     parser_advance(p);
 
     for (int i = 0; i < eid_count; i += 1) {
         if (p->cur->type != JSMN_STRING)
             return false;
 
+        if ((*eids)->fixed && !strbuf_fits(*eids, parser_cur_len(p) + 1))
+            return false;
+
         strbuf_append(eids, parser_cur_str(p), parser_cur_len(p));
         strbuf_finish(eids);
 
@@ -226,6 +304,31 @@ TEST test_parse_eids(void) {
 }
 #endif
 
+static bool parse_widths(primary_block_t *b, parser_t *p) {
+    if (p->cur->type != JSMN_OBJECT)
+        return false;
+
+    // Keys and values are both counted.
+    int width_count = p->cur->size / 2;
+
+    parser_advance(p);
+
+    for (int i = 0; i < width_count; i += 1) {
+        uint32_t f = parser_parse_sym(p, primary_field_names,
+                                      PRIMARY_FIELD_MAX);
+
+        if (f == SYM_INVALID || p->error)
+            return false;
+
+        uint8_t width = parser_parse_u8(p);
+
+        if (p->error || !primary_block_set_width(b, f, width))
+            return false;
+    }
+
+    return true;
+}
+
 bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
     enum {
         SYM_VERSION,
@@ -241,8 +344,11 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
         SYM_EIDS_SIZE,
         SYM_EIDS,
 
+        // Optional symbols.
+        SYM_WIDTHS,
+
         SYM_MAX,
-        SYM_MASK = (1 << SYM_MAX) - 1,
+        SYM_MASK = (1 << SYM_WIDTHS) - 1,
     };
 
     static const char *MAP[] = {
@@ -258,15 +364,23 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
         [SYM_LIFETIME] = "lifetime",
         [SYM_EIDS_SIZE] = "eids-size",
         [SYM_EIDS] = "eids",
+        [SYM_WIDTHS] = "widths",
     };
 
+    if (p->cur->type != JSMN_OBJECT)
+        return false;
+
+    // Only visit this object's keys, so it can be embedded in a larger
+    // document. The object size counts both keys and values.
+    int pair_count = p->cur->size / 2;
+
     if (!parser_advance(p))
         return false;
 
     // Bitmap where each bit represents if a symbol has been visited.
     uint32_t symbols = 0;
 
-    while (parser_more(p)) {
+    for (int i = 0; i < pair_count; i += 1) {
         uint32_t sym = parser_parse_sym(p, MAP, ASIZE(MAP));
         symbols |= 1u << sym;
 
@@ -280,7 +394,7 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
         break;
 
         case SYM_LENGTH:
-            b->length = parser_parse_u32(p);
+            b->length = parser_parse_u64(p);
         break;
 
         case SYM_DEST:
@@ -300,15 +414,15 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
         break;
 
         case SYM_CREATION_TS:
-            b->creation_ts = parser_parse_u32(p);
+            b->creation_ts = parser_parse_u64(p);
         break;
 
         case SYM_CREATION_SEQ:
-            b->creation_seq = parser_parse_u32(p);
+            b->creation_seq = parser_parse_u64(p);
         break;
 
         case SYM_LIFETIME:
-            b->lifetime = parser_parse_u32(p);
+            b->lifetime = parser_parse_u64(p);
         break;
 
         case SYM_EIDS_SIZE:
@@ -320,6 +434,11 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
                 return false;
         break;
 
+        case SYM_WIDTHS:
+            if (!parse_widths(b, p))
+                return false;
+        break;
+
         case SYM_INVALID:
             return false;
         break;
@@ -329,7 +448,7 @@ bool primary_block_unserialize(primary_block_t *b, parser_t *p) {
             return false;
     }
 
-    return symbols == SYM_MASK;
+    return (symbols & SYM_MASK) == SYM_MASK && primary_block_check_widths(b);
 }
 
 #ifdef MKBUNDLE_TEST
@@ -340,72 +459,234 @@ TEST test_primary_block_unserialize(void) {
     static const char J[] =
         "{\"version\": 42, \"flags\": 42, \"length\": 42, \"dest\": [0, 1],"
         " \"src\": [1, 0], \"report-to\": [0, 1], \"custodian\": [1, 0],"
-        " \"creation-ts\": 42, \"creation-seq\": 42, \"lifetime\": 42,"
+        " \"creation-ts\": 42, \"creation-seq\": 8589934592, \"lifetime\": 42,"
         " \"eids-size\": 42, \"eids\": [\"a\", \"b\"]}";
     parser_t parser;
     parser_init(&parser);
     ASSERT(parser_parse(&parser, J, sizeof(J) - 1));
     ASSERT(primary_block_unserialize(&block, &parser));
+    ASSERT_EQ(block.creation_seq, UINT64_C(8589934592));
 
     primary_block_destroy(&block);
 
     PASS();
 }
+
+TEST test_primary_block_unserialize_widths(void) {
+    static const char J[] =
+        "{\"version\": 6, \"flags\": 0, \"length\": 0, \"dest\": [0, 1],"
+        " \"src\": [1, 0], \"report-to\": [0, 1], \"custodian\": [1, 0],"
+        " \"creation-ts\": 42, \"creation-seq\": 300, \"lifetime\": 42,"
+        " \"eids-size\": 0, \"eids\": [],"
+        " \"widths\": {\"creation-ts\": 5, \"creation-seq\": 2}}";
+
+    primary_block_t block;
+    primary_block_init(&block);
+
+    parser_t parser;
+    parser_init(&parser);
+    ASSERT(parser_parse(&parser, J, sizeof(J) - 1));
+    ASSERT(primary_block_unserialize(&block, &parser));
+
+    ASSERT_EQ(block.widths[PRIMARY_FIELD_CREATION_TS], 5);
+    ASSERT_EQ(block.widths[PRIMARY_FIELD_CREATION_SEQ], 2);
+    ASSERT_EQ(block.widths[PRIMARY_FIELD_LIFETIME], 0);
+
+    primary_block_destroy(&block);
+
+    // The sequence number doesn't fit in 1 byte.
+    static const char BAD[] =
+        "{\"version\": 6, \"flags\": 0, \"length\": 0, \"dest\": [0, 1],"
+        " \"src\": [1, 0], \"report-to\": [0, 1], \"custodian\": [1, 0],"
+        " \"creation-ts\": 42, \"creation-seq\": 300, \"lifetime\": 42,"
+        " \"eids-size\": 0, \"eids\": [], \"widths\": {\"creation-seq\": 1}}";
+
+    primary_block_init(&block);
+    parser_init(&parser);
+    ASSERT(parser_parse(&parser, BAD, sizeof(BAD) - 1));
+    ASSERT(!primary_block_unserialize(&block, &parser));
+    primary_block_destroy(&block);
+
+    PASS();
+}
 #endif
 
 void primary_block_init(primary_block_t *b) {
+    primary_block_init_arena(b, NULL);
+}
+
+void primary_block_init_arena(primary_block_t *b, arena_t *arena) {
     *b = (primary_block_t) {
         .version = BUNDLE_VERSION_DEFAULT,
         .flags = FLAG_DEFAULT,
     };
 
+#ifdef MKBUNDLE_FIXED
+    (void) arena;
+
     eid_map_init(&b->eid_map);
-    strbuf_init(&b->eid_buf, 1 << 8);
+    strbuf_init_fixed(&b->eid_buf, b->eid_mem, sizeof(b->eid_mem));
+#else
+    eid_map_init_arena(&b->eid_map, arena);
+    strbuf_init_arena(&b->eid_buf, 1 << 8, arena);
+#endif
 }
 
 void primary_block_destroy(primary_block_t *b) {
     strbuf_destroy(b->eid_buf);
+#ifndef MKBUNDLE_FIXED
     eid_map_destroy(b->eid_map);
+#endif
+}
+
+// Largest possible encoding of the fields covered by the block length: 12
+// SDNVs.
+enum { BODY_MAX = 12 * SDNV_MAX_U64 };
+
+// Largest possible encoding of everything but the EID strings: the version
+// byte, flags, length and body.
+enum { HEADER_MAX = 1 + 2 * SDNV_MAX_U64 + BODY_MAX };
+
+// Get the most bytes the block can encode to.
+static inline size_t encoded_max(const primary_block_t *b) {
+    return HEADER_MAX + b->eid_buf->pos;
+}
+
+// Encode the block at the cursor, which must have room for encoded_max bytes,
+// and return the cursor past it.
+static uint8_t *put_block(const primary_block_t *b, uint8_t *cur) {
+    // Encode the body once into scratch space so the block length falls out
+    // of its size instead of being computed separately.
+    uint8_t body[BODY_MAX];
+    uint8_t *bcur = body;
+
+    PUT_EID(bcur, &b->dest);
+    PUT_EID(bcur, &b->src);
+    PUT_EID(bcur, &b->report_to);
+    PUT_EID(bcur, &b->custodian);
+
+    PUT_SDNV_FIXED(bcur, b->creation_ts, b->widths[PRIMARY_FIELD_CREATION_TS]);
+    PUT_SDNV_FIXED(bcur, b->creation_seq,
+                   b->widths[PRIMARY_FIELD_CREATION_SEQ]);
+    PUT_SDNV_FIXED(bcur, b->lifetime, b->widths[PRIMARY_FIELD_LIFETIME]);
+    PUT_SDNV(bcur, b->eids_size);
+
+    size_t body_len = (size_t)(bcur - body);
+
+    *cur++ = b->version;
+    PUT_SDNV(cur, b->flags);
+    PUT_SDNV(cur, body_len + b->eid_buf->pos);
+    PUT(cur, body, body_len);
+    PUT(cur, b->eid_buf->buf, b->eid_buf->pos);
+
+    return cur;
+}
+
+void primary_block_encode(const primary_block_t *b, strbuf_t **sbp) {
+    strbuf_expect(sbp, encoded_max(b));
+
+    uint8_t *start = STRBUF_CURSOR(*sbp);
+    (*sbp)->pos += (size_t)(put_block(b, start) - start);
+}
+
+bool primary_block_write(const primary_block_t *b, sink_t *s) {
+    uint8_t *start = sink_reserve(s, encoded_max(b));
+
+    if (!start)
+        return false;
+
+    sink_commit(s, (size_t)(put_block(b, start) - start));
+
+    return true;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_primary_block_encode(void) {
+    primary_block_t block;
+    primary_block_init(&block);
+
+    block.version = 6;
+    // Ignored in favor of the encoded length.
+    block.length = 300;
+    block.dest = (eid_t) {.scheme = 0, .ssp = 2};
+    block.creation_ts = 42;
+    ASSERT(primary_block_set_width(&block, PRIMARY_FIELD_CREATION_SEQ, 3));
+    block.creation_seq = 1;
+    block.eids_size = 2;
+    strbuf_append(&block.eid_buf, "a", 2);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+    strbuf_append(&sb, "x", 1);
+
+    primary_block_encode(&block, &sb);
+
+    static const uint8_t EXPECT[] = {
+        'x', 0x06, 0x00, 0x10, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x2a, 0x80, 0x80, 0x01, 0x00, 0x02, 'a', 0x00,
+    };
+    ASSERT_EQ(sb->pos, sizeof(EXPECT));
+    ASSERT_EQ(memcmp(sb->buf, EXPECT, sizeof(EXPECT)), 0);
+    ASSERT_EQ(calc_length(&block), 0x10);
+
+    strbuf_destroy(sb);
+    primary_block_destroy(&block);
+
+    PASS();
 }
+#endif
+
+bool primary_block_set_width(primary_block_t *b, primary_field_t f,
+                             size_t width)
+{
+    if (f >= PRIMARY_FIELD_MAX || width > SDNV_MAX_U64)
+        return false;
 
-void primary_block_write(const primary_block_t *b, FILE *stream) {
-    WRITE(stream, &b->version, sizeof(b->version));
-    WRITE_SDNV(stream, SWAP32(b->flags));
-    WRITE_SDNV(stream, SWAP32(b->length));
+    b->widths[f] = (uint8_t) width;
 
-    WRITE_EID(stream, &b->dest);
-    WRITE_EID(stream, &b->src);
-    WRITE_EID(stream, &b->report_to);
-    WRITE_EID(stream, &b->custodian);
+    return true;
+}
 
-    WRITE_SDNV(stream, SWAP32(b->creation_ts));
-    WRITE_SDNV(stream, SWAP32(b->creation_seq));
-    WRITE_SDNV(stream, SWAP32(b->lifetime));
-    WRITE_SDNV(stream, SWAP32(b->eids_size));
+bool primary_block_check_widths(const primary_block_t *b) {
+    for (size_t f = 0; f < PRIMARY_FIELD_MAX; f += 1)
+        if (b->widths[f] && sdnv_len_u64(field_val(b, f)) > b->widths[f])
+            return false;
 
-    WRITE(stream, b->eid_buf->buf, b->eid_buf->pos);
+    return true;
 }
 
-static size_t add_eid(primary_block_t *b, const char *str, size_t len) {
+// Add the string to the block if it isn't there already and store its offset
+// in pos. Return false if there's no room for it.
+static bool add_eid(primary_block_t *b, const char *str, size_t len,
+                    size_t *pos)
+{
     const eid_table_str_t s = {
         .str = str,
         .len = len,
     };
 
-    size_t *pos = eid_map_lookup(b->eid_map, &s);
+    size_t *slot = eid_map_lookup(EID_MAP(b), &s);
 
-    if (pos)
-        return *pos;
+    if (slot) {
+        *pos = *slot;
+        return true;
+    }
 
-    pos = eid_map_add(&b->eid_map, &s);
-    assert(pos);
+    if (b->eid_buf->fixed && !strbuf_fits(b->eid_buf, len + 1))
+        return false;
+
+    // Only a fixed table can fill up.
+    slot = eid_map_add(&b->eid_map, &s);
+
+    if (!slot)
+        return false;
 
-    *pos = b->eid_buf->pos;
+    *pos = *slot = b->eid_buf->pos;
 
     strbuf_append(&b->eid_buf, str, len);
     strbuf_finish(&b->eid_buf);
 
-    return *pos;
+    return true;
 }
 
 #ifdef MKBUNDLE_TEST
@@ -413,11 +694,13 @@ TEST test_add_eid(void) {
     primary_block_t block;
     primary_block_init(&block);
 
-    ASSERT(add_eid(&block, "ab", 2) == 0);
-    ASSERT(add_eid(&block, "cd", 2) == 3);
+    size_t pos;
+
+    ASSERT(add_eid(&block, "ab", 2, &pos) && pos == 0);
+    ASSERT(add_eid(&block, "cd", 2, &pos) && pos == 3);
 
-    ASSERT(add_eid(&block, "ab", 2) == 0);
-    ASSERT(add_eid(&block, "cd", 2) == 3);
+    ASSERT(add_eid(&block, "ab", 2, &pos) && pos == 0);
+    ASSERT(add_eid(&block, "cd", 2, &pos) && pos == 3);
 
     primary_block_destroy(&block);
 
@@ -431,9 +714,17 @@ bool primary_block_add_eid(primary_block_t *b, eid_t *e, const char *str) {
     if (!sep)
         return false;
 
+    size_t scheme, ssp;
+
+    if (!add_eid(b, str, (size_t)(sep - str), &scheme) ||
+        !add_eid(b, sep + 1, strlen(sep + 1), &ssp))
+    {
+        return false;
+    }
+
     *e = (eid_t) {
-        .scheme = (uint32_t) add_eid(b, str, (size_t)(sep - str)),
-        .ssp = (uint32_t) add_eid(b, sep + 1, strlen(sep + 1)),
+        .scheme = (uint32_t) scheme,
+        .ssp = (uint32_t) ssp,
     };
 
     return true;
@@ -468,13 +759,117 @@ TEST test_primary_block_add_eid(void) {
 }
 #endif
 
+#if defined MKBUNDLE_TEST && !defined MKBUNDLE_FIXED
+TEST test_primary_block_arena(void) {
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    primary_block_t heap, block;
+    primary_block_init(&heap);
+    primary_block_init_arena(&block, &arena);
+
+    ASSERT_EQ(block.eid_map->arena, &arena);
+    ASSERT_EQ(block.eid_buf->arena, &arena);
+
+    // Enough EIDs to grow the table and the string buffer.
+    for (size_t i = 0; i < 1000; i += 1) {
+        char str[32];
+        snprintf(str, sizeof(str), "dtn:node-%zu", i);
+
+        eid_t a, b;
+        ASSERT(primary_block_add_eid(&heap, &a, str));
+        ASSERT(primary_block_add_eid(&block, &b, str));
+        ASSERT_EQ(a.scheme, b.scheme);
+        ASSERT_EQ(a.ssp, b.ssp);
+    }
+
+    ASSERT(block.eid_map->size > 1u << 6);
+    ASSERT_EQ(block.eid_buf->pos, heap.eid_buf->pos);
+    ASSERT_EQ(memcmp(block.eid_buf->buf, heap.eid_buf->buf,
+                     heap.eid_buf->pos), 0);
+
+    // Destroying a block in an arena leaves its memory to the arena.
+    primary_block_destroy(&block);
+    primary_block_destroy(&heap);
+    arena_destroy(&arena);
+
+    PASS();
+}
+#endif
+
+#if defined MKBUNDLE_TEST && defined MKBUNDLE_FIXED
+TEST test_primary_block_fixed(void) {
+    primary_block_t block;
+    primary_block_init(&block);
+
+    ASSERT_EQ((void *) block.eid_buf, (void *) block.eid_mem);
+
+    // Fill the block until an EID doesn't fit.
+    size_t count = 0;
+
+    for (;;) {
+        char str[32];
+        snprintf(str, sizeof(str), "dtn:node-%zu", count);
+
+        eid_t e;
+
+        if (!primary_block_add_eid(&block, &e, str))
+            break;
+
+        count += 1;
+    }
+
+    ASSERT(count > 0);
+    ASSERT(block.eid_buf->pos <= PRIMARY_EID_BUF_MAX);
+
+    // EIDs already added are still found.
+    eid_t e;
+    ASSERT(primary_block_add_eid(&block, &e, "dtn:node-0"));
+    ASSERT_EQ(e.scheme, 0);
+    ASSERT_EQ(e.ssp, 4);
+
+    primary_block_destroy(&block);
+
+    // Strings in params are held to the same limit.
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+    strbuf_append(&sb, "{\"a\": [\"", 8);
+
+    for (size_t i = 0; i < PRIMARY_EID_BUF_MAX; i += 1)
+        strbuf_append(&sb, "x", 1);
+
+    strbuf_append(&sb, "\"]}", 3);
+
+    parser_t parser;
+    parser_init(&parser);
+    ASSERT(parser_parse(&parser, sb->buf, sb->pos));
+    ASSERT(parser_advance(&parser));
+    ASSERT(parser_advance(&parser));
+
+    primary_block_init(&block);
+    ASSERT(!parse_eids(&block.eid_buf, &parser));
+    primary_block_destroy(&block);
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+#endif
+
 #ifdef MKBUNDLE_TEST
 SUITE(primary_block_suite) {
     RUN_TEST(test_calc_length);
     RUN_TEST(test_serialize_eids);
     RUN_TEST(test_parse_eids);
     RUN_TEST(test_primary_block_unserialize);
+    RUN_TEST(test_primary_block_unserialize_widths);
+    RUN_TEST(test_primary_block_encode);
     RUN_TEST(test_add_eid);
     RUN_TEST(test_primary_block_add_eid);
+#ifdef MKBUNDLE_FIXED
+    RUN_TEST(test_primary_block_fixed);
+#else
+    RUN_TEST(test_primary_block_arena);
+#endif
 }
 #endif
@@ -4,11 +4,14 @@
 #define PRIMARY_BLOCK_H
 
 #include <inttypes.h>
+#include <stdalign.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "eid.h"
 #include "parser.h"
+#include "sink.h"
 #include "strbuf.h"
 
 #define HTABLE_COMMON
@@ -28,46 +31,103 @@ typedef struct {
 #define HTABLE_KEY_TYPE eid_table_str_t *
 #define HTABLE_DATA_TYPE size_t
 #define HTABLE_DEFAULT_SIZE (1u << 6)
+#ifdef MKBUNDLE_FIXED
+#define HTABLE_FIXED
+#else
+#define HTABLE_ARENA
+#endif
 #define HTABLE_HASH_KEY(key) fnv(key)
 #include "htable.h"
 
+#ifdef MKBUNDLE_FIXED
+enum {
+    // Most bytes of EID strings, including terminators, a block can hold.
+    PRIMARY_EID_BUF_MAX = 1 << 10,
+};
+#endif
+
+// Fields that can be encoded with a fixed width.
+typedef enum {
+    PRIMARY_FIELD_CREATION_TS,
+    PRIMARY_FIELD_CREATION_SEQ,
+    PRIMARY_FIELD_LIFETIME,
+
+    PRIMARY_FIELD_MAX,
+    PRIMARY_FIELD_INVALID = PRIMARY_FIELD_MAX,
+} primary_field_t;
+
+// Names of the fields in params, which the command line uses too.
+extern const char *const primary_field_names[PRIMARY_FIELD_MAX];
+
 typedef struct {
     uint8_t version;
     uint32_t flags;
-    uint32_t length;
+    // Informational only: the encoder derives the length from the fields.
+    uint64_t length;
 
     eid_t dest;
     eid_t src;
     eid_t report_to;
     eid_t custodian;
 
-    uint32_t creation_ts;
-    uint32_t creation_seq;
-    uint32_t lifetime;
+    uint64_t creation_ts;
+    uint64_t creation_seq;
+    uint64_t lifetime;
     uint32_t eids_size;
 
+    // Fixed SDNV width of each field, or zero to encode it minimally. Fields
+    // with a fixed width can be patched in place in the compiled block.
+    uint8_t widths[PRIMARY_FIELD_MAX];
+
+#ifdef MKBUNDLE_FIXED
     // Maps EID strings to offsets inside eid_buf.
+    eid_map_t eid_map;
+#else
     eid_map_t *eid_map;
+#endif
     // Holds all EID strings.
     strbuf_t *eid_buf;
+#ifdef MKBUNDLE_FIXED
+    // Storage for eid_buf, so the block never touches the heap. This makes
+    // the block unsafe to copy.
+    alignas(strbuf_t) char eid_mem[sizeof(strbuf_t) + PRIMARY_EID_BUF_MAX];
+#endif
 } primary_block_t;
 
 // Initialize the block to a default state.
 void primary_block_init(primary_block_t *b);
 
+// Initialize the block to a default state, with its EID table and strings
+// allocated from the arena, or from the heap if it's NULL. With
+// MKBUNDLE_FIXED, they're held inside the block and the arena is unused.
+void primary_block_init_arena(primary_block_t *b, arena_t *arena);
+
 // Free memory held by the block.
 void primary_block_destroy(primary_block_t *b);
 
-// Write the params for the block to JSON.
-void primary_block_serialize(const primary_block_t *b, FILE *stream);
+// Write the params for the block to the sink as JSON.
+void primary_block_serialize(const primary_block_t *b, sink_t *s);
 
 // Unserialize a block from the parser.
 bool primary_block_unserialize(primary_block_t *b, parser_t *p);
 
-// Write the final binary form of the block.
-void primary_block_write(const primary_block_t *b, FILE *stream);
+// Append the final binary form of the block to the strbuf.
+void primary_block_encode(const primary_block_t *b, strbuf_t **sbp);
+
+// Write the final binary form of the block to the sink. Return false if the
+// sink has failed.
+bool primary_block_write(const primary_block_t *b, sink_t *s);
+
+// Encode the given field with exactly width bytes, or minimally if width is
+// zero. Return false if the width is larger than any SDNV of the field.
+bool primary_block_set_width(primary_block_t *b, primary_field_t f,
+                             size_t width);
+
+// Check if every fixed-width field fits in its width.
+bool primary_block_check_widths(const primary_block_t *b);
 
-// Parse the string into an EID and add it to the block.
+// Parse the string into an EID and add it to the block. Return false if the
+// string isn't an EID or the block has no room left for it.
 bool primary_block_add_eid(primary_block_t *b, eid_t *e, const char *str);
 
 #endif
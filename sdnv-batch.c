@@ -0,0 +1,813 @@
+// See copyright notice in Copying.
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __x86_64__
+#include <immintrin.h>
+#define SDNV_BATCH_X86
+#endif
+
+#include "sdnv-batch.h"
+#include "sdnv.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#endif
+
+#ifdef MKBUNDLE_BENCH
+#include "bench.h"
+#endif
+
+// Signatures of batch encode kernels.
+typedef size_t (*encode_u32_fn)(const uint32_t *vals, size_t count,
+                                uint8_t *out, size_t *offsets);
+typedef size_t (*encode_u64_fn)(const uint64_t *vals, size_t count,
+                                uint8_t *out, size_t *offsets);
+
+static size_t encode_u32_scalar(const uint32_t *vals, size_t count,
+                                uint8_t *out, size_t *offsets)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i += 1) {
+        offsets[i] = pos;
+        pos += sdnv_encode_u32(vals[i], &out[pos]);
+    }
+
+    offsets[count] = pos;
+
+    return pos;
+}
+
+static size_t encode_u64_scalar(const uint64_t *vals, size_t count,
+                                uint8_t *out, size_t *offsets)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i += 1) {
+        offsets[i] = pos;
+        pos += sdnv_encode_u64(vals[i], &out[pos]);
+    }
+
+    offsets[count] = pos;
+
+    return pos;
+}
+
+#ifdef SDNV_BATCH_X86
+// Selects the 7-bit groups of a value that fit in one word.
+#define SPREAD_MASK UINT64_C(0x7f7f7f7f7f7f7f7f)
+// Continue bits for every byte of a word.
+#define CONTINUE_MASK UINT64_C(0x8080808080808080)
+
+// Store a value whose 7-bit groups have been spread one per byte, with the
+// least-significant group in the low byte, as a len-byte SDNV. A whole word is
+// stored, so up to 8 - len bytes past the SDNV are clobbered.
+static inline size_t store_spread(uint64_t spread, size_t len, uint8_t *out) {
+    size_t shift = CHAR_BIT * (sizeof(spread) - len);
+
+    // Set the continue bit on every byte but the least-significant one.
+    spread |= (CONTINUE_MASK >> shift) & ~UINT64_C(0xff);
+
+    // Move the most-significant group into the top byte, then reverse into
+    // big-endian order.
+    uint64_t be = __builtin_bswap64(spread << shift);
+    memcpy(out, &be, sizeof(be));
+
+    return len;
+}
+
+__attribute__((target("bmi2")))
+static size_t encode_u32_bmi2(const uint32_t *vals, size_t count,
+                              uint8_t *out, size_t *offsets)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i += 1) {
+        offsets[i] = pos;
+        pos += store_spread(_pdep_u64(vals[i], SPREAD_MASK),
+                            sdnv_len_u32(vals[i]), &out[pos]);
+    }
+
+    offsets[count] = pos;
+
+    return pos;
+}
+
+__attribute__((target("bmi2")))
+static size_t encode_u64_bmi2(const uint64_t *vals, size_t count,
+                              uint8_t *out, size_t *offsets)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i += 1) {
+        offsets[i] = pos;
+
+        // Values over 56 bits don't fit in one spread word.
+        if (vals[i] >> 56)
+            pos += sdnv_encode_u64(vals[i], &out[pos]);
+        else
+            pos += store_spread(_pdep_u64(vals[i], SPREAD_MASK),
+                                sdnv_len_u64(vals[i]), &out[pos]);
+    }
+
+    offsets[count] = pos;
+
+    return pos;
+}
+
+// Spread and encode 4 values in 64-bit lanes, leaving each lane as the word
+// store_spread would store and setting each length.
+__attribute__((target("avx2")))
+static inline __m256i encode_lanes_avx2(__m256i v, __m256i *lens) {
+    const __m256i group = _mm256_set1_epi64x(0x7f);
+
+    // Spread the 5 groups of each 32-bit value one per byte.
+    __m256i spread = _mm256_and_si256(v, group);
+    spread = _mm256_or_si256(spread, _mm256_and_si256(
+        _mm256_slli_epi64(v, 1), _mm256_slli_epi64(group, 8)));
+    spread = _mm256_or_si256(spread, _mm256_and_si256(
+        _mm256_slli_epi64(v, 2), _mm256_slli_epi64(group, 16)));
+    spread = _mm256_or_si256(spread, _mm256_and_si256(
+        _mm256_slli_epi64(v, 3), _mm256_slli_epi64(group, 24)));
+    spread = _mm256_or_si256(spread, _mm256_and_si256(
+        _mm256_slli_epi64(v, 4), _mm256_slli_epi64(group, 32)));
+
+    // Each compare is -1 where the value needs another byte.
+    __m256i len = _mm256_set1_epi64x(1);
+    len = _mm256_sub_epi64(len,
+        _mm256_cmpgt_epi64(v, _mm256_set1_epi64x(0x7f)));
+    len = _mm256_sub_epi64(len,
+        _mm256_cmpgt_epi64(v, _mm256_set1_epi64x(0x3fff)));
+    len = _mm256_sub_epi64(len,
+        _mm256_cmpgt_epi64(v, _mm256_set1_epi64x(0x1fffff)));
+    len = _mm256_sub_epi64(len,
+        _mm256_cmpgt_epi64(v, _mm256_set1_epi64x(0xfffffff)));
+
+    // Same as store_spread, using bswap(x << n) == bswap(x) >> n.
+    __m256i shift = _mm256_slli_epi64(
+        _mm256_sub_epi64(_mm256_set1_epi64x(sizeof(uint64_t)), len), 3);
+    __m256i cont = _mm256_andnot_si256(_mm256_set1_epi64x(0xff),
+        _mm256_srlv_epi64(_mm256_set1_epi64x((long long) CONTINUE_MASK),
+                          shift));
+    const __m256i bswap = _mm256_setr_epi8(
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+    *lens = len;
+
+    return _mm256_srlv_epi64(
+        _mm256_shuffle_epi8(_mm256_or_si256(spread, cont), bswap), shift);
+}
+
+__attribute__((target("avx2")))
+static size_t encode_u32_avx2(const uint32_t *vals, size_t count,
+                              uint8_t *out, size_t *offsets)
+{
+    enum { LANES = 4 };
+
+    uint64_t words[LANES];
+    uint64_t lens[LANES];
+    size_t pos = 0;
+    size_t i = 0;
+
+    for (; i + LANES <= count; i += LANES) {
+        __m256i len;
+        __m256i v = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128((const __m128i *) &vals[i]));
+
+        _mm256_storeu_si256((__m256i *) words, encode_lanes_avx2(v, &len));
+        _mm256_storeu_si256((__m256i *) lens, len);
+
+        for (size_t k = 0; k < LANES; k += 1) {
+            offsets[i + k] = pos;
+            memcpy(&out[pos], &words[k], sizeof(words[k]));
+            pos += lens[k];
+        }
+    }
+
+    for (; i < count; i += 1) {
+        offsets[i] = pos;
+        pos += sdnv_encode_u32(vals[i], &out[pos]);
+    }
+
+    offsets[count] = pos;
+
+    return pos;
+}
+#endif
+
+// Pick the fastest kernels the CPU supports.
+static encode_u32_fn pick_u32(void) {
+#ifdef SDNV_BATCH_X86
+    if (__builtin_cpu_supports("avx2"))
+        return encode_u32_avx2;
+
+    if (__builtin_cpu_supports("bmi2"))
+        return encode_u32_bmi2;
+#endif
+
+    return encode_u32_scalar;
+}
+
+static encode_u64_fn pick_u64(void) {
+#ifdef SDNV_BATCH_X86
+    if (__builtin_cpu_supports("bmi2"))
+        return encode_u64_bmi2;
+#endif
+
+    return encode_u64_scalar;
+}
+
+size_t sdnv_encode_batch_u32(const uint32_t *vals, size_t count, uint8_t *out,
+                             size_t *offsets)
+{
+    return pick_u32()(vals, count, out, offsets);
+}
+
+size_t sdnv_encode_batch_u64(const uint64_t *vals, size_t count, uint8_t *out,
+                             size_t *offsets)
+{
+    return pick_u64()(vals, count, out, offsets);
+}
+
+// Signature of bulk decode kernels.
+typedef size_t (*decode_u64_fn)(const uint8_t *bytes, size_t byte_count,
+                                uint64_t *vals, size_t count, size_t *used);
+
+// Decode one SDNV at a time. This is the reference the other kernels must
+// match, and also finishes whatever input they can't handle.
+static size_t decode_u64_scalar(const uint8_t *bytes, size_t byte_count,
+                                uint64_t *vals, size_t count, size_t *used)
+{
+    size_t pos = 0;
+    size_t n = 0;
+
+    for (; n < count; n += 1) {
+        size_t len;
+        sdnv_status_t status =
+            sdnv_decode_u64(&bytes[pos], byte_count - pos, &vals[n], &len);
+
+        if (status != SDNV_OK && status != SDNV_OVERLONG)
+            break;
+
+        pos += len;
+    }
+
+    *used = pos;
+
+    return n;
+}
+
+#ifdef SDNV_BATCH_X86
+// Decode every SDNV that fits in a word and ends in the window starting at
+// pos. Bit i of term is set if bytes[pos + i] ends an SDNV. At least a word
+// must be readable past each terminator's SDNV start. Return the position
+// after the last SDNV decoded.
+__attribute__((target("bmi2")))
+static inline size_t decode_window(const uint8_t *bytes, size_t pos,
+                                   uint64_t term, uint64_t *vals,
+                                   size_t count, size_t *n)
+{
+    size_t start = pos;
+
+    for (; term && *n < count; term &= term - 1) {
+        size_t end = pos + (size_t) __builtin_ctzll(term) + 1;
+        size_t len = end - start;
+
+        if (len > sizeof(uint64_t))
+            break;
+
+        // Put the SDNV in the low bytes with its last byte lowest, then
+        // squeeze out the continue bits.
+        uint64_t word;
+        memcpy(&word, &bytes[start], sizeof(word));
+        word = __builtin_bswap64(word) >> (CHAR_BIT * (sizeof(word) - len));
+
+        vals[*n] = _pext_u64(word, SPREAD_MASK);
+        *n += 1;
+
+        start = end;
+    }
+
+    return start;
+}
+
+// Decode an SDNV decode_window can't handle. Return false if decoding has to
+// stop.
+static bool decode_one(const uint8_t *bytes, size_t byte_count, size_t *pos,
+                       uint64_t *vals, size_t *n)
+{
+    size_t len;
+    sdnv_status_t status =
+        sdnv_decode_u64(&bytes[*pos], byte_count - *pos, &vals[*n], &len);
+
+    if (status != SDNV_OK && status != SDNV_OVERLONG)
+        return false;
+
+    *pos += len;
+    *n += 1;
+
+    return true;
+}
+
+// Find the SDNV terminators, the bytes without a continue bit, 16 bytes at a
+// time.
+__attribute__((target("bmi2")))
+static size_t decode_u64_sse2(const uint8_t *bytes, size_t byte_count,
+                              uint64_t *vals, size_t count, size_t *used)
+{
+    enum { WINDOW = sizeof(__m128i) };
+
+    size_t pos = 0;
+    size_t n = 0;
+
+    while (n < count && pos + WINDOW + sizeof(uint64_t) <= byte_count) {
+        __m128i w = _mm_loadu_si128((const __m128i *) &bytes[pos]);
+        uint64_t term = ~(uint32_t) _mm_movemask_epi8(w) & 0xffffu;
+        size_t next = decode_window(bytes, pos, term, vals, count, &n);
+
+        if (next == pos && !decode_one(bytes, byte_count, &next, vals, &n))
+            break;
+
+        pos = next;
+    }
+
+    size_t tail;
+    n += decode_u64_scalar(&bytes[pos], byte_count - pos, &vals[n], count - n,
+                           &tail);
+    *used = pos + tail;
+
+    return n;
+}
+
+// Same as above, 32 bytes at a time.
+__attribute__((target("avx2,bmi2")))
+static size_t decode_u64_avx2(const uint8_t *bytes, size_t byte_count,
+                              uint64_t *vals, size_t count, size_t *used)
+{
+    enum { WINDOW = sizeof(__m256i) };
+
+    size_t pos = 0;
+    size_t n = 0;
+
+    while (n < count && pos + WINDOW + sizeof(uint64_t) <= byte_count) {
+        __m256i w = _mm256_loadu_si256((const __m256i *) &bytes[pos]);
+        uint64_t term = ~(uint32_t) _mm256_movemask_epi8(w);
+        size_t next = decode_window(bytes, pos, term, vals, count, &n);
+
+        if (next == pos && !decode_one(bytes, byte_count, &next, vals, &n))
+            break;
+
+        pos = next;
+    }
+
+    size_t tail;
+    n += decode_u64_scalar(&bytes[pos], byte_count - pos, &vals[n], count - n,
+                           &tail);
+    *used = pos + tail;
+
+    return n;
+}
+#endif
+
+static decode_u64_fn pick_decode_u64(void) {
+#ifdef SDNV_BATCH_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+        return decode_u64_avx2;
+
+    if (__builtin_cpu_supports("bmi2"))
+        return decode_u64_sse2;
+#endif
+
+    return decode_u64_scalar;
+}
+
+size_t sdnv_decode_batch_u64(const uint8_t *bytes, size_t byte_count,
+                             uint64_t *vals, size_t count, size_t *used)
+{
+    return pick_decode_u64()(bytes, byte_count, vals, count, used);
+}
+
+#if defined MKBUNDLE_TEST || defined MKBUNDLE_BENCH
+// A kernel and whether the CPU can run it.
+typedef struct {
+    const char *name;
+    encode_u32_fn fn;
+    bool supported;
+} kernel_u32_t;
+
+typedef struct {
+    const char *name;
+    encode_u64_fn fn;
+    bool supported;
+} kernel_u64_t;
+
+typedef struct {
+    const char *name;
+    decode_u64_fn fn;
+    bool supported;
+} kernel_decode_t;
+
+static void decode_kernels_init(kernel_decode_t kd[static 3]) {
+    kd[0] = (kernel_decode_t) {"scalar", decode_u64_scalar, true};
+
+#ifdef SDNV_BATCH_X86
+    kd[1] = (kernel_decode_t) {"sse2", decode_u64_sse2,
+                               __builtin_cpu_supports("bmi2")};
+    kd[2] = (kernel_decode_t) {"avx2", decode_u64_avx2,
+                               __builtin_cpu_supports("avx2") &&
+                               __builtin_cpu_supports("bmi2")};
+#else
+    kd[1] = kd[2] = (kernel_decode_t) {"none", NULL, false};
+#endif
+}
+
+static void kernels_init(kernel_u32_t k32[static 3],
+                         kernel_u64_t k64[static 2])
+{
+    k32[0] = (kernel_u32_t) {"scalar", encode_u32_scalar, true};
+    k64[0] = (kernel_u64_t) {"scalar", encode_u64_scalar, true};
+
+#ifdef SDNV_BATCH_X86
+    k32[1] = (kernel_u32_t) {"bmi2", encode_u32_bmi2,
+                             __builtin_cpu_supports("bmi2")};
+    k32[2] = (kernel_u32_t) {"avx2", encode_u32_avx2,
+                             __builtin_cpu_supports("avx2")};
+    k64[1] = (kernel_u64_t) {"bmi2", encode_u64_bmi2,
+                             __builtin_cpu_supports("bmi2")};
+#else
+    k32[1] = k32[2] = (kernel_u32_t) {"none", NULL, false};
+    k64[1] = (kernel_u64_t) {"none", NULL, false};
+#endif
+}
+
+// Generate a field value with a rough distribution of real bundles: mostly
+// offsets and flags, with some timestamps and the occasional large value.
+static uint64_t next_field(uint64_t *state) {
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    static const unsigned BITS[] = {7, 7, 7, 7, 14, 14, 21, 32};
+
+    return *state >> (64 - BITS[*state & 7]);
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+TEST test_encode_batch(void) {
+    enum { COUNT = 1003 };
+
+    static uint32_t vals32[COUNT];
+    static uint64_t vals64[COUNT];
+    static uint8_t expect[SDNV_BATCH_CAP_U64(COUNT)];
+    static uint8_t out[SDNV_BATCH_CAP_U64(COUNT)];
+    static size_t expect_offsets[COUNT + 1];
+    static size_t offsets[COUNT + 1];
+
+    kernel_u32_t k32[3];
+    kernel_u64_t k64[2];
+    kernels_init(k32, k64);
+
+    uint64_t state = 42;
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        vals32[i] = (uint32_t) next_field(&state);
+        vals64[i] = next_field(&state) << (i % 33);
+    }
+
+    // Make sure every boundary shows up.
+    for (unsigned shift = 0; shift < 32; shift += 1) {
+        vals32[shift] = (uint32_t)((UINT64_C(1) << shift) - 1);
+        vals32[shift + 32] = UINT32_C(1) << shift;
+    }
+
+    for (unsigned shift = 0; shift < 64; shift += 1) {
+        vals64[shift] = (UINT64_C(1) << shift) - 1;
+        vals64[shift + 64] = UINT64_C(1) << shift;
+    }
+
+    size_t len = 0;
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        expect_offsets[i] = len;
+        len += sdnv_encode_u32(vals32[i], &expect[len]);
+    }
+
+    expect_offsets[COUNT] = len;
+
+    for (size_t k = 0; k < ASIZE(k32); k += 1) {
+        if (!k32[k].supported)
+            continue;
+
+        memset(out, 0, sizeof(out));
+        ASSERT_EQ(k32[k].fn(vals32, COUNT, out, offsets), len);
+        ASSERT_EQ(memcmp(out, expect, len), 0);
+        ASSERT_EQ(memcmp(offsets, expect_offsets, sizeof(offsets)), 0);
+    }
+
+    ASSERT_EQ(sdnv_encode_batch_u32(vals32, COUNT, out, offsets), len);
+    ASSERT_EQ(memcmp(out, expect, len), 0);
+
+    len = 0;
+
+    for (size_t i = 0; i < COUNT; i += 1) {
+        expect_offsets[i] = len;
+        len += sdnv_encode_u64(vals64[i], &expect[len]);
+    }
+
+    expect_offsets[COUNT] = len;
+
+    for (size_t k = 0; k < ASIZE(k64); k += 1) {
+        if (!k64[k].supported)
+            continue;
+
+        memset(out, 0, sizeof(out));
+        ASSERT_EQ(k64[k].fn(vals64, COUNT, out, offsets), len);
+        ASSERT_EQ(memcmp(out, expect, len), 0);
+        ASSERT_EQ(memcmp(offsets, expect_offsets, sizeof(offsets)), 0);
+    }
+
+    ASSERT_EQ(sdnv_encode_batch_u64(vals64, COUNT, out, offsets), len);
+    ASSERT_EQ(memcmp(out, expect, len), 0);
+
+    PASS();
+}
+
+TEST test_encode_batch_matches_sdnv_encode(void) {
+    static const uint32_t VALS[] = {
+        0, 1, 0x7f, 0x80, 0xabc, 0x3fff, 0x4000, 0x4234, 0x1fffff, 0x200000,
+        0xfffffff, 0x10000000, 0xff3f, UINT32_MAX,
+    };
+
+    uint8_t out[SDNV_BATCH_CAP_U32(ASIZE(VALS))];
+    size_t offsets[ASIZE(VALS) + 1];
+
+    sdnv_encode_batch_u32(VALS, ASIZE(VALS), out, offsets);
+
+    for (size_t i = 0; i < ASIZE(VALS); i += 1) {
+        uint8_t be[] = {
+            (uint8_t)(VALS[i] >> 24), (uint8_t)(VALS[i] >> 16),
+            (uint8_t)(VALS[i] >> 8), (uint8_t) VALS[i],
+        };
+
+        sdnv_t *sdnv = sdnv_encode(be, sizeof(be));
+
+        ASSERT_EQ(offsets[i + 1] - offsets[i], sdnv->len);
+        ASSERT_EQ(memcmp(&out[offsets[i]], sdnv->bytes, sdnv->len), 0);
+
+        sdnv_destroy(sdnv);
+    }
+
+    PASS();
+}
+
+// Check every decode kernel against the scalar reference.
+static bool check_decode_batch(const uint8_t *bytes, size_t byte_count,
+                               size_t count)
+{
+    static uint64_t expect[1 << 12];
+    static uint64_t vals[1 << 12];
+
+    assert(count <= ASIZE(vals));
+
+    kernel_decode_t kd[3];
+    decode_kernels_init(kd);
+
+    size_t expect_used;
+    size_t expect_n = decode_u64_scalar(bytes, byte_count, expect, count,
+                                        &expect_used);
+
+    for (size_t k = 0; k < ASIZE(kd); k += 1) {
+        if (!kd[k].supported)
+            continue;
+
+        size_t used;
+
+        if (kd[k].fn(bytes, byte_count, vals, count, &used) != expect_n ||
+            used != expect_used ||
+            memcmp(vals, expect, expect_n * sizeof(vals[0])) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST test_decode_batch(void) {
+    enum { COUNT = 1 << 12 };
+
+    static uint64_t vals[COUNT];
+    static uint64_t out[COUNT];
+    static uint8_t buf[SDNV_BATCH_CAP_U64(COUNT)];
+    static size_t offsets[COUNT + 1];
+
+    uint64_t state = 42;
+
+    for (size_t i = 0; i < COUNT; i += 1)
+        vals[i] = next_field(&state) << (i % 40);
+
+    for (unsigned shift = 0; shift < 64; shift += 1)
+        vals[shift * 3] = UINT64_C(1) << shift;
+
+    size_t len = sdnv_encode_batch_u64(vals, COUNT, buf, offsets);
+    size_t used;
+
+    ASSERT_EQ(sdnv_decode_batch_u64(buf, len, out, COUNT, &used), COUNT);
+    ASSERT_EQ(used, len);
+    ASSERT_EQ(memcmp(out, vals, sizeof(vals)), 0);
+
+    ASSERT(check_decode_batch(buf, len, COUNT));
+
+    // Stop at a count or in the middle of the input.
+    ASSERT(check_decode_batch(buf, len, 17));
+    ASSERT(check_decode_batch(buf, len / 2, COUNT));
+    ASSERT(check_decode_batch(buf, offsets[100] - 1, COUNT));
+
+    PASS();
+}
+
+TEST test_decode_batch_errors(void) {
+    uint8_t buf[128];
+
+    // A primary block header followed by an overlong SDNV, then one that's too
+    // long for a word, then one that overflows.
+    static const uint8_t HDR[] = {
+        0x81, 0x10, 0x20, 0x00, 0x04, 0x00, 0x08, 0x00, 0x08, 0x00, 0x0c,
+        0x81, 0xee, 0xb5, 0xca, 0x00, 0x84, 0xa2, 0x70, 0x9c, 0x10, 0x0d,
+        0x80, 0x80, 0x01,
+        0x81, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00,
+        0x82, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00,
+        0x01, 0x02,
+    };
+
+    memset(buf, 0x7f, sizeof(buf));
+    memcpy(buf, HDR, sizeof(HDR));
+
+    uint64_t vals[64];
+    size_t used;
+
+    ASSERT_EQ(sdnv_decode_batch_u64(buf, sizeof(buf), vals, ASIZE(vals),
+                                    &used), 16);
+    ASSERT_EQ(used, 34);
+    ASSERT_EQ(vals[0], 0x90);
+    ASSERT_EQ(vals[1], 0x20);
+    ASSERT_EQ(vals[10], 500000000);
+    ASSERT_EQ(vals[11], 70000);
+    ASSERT_EQ(vals[12], 3600);
+    ASSERT_EQ(vals[13], 0x0d);
+    ASSERT_EQ(vals[14], 1);
+    ASSERT_EQ(vals[15], UINT64_C(1) << 56);
+
+    ASSERT(check_decode_batch(buf, sizeof(buf), ASIZE(vals)));
+    ASSERT(check_decode_batch(buf, sizeof(HDR) - 1, ASIZE(vals)));
+
+    // A window full of continue bytes.
+    memset(buf, 0x80, sizeof(buf));
+    ASSERT(check_decode_batch(buf, sizeof(buf), ASIZE(vals)));
+
+    PASS();
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+SUITE(sdnv_batch_suite) {
+    RUN_TEST(test_encode_batch);
+    RUN_TEST(test_encode_batch_matches_sdnv_encode);
+    RUN_TEST(test_decode_batch);
+    RUN_TEST(test_decode_batch_errors);
+}
+#endif
+
+#ifdef MKBUNDLE_BENCH
+static void bench_decode(void) {
+    enum { COUNT = 1 << 16, ROUNDS = 128 };
+
+    static uint64_t vals[COUNT];
+    static uint8_t buf[SDNV_BATCH_CAP_U64(COUNT)];
+    static size_t offsets[COUNT + 1];
+
+    kernel_decode_t kd[3];
+    decode_kernels_init(kd);
+
+    uint64_t state = 42;
+
+    for (size_t i = 0; i < COUNT; i += 1)
+        vals[i] = next_field(&state);
+
+    size_t len = sdnv_encode_batch_u64(vals, COUNT, buf, offsets);
+
+    for (size_t k = 0; k < ASIZE(kd); k += 1) {
+        if (!kd[k].supported)
+            continue;
+
+        double start = bench_now();
+
+        for (size_t r = 0; r < ROUNDS; r += 1) {
+            size_t used;
+            bench_keep(kd[k].fn(buf, len, vals, COUNT, &used));
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "bulk decode u64 %s", kd[k].name);
+        bench_report(name, (double) COUNT * ROUNDS, "val",
+                     bench_now() - start);
+    }
+}
+
+BENCH_SUITE(sdnv_batch_bench) {
+    enum { COUNT = 1 << 14, ROUNDS = 512 };
+
+    static uint32_t vals[COUNT];
+    static uint8_t out[SDNV_BATCH_CAP_U32(COUNT)];
+    static size_t offsets[COUNT + 1];
+
+    kernel_u32_t k32[3];
+    kernel_u64_t k64[2];
+    kernels_init(k32, k64);
+
+    uint64_t state = 42;
+
+    for (size_t i = 0; i < COUNT; i += 1)
+        vals[i] = (uint32_t) next_field(&state);
+
+    double start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1) {
+            sdnv_t *sdnv = SDNV_ENCODE(SWAP32(vals[i]));
+            memcpy(&out[pos], sdnv->bytes, sdnv->len);
+            pos += sdnv->len;
+            sdnv_destroy(sdnv);
+        }
+
+        bench_keep(pos);
+    }
+
+    bench_report("loop SDNV_ENCODE", (double) COUNT * ROUNDS, "val",
+                 bench_now() - start);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1)
+            pos += sdnv_encode_u32(vals[i], &out[pos]);
+
+        bench_keep(pos);
+    }
+
+    bench_report("loop sdnv_encode_u32", (double) COUNT * ROUNDS, "val",
+                 bench_now() - start);
+
+    for (size_t k = 0; k < ASIZE(k32); k += 1) {
+        if (!k32[k].supported)
+            continue;
+
+        start = bench_now();
+
+        for (size_t r = 0; r < ROUNDS; r += 1)
+            bench_keep(k32[k].fn(vals, COUNT, out, offsets));
+
+        char name[64];
+        snprintf(name, sizeof(name), "batch u32 %s", k32[k].name);
+        bench_report(name, (double) COUNT * ROUNDS, "val",
+                     bench_now() - start);
+    }
+
+    static uint64_t vals64[COUNT];
+    static uint8_t out64[SDNV_BATCH_CAP_U64(COUNT)];
+
+    for (size_t i = 0; i < COUNT; i += 1)
+        vals64[i] = next_field(&state) << (i % 24);
+
+    for (size_t k = 0; k < ASIZE(k64); k += 1) {
+        if (!k64[k].supported)
+            continue;
+
+        start = bench_now();
+
+        for (size_t r = 0; r < ROUNDS; r += 1)
+            bench_keep(k64[k].fn(vals64, COUNT, out64, offsets));
+
+        char name[64];
+        snprintf(name, sizeof(name), "batch u64 %s", k64[k].name);
+        bench_report(name, (double) COUNT * ROUNDS, "val",
+                     bench_now() - start);
+    }
+
+    bench_decode();
+}
+#endif
@@ -0,0 +1,38 @@
+// See copyright notice in Copying.
+
+#ifndef SDNV_BATCH_H
+#define SDNV_BATCH_H
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "sdnv.h"
+
+// Number of output bytes needed to batch encode the given number of values.
+// The kernels store whole words, so this includes slack past the last value.
+#define SDNV_BATCH_CAP_U32(count) \
+    ((count) * SDNV_MAX_U32 + sizeof(uint64_t))
+#define SDNV_BATCH_CAP_U64(count) \
+    ((count) * SDNV_MAX_U64 + sizeof(uint64_t))
+
+// Encode the values back to back into out, which must hold at least
+// SDNV_BATCH_CAP_U32/SDNV_BATCH_CAP_U64 bytes. offsets must hold count + 1
+// entries: offsets[i] is where value i starts and offsets[count] is the total
+// length, which is also returned. The output is the same as encoding each value
+// with sdnv_encode_u32/sdnv_encode_u64, but uses AVX2 or BMI2 when the CPU
+// supports them.
+size_t sdnv_encode_batch_u32(const uint32_t *vals, size_t count, uint8_t *out,
+                             size_t *offsets);
+size_t sdnv_encode_batch_u64(const uint64_t *vals, size_t count, uint8_t *out,
+                             size_t *offsets);
+
+// Decode up to count SDNVs laid back to back at the start of the given bytes
+// into vals. Return the number decoded and set used to the bytes they took up.
+// Overlong SDNVs are accepted. Decoding stops early at an SDNV that is
+// truncated or overflows; sdnv_decode_u64 on the bytes at used reports which.
+// The SDNV terminators are found 16 or 32 bytes at a time with SSE2 or AVX2 and
+// the values are extracted with BMI2 when the CPU supports them.
+size_t sdnv_decode_batch_u64(const uint8_t *bytes, size_t byte_count,
+                             uint64_t *vals, size_t count, size_t *used);
+
+#endif
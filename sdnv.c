@@ -5,16 +5,98 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "sdnv.h"
 
 #ifdef MKBUNDLE_TEST
 #include "greatest.h"
 #endif
 
-// Allocate an SDNV to hold the number of bytes and point the pointer at it.
-static void sdnv_init(sdnv_t **sdnv, size_t byte_count) {
-    *sdnv = malloc(sizeof(sdnv_t) + byte_count * sizeof(uint8_t));
+#ifdef MKBUNDLE_BENCH
+#include "bench.h"
+#endif
+
+// Expand to the table entry for a value below SDNV_SMALL_COUNT. This is the
+// same as the first two bytes of SDNV_CONST, but cheap enough to expand
+// thousands of times.
+#define SMALL_1(x) { \
+    (x) < 0x80 ? (x) : 0x80 | (x) >> 7, \
+    (x) < 0x80 ? 0 : (x) & 0x7f, \
+},
+#define SMALL_4(x) \
+    SMALL_1(x) SMALL_1(x + 1) SMALL_1(x + 2) SMALL_1(x + 3)
+#define SMALL_16(x) \
+    SMALL_4(x) SMALL_4(x + 4) SMALL_4(x + 8) SMALL_4(x + 12)
+#define SMALL_64(x) \
+    SMALL_16(x) SMALL_16(x + 16) SMALL_16(x + 32) SMALL_16(x + 48)
+#define SMALL_256(x) \
+    SMALL_64(x) SMALL_64(x + 64) SMALL_64(x + 128) SMALL_64(x + 192)
+#define SMALL_1024(x) \
+    SMALL_256(x) SMALL_256(x + 256) SMALL_256(x + 512) SMALL_256(x + 768)
+#define SMALL_4096(x) \
+    SMALL_1024(x) SMALL_1024(x + 1024) SMALL_1024(x + 2048) \
+    SMALL_1024(x + 3072)
+
+const uint8_t sdnv_small[SDNV_SMALL_COUNT][2] = {
+    SMALL_4096(0) SMALL_4096(4096) SMALL_4096(8192) SMALL_4096(12288)
+};
+
+static_assert(SDNV_SMALL_COUNT == 4 * 4096, "sdnv_small must be filled");
+
+#undef SMALL_4096
+#undef SMALL_1024
+#undef SMALL_256
+#undef SMALL_64
+#undef SMALL_16
+#undef SMALL_4
+#undef SMALL_1
+
+#ifdef MKBUNDLE_TEST
+TEST test_sdnv_small(void) {
+    for (uint32_t val = 0; val < SDNV_SMALL_COUNT; val += 1) {
+        uint8_t out[SDNV_MAX_U32];
+        size_t len = sdnv_len_u32(val);
+        sdnv_encode_len(val, len, out);
+
+        ASSERT_EQ(sdnv_small_len(val), len);
+        ASSERT_EQ(memcmp(sdnv_small[val], out, len), 0);
+    }
+
+    PASS();
+}
+#endif
+
+// Get the value of the given big-endian bytes if it's below SDNV_SMALL_COUNT.
+// Return false otherwise.
+static inline bool small_value(const uint8_t *bytes, size_t byte_count,
+                               uint32_t *val)
+{
+    // All but the last two bytes must be zero.
+    for (size_t i = 0; i + 2 < byte_count; i += 1)
+        if (bytes[i])
+            return false;
+
+    uint32_t v = bytes[byte_count - 1];
+
+    if (byte_count > 1)
+        v |= (uint32_t) bytes[byte_count - 2] << 8;
+
+    if (v >= SDNV_SMALL_COUNT)
+        return false;
+
+    *val = v;
+
+    return true;
+}
+
+// Allocate an SDNV to hold the number of bytes, from the arena if it isn't
+// NULL, and point the pointer at it.
+static void sdnv_init(sdnv_t **sdnv, size_t byte_count, arena_t *arena) {
+    size_t size = sizeof(sdnv_t) + byte_count * sizeof(uint8_t);
+
+    *sdnv = arena ? arena_alloc(arena, size) : malloc(size);
     assert(*sdnv);
 
     **sdnv = (sdnv_t) {
@@ -159,13 +241,22 @@ static void sdnv_params_init(sdnv_params_t *p, const uint8_t *bytes,
     };
 }
 
-size_t sdnv_len(const uint8_t *bytes, size_t byte_count) {
+static size_t len_general(const uint8_t *bytes, size_t byte_count) {
     sdnv_params_t params;
     sdnv_params_init(&params, bytes, byte_count);
 
     return params.len;
 }
 
+size_t sdnv_len(const uint8_t *bytes, size_t byte_count) {
+    uint32_t val;
+
+    if (small_value(bytes, byte_count, &val))
+        return sdnv_small_len(val);
+
+    return len_general(bytes, byte_count);
+}
+
 #ifdef MKBUNDLE_TEST
 TEST test_sdnv_len(void) {
     ASSERT_EQ(sdnv_len((uint8_t[]){0xff}, 1), 2);
@@ -179,7 +270,9 @@ TEST test_sdnv_len(void) {
 }
 #endif
 
-sdnv_t *sdnv_encode(const uint8_t *bytes, size_t byte_count) {
+static sdnv_t *encode_general(const uint8_t *bytes, size_t byte_count,
+                              arena_t *arena)
+{
 // The value of the "continue" bit.
 #define CONTINUE (1u << 7)
 
@@ -193,7 +286,7 @@ sdnv_t *sdnv_encode(const uint8_t *bytes, size_t byte_count) {
 
     // The output SDNV itself.
     sdnv_t *out;
-    sdnv_init(&out, params.len);
+    sdnv_init(&out, params.len, arena);
 
     // The current bit index. Start on the most significant bit.
     size_t bit = 0;
@@ -252,6 +345,25 @@ sdnv_t *sdnv_encode(const uint8_t *bytes, size_t byte_count) {
 #undef CONTINUE
 }
 
+sdnv_t *sdnv_encode(const uint8_t *bytes, size_t byte_count) {
+    return sdnv_encode_arena(bytes, byte_count, NULL);
+}
+
+sdnv_t *sdnv_encode_arena(const uint8_t *bytes, size_t byte_count,
+                          arena_t *arena)
+{
+    uint32_t val;
+
+    if (!small_value(bytes, byte_count, &val))
+        return encode_general(bytes, byte_count, arena);
+
+    sdnv_t *out;
+    sdnv_init(&out, sdnv_small_len(val), arena);
+    memcpy(out->bytes, sdnv_small[val], out->len);
+
+    return out;
+}
+
 #ifdef MKBUNDLE_TEST
 TEST test_sdnv_encode(void) {
     sdnv_t *sdnv;
@@ -425,14 +537,516 @@ TEST test_sdnv_encode(void) {
 
     PASS();
 }
+
+TEST test_sdnv_encode_arena(void) {
+    static const uint8_t INPUTS[][4] = {
+        {0x00, 0x00, 0x00, 0x05},
+        {0x00, 0x00, 0x42, 0x34},
+        {0x00, 0xff, 0xff, 0xff},
+        {0xff, 0xff, 0xff, 0xff},
+    };
+
+    arena_t arena;
+    arena_init(&arena, 256, 0);
+
+    for (size_t i = 0; i < sizeof(INPUTS) / sizeof(INPUTS[0]); i += 1) {
+        sdnv_t *expect = sdnv_encode(INPUTS[i], sizeof(INPUTS[i]));
+        sdnv_t *sdnv = sdnv_encode_arena(INPUTS[i], sizeof(INPUTS[i]),
+                                         &arena);
+
+        ASSERT_EQ(sdnv->len, expect->len);
+        ASSERT_EQ(memcmp(sdnv->bytes, expect->bytes, sdnv->len), 0);
+        ASSERT_EQ((void *) sdnv, arena.last);
+
+        sdnv_destroy(expect);
+    }
+
+    arena_destroy(&arena);
+
+    PASS();
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+TEST test_sdnv_len_native(void) {
+    ASSERT_EQ(sdnv_len_u32(0), 1);
+    ASSERT_EQ(sdnv_len_u32(0x7f), 1);
+    ASSERT_EQ(sdnv_len_u32(0x80), 2);
+    ASSERT_EQ(sdnv_len_u32(0x3fff), 2);
+    ASSERT_EQ(sdnv_len_u32(0x4000), 3);
+    ASSERT_EQ(sdnv_len_u32(UINT32_MAX), SDNV_MAX_U32);
+
+    ASSERT_EQ(sdnv_len_u64(0), 1);
+    ASSERT_EQ(sdnv_len_u64(UINT32_MAX), 5);
+    ASSERT_EQ(sdnv_len_u64(UINT64_C(1) << 56), 9);
+    ASSERT_EQ(sdnv_len_u64(UINT64_C(1) << 63), SDNV_MAX_U64);
+    ASSERT_EQ(sdnv_len_u64(UINT64_MAX), SDNV_MAX_U64);
+
+    PASS();
+}
+
+// Check the native encoders against the byte-array encoder for the value.
+static bool check_encode_native(uint64_t val) {
+    uint8_t be[sizeof(val)];
+
+    for (size_t i = 0; i < sizeof(be); i += 1)
+        be[i] = (uint8_t)(val >> (8 * (sizeof(be) - 1 - i)));
+
+    sdnv_t *sdnv = sdnv_encode(be, sizeof(be));
+    uint8_t out[SDNV_MAX_U64];
+    size_t len = sdnv_encode_u64(val, out);
+
+    bool ok = len == sdnv->len && len == sdnv_len_u64(val) &&
+              memcmp(out, sdnv->bytes, len) == 0;
+
+    if (val <= UINT32_MAX) {
+        len = sdnv_encode_u32((uint32_t) val, out);
+
+        ok = ok && len == sdnv->len && len == sdnv_len_u32((uint32_t) val) &&
+             memcmp(out, sdnv->bytes, len) == 0;
+    }
+
+    sdnv_destroy(sdnv);
+
+    return ok;
+}
+
+TEST test_sdnv_encode_native(void) {
+    uint8_t out[SDNV_MAX_U64];
+
+    ASSERT_EQ(sdnv_encode_u32(0, out), 1);
+    ASSERT_EQ(out[0], 0x00);
+
+    ASSERT_EQ(sdnv_encode_u32(0xabc, out), 2);
+    ASSERT_EQ(out[0], 0x95);
+    ASSERT_EQ(out[1], 0x3c);
+
+    ASSERT_EQ(sdnv_encode_u32(0x4234, out), 3);
+    ASSERT_EQ(out[0], 0x81);
+    ASSERT_EQ(out[1], 0x84);
+    ASSERT_EQ(out[2], 0x34);
+
+    for (unsigned shift = 0; shift < 56; shift += 1) {
+        uint64_t bit = UINT64_C(1) << shift;
+
+        ASSERT(check_encode_native(bit));
+        ASSERT(check_encode_native(bit - 1));
+        ASSERT(check_encode_native(bit | (bit >> 1) | 1));
+    }
+
+    // The byte-array encoder never compacts a full 8-byte input, so it emits a
+    // leading 0x80 for values between 2^56 and 2^63. The native encoders are
+    // always minimal.
+    ASSERT_EQ(sdnv_encode_u64(UINT64_C(1) << 56, out), 9);
+    ASSERT_EQ(out[0], 0x81);
+    for (size_t i = 1; i < 8; i += 1)
+        ASSERT_EQ(out[i], 0x80);
+    ASSERT_EQ(out[8], 0x00);
+
+    ASSERT_EQ(sdnv_encode_u64(INT64_MAX, out), 9);
+    ASSERT_EQ(out[0], 0xff);
+    ASSERT_EQ(out[8], 0x7f);
+
+    ASSERT(check_encode_native(UINT64_C(1) << 63));
+    ASSERT(check_encode_native(UINT64_MAX));
+
+    PASS();
+}
+#endif
+
+// Find the number of bytes taken up by the SDNV at the start of the given
+// bytes. Return 0 if it isn't terminated.
+static size_t find_end(const uint8_t *bytes, size_t byte_count) {
+    for (size_t i = 0; i < byte_count; i += 1)
+        if (!(bytes[i] & 0x80))
+            return i + 1;
+
+    return 0;
+}
+
+// Get the status of a well-formed SDNV with the given length.
+static inline sdnv_status_t check_minimal(const uint8_t *bytes, size_t len) {
+    return len > 1 && bytes[0] == 0x80 ? SDNV_OVERLONG : SDNV_OK;
+}
+
+sdnv_status_t sdnv_decode_u64(const uint8_t *bytes, size_t byte_count,
+                              uint64_t *val, size_t *used)
+{
+    uint64_t acc = 0;
+    bool overflow = false;
+
+    for (size_t i = 0; i < byte_count; i += 1) {
+        // Shifting in another group would push out set bits.
+        overflow |= (acc >> (64 - 7)) != 0;
+        acc = acc << 7 | (bytes[i] & 0x7fu);
+
+        if (bytes[i] & 0x80)
+            continue;
+
+        *used = i + 1;
+
+        if (overflow)
+            return SDNV_OVERFLOW;
+
+        *val = acc;
+
+        return check_minimal(bytes, i + 1);
+    }
+
+    return SDNV_TRUNCATED;
+}
+
+sdnv_status_t sdnv_decode_u32(const uint8_t *bytes, size_t byte_count,
+                              uint32_t *val, size_t *used)
+{
+    uint64_t wide;
+    sdnv_status_t status = sdnv_decode_u64(bytes, byte_count, &wide, used);
+
+    if (status != SDNV_OK && status != SDNV_OVERLONG)
+        return status;
+
+    if (wide > UINT32_MAX)
+        return SDNV_OVERFLOW;
+
+    *val = (uint32_t) wide;
+
+    return status;
+}
+
+sdnv_status_t sdnv_decode(const uint8_t *bytes, size_t byte_count,
+                          uint8_t *out, size_t out_count, size_t *used)
+{
+    assert(out_count > 0);
+
+    size_t len = find_end(bytes, byte_count);
+
+    if (!len)
+        return SDNV_TRUNCATED;
+
+    *used = len;
+
+    // Skip leading zero groups, then count the significant bits left.
+    size_t skip = 0;
+
+    while (skip < len - 1 && bytes[skip] == 0x80)
+        skip += 1;
+
+    size_t bits = 7 * (len - skip - 1) +
+                  (size_t)(32 - __builtin_clz((bytes[skip] & 0x7fu) | 1));
+
+    if (bits > out_count * CHAR_BIT)
+        return SDNV_OVERFLOW;
+
+    // Fill the output from the least-significant end, carrying leftover bits
+    // of each group into the next output byte.
+    uint32_t acc = 0;
+    size_t acc_bits = 0;
+    size_t j = out_count;
+
+    for (size_t i = len; i > skip; i -= 1) {
+        acc |= (uint32_t)(bytes[i - 1] & 0x7fu) << acc_bits;
+        acc_bits += 7;
+
+        for (; acc_bits >= CHAR_BIT && j; acc_bits -= CHAR_BIT) {
+            out[--j] = (uint8_t) acc;
+            acc >>= CHAR_BIT;
+        }
+    }
+
+    if (j)
+        out[--j] = (uint8_t) acc;
+
+    while (j)
+        out[--j] = 0;
+
+    return check_minimal(bytes, len);
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_sdnv_decode_native(void) {
+    uint64_t val64;
+    uint32_t val32;
+    size_t used;
+
+    ASSERT_EQ(sdnv_decode_u64((uint8_t[]){0x00}, 1, &val64, &used), SDNV_OK);
+    ASSERT_EQ(val64, 0);
+    ASSERT_EQ(used, 1);
+
+    ASSERT_EQ(sdnv_decode_u32((uint8_t[]){0x95, 0x3c, 0xff}, 3, &val32, &used),
+              SDNV_OK);
+    ASSERT_EQ(val32, 0xabc);
+    ASSERT_EQ(used, 2);
+
+    ASSERT_EQ(sdnv_decode_u32((uint8_t[]){0x81, 0x84}, 2, &val32, &used),
+              SDNV_TRUNCATED);
+    ASSERT_EQ(sdnv_decode_u64(NULL, 0, &val64, &used), SDNV_TRUNCATED);
+
+    ASSERT_EQ(sdnv_decode_u32((uint8_t[]){0x80, 0x80, 0x01}, 3, &val32, &used),
+              SDNV_OVERLONG);
+    ASSERT_EQ(val32, 1);
+    ASSERT_EQ(used, 3);
+
+    // 2^32 needs 33 bits.
+    ASSERT_EQ(sdnv_decode_u32((uint8_t[]){0x90, 0x80, 0x80, 0x80, 0x00}, 5,
+                              &val32, &used), SDNV_OVERFLOW);
+    ASSERT_EQ(used, 5);
+    ASSERT_EQ(sdnv_decode_u64((uint8_t[]){0x90, 0x80, 0x80, 0x80, 0x00}, 5,
+                              &val64, &used), SDNV_OK);
+    ASSERT_EQ(val64, UINT64_C(1) << 32);
+
+    // 2^64 needs 65 bits.
+    ASSERT_EQ(sdnv_decode_u64((uint8_t[]){0x82, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                          0x80, 0x80, 0x80, 0x00}, 10,
+                              &val64, &used), SDNV_OVERFLOW);
+    ASSERT_EQ(used, 10);
+
+    for (unsigned shift = 0; shift < 64; shift += 1) {
+        uint64_t in = (UINT64_C(1) << shift) | (UINT64_C(1) << shift >> 1);
+        uint8_t buf[SDNV_MAX_U64];
+        size_t len = sdnv_encode_u64(in, buf);
+
+        ASSERT_EQ(sdnv_decode_u64(buf, len, &val64, &used), SDNV_OK);
+        ASSERT_EQ(val64, in);
+        ASSERT_EQ(used, len);
+        ASSERT_EQ(sdnv_decode_u64(buf, len - 1, &val64, &used),
+                  SDNV_TRUNCATED);
+    }
+
+    PASS();
+}
+
+TEST test_sdnv_decode(void) {
+    uint8_t out[16];
+    size_t used;
+
+    ASSERT_EQ(sdnv_decode((uint8_t[]){0x95, 0x3c}, 2, out, 2, &used), SDNV_OK);
+    ASSERT_EQ(used, 2);
+    ASSERT_EQ(out[0], 0x0a);
+    ASSERT_EQ(out[1], 0xbc);
+
+    ASSERT_EQ(sdnv_decode((uint8_t[]){0x81, 0x7f}, 2, out, 4, &used), SDNV_OK);
+    ASSERT_EQ(out[0], 0x00);
+    ASSERT_EQ(out[1], 0x00);
+    ASSERT_EQ(out[2], 0x00);
+    ASSERT_EQ(out[3], 0xff);
+
+    ASSERT_EQ(sdnv_decode((uint8_t[]){0x82, 0x00}, 2, out, 1, &used),
+              SDNV_OVERFLOW);
+    ASSERT_EQ(sdnv_decode((uint8_t[]){0x80, 0x81, 0x7f}, 3, out, 1, &used),
+              SDNV_OVERLONG);
+    ASSERT_EQ(out[0], 0xff);
+    ASSERT_EQ(sdnv_decode((uint8_t[]){0x81, 0x81}, 2, out, 1, &used),
+              SDNV_TRUNCATED);
+
+    // Round trip the multi-word value from test_sdnv_encode.
+    static const uint8_t IN[] = {
+        0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff,
+        0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff,
+    };
+
+    sdnv_t *sdnv = sdnv_encode(IN, sizeof(IN));
+    ASSERT_EQ(sdnv_decode(sdnv->bytes, sdnv->len, out, sizeof(IN), &used),
+              SDNV_OK);
+    ASSERT_EQ(used, sdnv->len);
+    ASSERT_EQ(memcmp(out, IN, sizeof(IN)), 0);
+    sdnv_destroy(sdnv);
+
+    PASS();
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+TEST test_sdnv_encode_fixed(void) {
+    uint8_t out[SDNV_MAX_U64];
+    uint64_t val;
+    size_t used;
+
+    ASSERT(sdnv_encode_u64_fixed(0, 1, out));
+    ASSERT_EQ(out[0], 0x00);
+
+    ASSERT(sdnv_encode_u64_fixed(0xabc, 4, out));
+    ASSERT_EQ(out[0], 0x80);
+    ASSERT_EQ(out[1], 0x80);
+    ASSERT_EQ(out[2], 0x95);
+    ASSERT_EQ(out[3], 0x3c);
+
+    ASSERT_EQ(sdnv_decode_u64(out, 4, &val, &used), SDNV_OVERLONG);
+    ASSERT_EQ(val, 0xabc);
+    ASSERT_EQ(used, 4);
+
+    ASSERT(sdnv_encode_u64_fixed(0x3fff, 2, out));
+    ASSERT(!sdnv_encode_u64_fixed(0x4000, 2, out));
+    ASSERT(!sdnv_encode_u64_fixed(0, 0, out));
+    ASSERT(sdnv_encode_u64_fixed(UINT64_MAX, SDNV_MAX_U64, out));
+
+    PASS();
+}
+
+// Lengths are usable in constant expressions.
+static_assert(SDNV_CONST_LEN(0) == 1, "SDNV_CONST_LEN");
+static_assert(SDNV_CONST_LEN(0x3fff) == 2, "SDNV_CONST_LEN");
+static_assert(SDNV_CONST_LEN(UINT64_MAX) == SDNV_MAX_U64, "SDNV_CONST_LEN");
+static_assert(SDNV_CONST_BYTE(0xabc, 0) == 0x95, "SDNV_CONST_BYTE");
+static_assert(SDNV_CONST_BYTE(0xabc, 1) == 0x3c, "SDNV_CONST_BYTE");
+static_assert(SDNV_CONST_BYTE(0xabc, 2) == 0x00, "SDNV_CONST_BYTE");
+
+// Check the precomputed SDNV against the native encoder.
+static bool check_const(const sdnv_const_t *c, uint64_t val) {
+    uint8_t out[SDNV_MAX_U64];
+    size_t len = sdnv_encode_u64(val, out);
+
+    return c->len == len && memcmp(c->bytes, out, len) == 0;
+}
+
+TEST test_sdnv_const(void) {
+#define CHECK_CONST(x) do { \
+    static const sdnv_const_t C = SDNV_CONST(x); \
+    ASSERT(check_const(&C, (x))); \
+} while (0)
+
+    CHECK_CONST(0);
+    CHECK_CONST(0x06);
+    CHECK_CONST(0x7f);
+    CHECK_CONST(0x80);
+    CHECK_CONST(0x4234);
+    CHECK_CONST(3600);
+    CHECK_CONST(1u << 18);
+    CHECK_CONST(0x3ffffu);
+    CHECK_CONST(UINT32_MAX);
+    CHECK_CONST(UINT64_C(1) << 56);
+    CHECK_CONST(INT64_MAX);
+    CHECK_CONST(UINT64_MAX);
+
+#undef CHECK_CONST
+
+    PASS();
+}
 #endif
 
 #ifdef MKBUNDLE_TEST
 SUITE(sdnv_suite) {
+    RUN_TEST(test_sdnv_small);
     RUN_TEST(test_max_bytes);
     RUN_TEST(test_skip_bytes);
     RUN_TEST(test_compact_msb);
     RUN_TEST(test_sdnv_encode);
+    RUN_TEST(test_sdnv_encode_arena);
     RUN_TEST(test_sdnv_len);
+    RUN_TEST(test_sdnv_len_native);
+    RUN_TEST(test_sdnv_encode_native);
+    RUN_TEST(test_sdnv_decode_native);
+    RUN_TEST(test_sdnv_decode);
+    RUN_TEST(test_sdnv_encode_fixed);
+    RUN_TEST(test_sdnv_const);
+}
+#endif
+
+#ifdef MKBUNDLE_BENCH
+// Fill the array with the field values of typical primary and extension
+// blocks: small dictionary offsets and types, flags under 2^19, and the odd
+// timestamp.
+static void fill_fields(uint32_t *vals, size_t count) {
+    uint64_t state = 42;
+
+    for (size_t i = 0; i < count; i += 1) {
+        state = state * UINT64_C(6364136223846793005) +
+                UINT64_C(1442695040888963407);
+        uint32_t r = (uint32_t)(state >> 33);
+
+        switch (i % 16) {
+        // Flags with some status reports.
+        case 0: vals[i] = 0x90 | (r & 0x1f) << 14; break;
+        // Block length.
+        case 1: vals[i] = 20 + r % 200; break;
+        // Creation timestamp, sequence number, and lifetime.
+        case 10: vals[i] = 500000000 + r % 100000; break;
+        case 11: vals[i] = r % 4096; break;
+        case 12: vals[i] = r & 1 ? 3600 : 86400; break;
+        // Extension block type and payload length.
+        case 14: vals[i] = r % 32; break;
+        case 15: vals[i] = r % 20000; break;
+        // Dictionary offsets and length.
+        default: vals[i] = r % 300; break;
+        }
+    }
+}
+
+BENCH_SUITE(sdnv_bench) {
+    enum { COUNT = 1 << 12, ROUNDS = 256 };
+
+    static uint32_t vals[COUNT];
+    static uint8_t be[COUNT][sizeof(uint32_t)];
+    static uint8_t out[COUNT * SDNV_MAX_U32];
+
+    fill_fields(vals, COUNT);
+
+    for (size_t i = 0; i < COUNT; i += 1)
+        for (size_t b = 0; b < sizeof(uint32_t); b += 1)
+            be[i][b] = (uint8_t)(vals[i] >> (CHAR_BIT * (3 - b)));
+
+    double start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t sum = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1) {
+            sdnv_t *sdnv = encode_general(be[i], sizeof(be[i]), NULL);
+            sum += len_general(be[i], sizeof(be[i])) + sdnv->bytes[0];
+            sdnv_destroy(sdnv);
+        }
+
+        bench_keep(sum);
+    }
+
+    bench_report("sdnv_len + sdnv_encode general", (double) COUNT * ROUNDS,
+                 "val", bench_now() - start);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t sum = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1) {
+            sdnv_t *sdnv = sdnv_encode(be[i], sizeof(be[i]));
+            sum += sdnv_len(be[i], sizeof(be[i])) + sdnv->bytes[0];
+            sdnv_destroy(sdnv);
+        }
+
+        bench_keep(sum);
+    }
+
+    bench_report("sdnv_len + sdnv_encode table", (double) COUNT * ROUNDS,
+                 "val", bench_now() - start);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1) {
+            size_t len = sdnv_len_u32(vals[i]);
+            sdnv_encode_len(vals[i], len, &out[pos]);
+            pos += len;
+        }
+
+        bench_keep(pos);
+    }
+
+    bench_report("sdnv_encode_u32 clz only", (double) COUNT * ROUNDS, "val",
+                 bench_now() - start);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < ROUNDS; r += 1) {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < COUNT; i += 1)
+            pos += sdnv_encode_u32(vals[i], &out[pos]);
+
+        bench_keep(pos);
+    }
+
+    bench_report("sdnv_encode_u32 table", (double) COUNT * ROUNDS, "val",
+                 bench_now() - start);
 }
 #endif
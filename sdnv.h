@@ -5,6 +5,15 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Maximum number of bytes needed to encode a native integer as an SDNV.
+enum {
+    SDNV_MAX_U32 = 5,
+    SDNV_MAX_U64 = 10,
+};
 
 // An encoded SDNV.
 typedef struct {
@@ -21,10 +30,164 @@ size_t sdnv_len(const uint8_t *bytes, size_t byte_count);
 // Encode the given bytes into an SDNV.
 sdnv_t *sdnv_encode(const uint8_t *bytes, size_t byte_count);
 
+// Encode the given bytes into an SDNV allocated from the arena, or from the
+// heap if it's NULL. An SDNV in an arena is released with the arena rather
+// than by sdnv_destroy.
+sdnv_t *sdnv_encode_arena(const uint8_t *bytes, size_t byte_count,
+                          arena_t *arena);
+
 // Encode the given variable into an SDNV.
 #define SDNV_ENCODE(x) sdnv_encode((const uint8_t *) &(x), sizeof(x))
 
 // Free the memory held by the SDNV.
 void sdnv_destroy(sdnv_t *b);
 
+// Values below this are encoded by table lookup. They take at most 2 bytes.
+#define SDNV_SMALL_COUNT (1u << 14)
+
+// SDNVs of the values below SDNV_SMALL_COUNT, padded to 2 bytes.
+extern const uint8_t sdnv_small[SDNV_SMALL_COUNT][2];
+
+// Get the SDNV length of a value below SDNV_SMALL_COUNT.
+static inline size_t sdnv_small_len(uint32_t val) {
+    return 1 + (val > 0x7f);
+}
+
+// Get the number of bytes needed to encode the given native integer.
+static inline size_t sdnv_len_u32(uint32_t val) {
+    // Number of significant bits, where zero still takes one bit. Each output
+    // byte holds 7 of them.
+    size_t bits = (size_t)(32 - __builtin_clz(val | 1));
+    return (bits + 6) / 7;
+}
+
+static inline size_t sdnv_len_u64(uint64_t val) {
+    size_t bits = (size_t)(64 - __builtin_clzll(val | 1));
+    return (bits + 6) / 7;
+}
+
+// Encode the value into exactly len bytes of the given buffer, where len must
+// be at least the value's SDNV length.
+static inline void sdnv_encode_len(uint64_t val, size_t len, uint8_t *out) {
+    // The least-significant byte is the only one without a continue bit.
+    out[len - 1] = (uint8_t)(val & 0x7f);
+
+    for (size_t i = len - 1; i > 0; i -= 1) {
+        val >>= 7;
+        out[i - 1] = (uint8_t)(0x80 | (val & 0x7f));
+    }
+}
+
+// Encode the native integer into the given buffer, which must hold at least
+// SDNV_MAX_U32 or SDNV_MAX_U64 bytes. Return the number of bytes written.
+// Small values come straight from the sdnv_small table.
+static inline size_t sdnv_encode_u32(uint32_t val, uint8_t *out) {
+    if (val < SDNV_SMALL_COUNT) {
+        memcpy(out, sdnv_small[val], sizeof(sdnv_small[val]));
+        return sdnv_small_len(val);
+    }
+
+    size_t len = sdnv_len_u32(val);
+    sdnv_encode_len(val, len, out);
+
+    return len;
+}
+
+static inline size_t sdnv_encode_u64(uint64_t val, uint8_t *out) {
+    if (val < SDNV_SMALL_COUNT) {
+        memcpy(out, sdnv_small[val], sizeof(sdnv_small[val]));
+        return sdnv_small_len((uint32_t) val);
+    }
+
+    size_t len = sdnv_len_u64(val);
+    sdnv_encode_len(val, len, out);
+
+    return len;
+}
+
+// Get the SDNV length of a constant integer as a constant expression, so it
+// can size arrays or be summed into a block length at compile time.
+#define SDNV_CONST_LEN(x) ( \
+    (uint64_t)(x) < (UINT64_C(1) << 7) ? 1 : \
+    (uint64_t)(x) < (UINT64_C(1) << 14) ? 2 : \
+    (uint64_t)(x) < (UINT64_C(1) << 21) ? 3 : \
+    (uint64_t)(x) < (UINT64_C(1) << 28) ? 4 : \
+    (uint64_t)(x) < (UINT64_C(1) << 35) ? 5 : \
+    (uint64_t)(x) < (UINT64_C(1) << 42) ? 6 : \
+    (uint64_t)(x) < (UINT64_C(1) << 49) ? 7 : \
+    (uint64_t)(x) < (UINT64_C(1) << 56) ? 8 : \
+    (uint64_t)(x) < (UINT64_C(1) << 63) ? 9 : 10 \
+)
+
+// Get byte i of the SDNV of a constant integer as a constant expression, or
+// zero past the end of the SDNV.
+#define SDNV_CONST_BYTE(x, i) (uint8_t)( \
+    (i) < SDNV_CONST_LEN(x) ? \
+        ((uint64_t)(x) >> \
+            (7 * ((unsigned)(SDNV_CONST_LEN(x) - 1 - (i)) % SDNV_MAX_U64)) & \
+            0x7f) | \
+        ((i) + 1 < SDNV_CONST_LEN(x) ? 0x80 : 0) \
+    : 0 \
+)
+
+// An SDNV encoded at compile time.
+typedef struct {
+    size_t len;
+    uint8_t bytes[SDNV_MAX_U64];
+} sdnv_const_t;
+
+// Initialize an sdnv_const_t with the SDNV of a constant integer, for example
+//
+//   static const sdnv_const_t LIFETIME = SDNV_CONST(3600);
+//
+#define SDNV_CONST(x) { \
+    .len = SDNV_CONST_LEN(x), \
+    .bytes = { \
+        SDNV_CONST_BYTE(x, 0), SDNV_CONST_BYTE(x, 1), SDNV_CONST_BYTE(x, 2), \
+        SDNV_CONST_BYTE(x, 3), SDNV_CONST_BYTE(x, 4), SDNV_CONST_BYTE(x, 5), \
+        SDNV_CONST_BYTE(x, 6), SDNV_CONST_BYTE(x, 7), SDNV_CONST_BYTE(x, 8), \
+        SDNV_CONST_BYTE(x, 9), \
+    }, \
+}
+
+// Encode the native integer into exactly width bytes, padding with leading
+// 0x80 bytes, so the SDNV can later be patched in place with any value that
+// fits. Return false if the value needs more than width bytes.
+static inline bool sdnv_encode_u64_fixed(uint64_t val, size_t width,
+                                         uint8_t *out)
+{
+    if (!width || sdnv_len_u64(val) > width)
+        return false;
+
+    sdnv_encode_len(val, width, out);
+
+    return true;
+}
+
+// Result of decoding an SDNV.
+typedef enum {
+    SDNV_OK,
+    // The input ended before the last byte of the SDNV.
+    SDNV_TRUNCATED,
+    // The SDNV starts with a zero group, so it isn't minimal. The value is
+    // still decoded.
+    SDNV_OVERLONG,
+    // The value doesn't fit in the target.
+    SDNV_OVERFLOW,
+} sdnv_status_t;
+
+// Decode the SDNV at the start of the given bytes into a native integer. On
+// every status except SDNV_TRUNCATED, set used to the number of bytes the SDNV
+// takes up, so the caller can advance past it. The value is only set on
+// SDNV_OK and SDNV_OVERLONG.
+sdnv_status_t sdnv_decode_u32(const uint8_t *bytes, size_t byte_count,
+                              uint32_t *val, size_t *used);
+sdnv_status_t sdnv_decode_u64(const uint8_t *bytes, size_t byte_count,
+                              uint64_t *val, size_t *used);
+
+// Decode the SDNV at the start of the given bytes into the big-endian out
+// bytes, the reverse of sdnv_encode. Statuses are the same as above.
+sdnv_status_t sdnv_decode(const uint8_t *bytes, size_t byte_count,
+                          uint8_t *out, size_t out_count, size_t *used);
+
 #endif
@@ -0,0 +1,551 @@
+// See copyright notice in Copying.
+
+// For accept4 and pipe2.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "bundle.h"
+#include "parser.h"
+#include "server.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include <pthread.h>
+
+#include "greatest.h"
+#include "test-params.h"
+#endif
+
+enum {
+    // Maximum number of events handled per wakeup.
+    SERVER_EVENTS = 64,
+    // Amount of input to read at a time.
+    SERVER_CHUNK = 1 << 16,
+};
+
+static uint32_t get_len(const char *buf) {
+    const uint8_t *b = (const uint8_t *) buf;
+
+    return (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 |
+           (uint32_t) b[2] << 8 | (uint32_t) b[3];
+}
+
+static void put_len(uint8_t *b, uint32_t len) {
+    b[0] = (uint8_t)(len >> 24);
+    b[1] = (uint8_t)(len >> 16);
+    b[2] = (uint8_t)(len >> 8);
+    b[3] = (uint8_t) len;
+}
+
+// Compile the request and append the output to the strbuf. Return NULL on
+// success and an error message otherwise, in which case the strbuf may hold
+// partial output.
+static const char *compile_request(batch_t *b, const char *req, size_t len,
+                                   strbuf_t **out, char *msg, size_t msg_len)
+{
+    size_t pos = parser_skip_space(req, len, 0);
+
+    if (pos < len && req[pos] == '[') {
+        // Clients mustn't read files with the server's privileges.
+        return bundle_build(&b->parser, b->arena, out, req, len,
+                            BUNDLE_NO_FILES) ? NULL : "unable to build bundle";
+    }
+
+    // Number records from the start of each request.
+    b->record = 0;
+    b->failed = 0;
+
+    batch_compile(b, req, len, true, out);
+
+    if (!b->failed)
+        return NULL;
+
+    snprintf(msg, msg_len, "%zu of %zu records failed", b->failed, b->record);
+
+    return msg;
+}
+
+void server_respond(batch_t *b, const char *req, size_t len, strbuf_t **out) {
+    size_t start = (*out)->pos;
+    size_t body = start + SERVER_HEADER_SIZE;
+
+    strbuf_expect(out, SERVER_HEADER_SIZE);
+    (*out)->pos = body;
+
+    char msg[64];
+    const char *err = compile_request(b, req, len, out, msg, sizeof(msg));
+
+    if (!err && (*out)->pos - body > UINT32_MAX)
+        err = "response too large";
+
+    if (err) {
+        (*out)->pos = body;
+        strbuf_append(out, err, strlen(err));
+    }
+
+    uint8_t *header = (uint8_t *) &(*out)->buf[start];
+
+    header[0] = err ? SERVER_ERROR : SERVER_OK;
+    put_len(&header[1], (uint32_t)((*out)->pos - body));
+}
+
+bool server_init(server_t *s, const char *path) {
+    s->listen_fd = -1;
+    s->epoll_fd = -1;
+    s->stop_fds[0] = -1;
+    s->stop_fds[1] = -1;
+    s->conns = NULL;
+    s->conn_count = 0;
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    struct epoll_event listen_event = {
+        .events = EPOLLIN,
+        .data.ptr = &s->listen_fd,
+    };
+
+    struct epoll_event stop_event = {
+        .events = EPOLLIN,
+        .data.ptr = &s->stop_fds[0],
+    };
+
+    bool ret =
+        (s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                        SOCK_CLOEXEC, 0)) >= 0 &&
+        !bind(s->listen_fd, (const struct sockaddr *) &addr, sizeof(addr)) &&
+        !listen(s->listen_fd, SOMAXCONN) &&
+        (s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0 &&
+        !pipe2(s->stop_fds, O_NONBLOCK | O_CLOEXEC) &&
+        !epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &listen_event) &&
+        !epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->stop_fds[0], &stop_event);
+
+    if (!ret) {
+        int err = errno;
+        server_destroy(s);
+        errno = err;
+    }
+
+    return ret;
+}
+
+static void conn_close(server_t *s, server_conn_t *c) {
+    close(c->fd);
+
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        s->conns = c->next;
+
+    if (c->next)
+        c->next->prev = c->prev;
+
+    s->conn_count -= 1;
+
+    strbuf_destroy(c->out);
+    strbuf_destroy(c->in);
+    arena_destroy(&c->arena);
+    free(c);
+}
+
+void server_destroy(server_t *s) {
+    while (s->conns)
+        conn_close(s, s->conns);
+
+    int fds[] = {s->listen_fd, s->epoll_fd, s->stop_fds[0], s->stop_fds[1]};
+
+    for (size_t i = 0; i < ASIZE(fds); i += 1)
+        if (fds[i] >= 0)
+            close(fds[i]);
+}
+
+static void conn_open(server_t *s, int fd) {
+    server_conn_t *c = malloc(sizeof(server_conn_t));
+
+    if (!c) {
+        close(fd);
+        return;
+    }
+
+    c->fd = fd;
+    c->events = EPOLLIN;
+    c->eof = false;
+    c->sent = 0;
+
+    batch_init(&c->batch, NULL, NULL);
+    arena_init(&c->arena, ARENA_CHUNK, 0);
+    c->batch.arena = &c->arena;
+    strbuf_init(&c->in, SERVER_CHUNK);
+    strbuf_init(&c->out, SERVER_CHUNK);
+
+    c->prev = NULL;
+    c->next = s->conns;
+
+    if (c->next)
+        c->next->prev = c;
+
+    s->conns = c;
+    s->conn_count += 1;
+
+    struct epoll_event event = {
+        .events = c->events,
+        .data.ptr = c,
+    };
+
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+        conn_close(s, c);
+}
+
+// Accept every pending connection.
+static void accept_conns(server_t *s) {
+    int fd;
+
+    while ((fd = accept4(s->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        conn_open(s, fd);
+    }
+}
+
+// Read what's available from the client. Return false on error.
+static bool conn_read(server_conn_t *c) {
+    strbuf_expect(&c->in, SERVER_CHUNK);
+
+    ssize_t len;
+
+    do {
+        len = read(c->fd, &c->in->buf[c->in->pos], SERVER_CHUNK);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    // The client may stop sending and still wait for its responses.
+    c->eof = len == 0;
+    c->in->pos += (size_t) len;
+
+    return true;
+}
+
+// Respond to every complete request received. Return false if a request is
+// too large.
+static bool conn_handle(server_conn_t *c) {
+    size_t pos = 0;
+
+    while (c->in->pos - pos >= SERVER_LEN_SIZE) {
+        uint32_t len = get_len(&c->in->buf[pos]);
+
+        if (len > SERVER_REQUEST_MAX)
+            return false;
+
+        if (c->in->pos - pos - SERVER_LEN_SIZE < len)
+            break;
+
+        server_respond(&c->batch, &c->in->buf[pos + SERVER_LEN_SIZE], len,
+                       &c->out);
+
+        pos += SERVER_LEN_SIZE + len;
+    }
+
+    strbuf_discard(c->in, pos);
+
+    return true;
+}
+
+// Send as much of the pending responses as the socket takes. Return false on
+// error.
+static bool conn_flush(server_conn_t *c) {
+    while (c->sent < c->out->pos) {
+        ssize_t len = send(c->fd, &c->out->buf[c->sent],
+                           c->out->pos - c->sent, MSG_NOSIGNAL);
+
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        c->sent += (size_t) len;
+    }
+
+    c->out->pos = 0;
+    c->sent = 0;
+
+    return true;
+}
+
+// Handle the events on the connection. Return false if it should be closed.
+static bool conn_update(server_t *s, server_conn_t *c, uint32_t events) {
+    if (events & EPOLLERR)
+        return false;
+
+    if (events & (EPOLLIN | EPOLLHUP) && !c->eof && !conn_read(c))
+        return false;
+
+    if (!conn_flush(c))
+        return false;
+
+    // New requests are only handled once earlier responses are sent, so a
+    // client that doesn't read can't make the output grow without bound.
+    if (!c->out->pos && (!conn_handle(c) || !conn_flush(c)))
+        return false;
+
+    bool pending = c->out->pos > 0;
+
+    if (c->eof && !pending)
+        return false;
+
+    // Wait for room to send or for more requests.
+    uint32_t want = pending ? EPOLLOUT : EPOLLIN;
+
+    if (want == c->events)
+        return true;
+
+    c->events = want;
+
+    struct epoll_event event = {
+        .events = want,
+        .data.ptr = c,
+    };
+
+    return !epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+}
+
+bool server_run(server_t *s) {
+    struct epoll_event events[SERVER_EVENTS];
+
+    for (;;) {
+        int count = epoll_wait(s->epoll_fd, events, SERVER_EVENTS, -1);
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        for (int i = 0; i < count; i += 1) {
+            int *fd = events[i].data.ptr;
+
+            if (fd == &s->stop_fds[0]) {
+                // Drain the wakeups so the server can be run again.
+                char buf[16];
+                while (read(s->stop_fds[0], buf, sizeof(buf)) > 0) {}
+
+                return true;
+            }
+
+            if (fd == &s->listen_fd) {
+                accept_conns(s);
+                continue;
+            }
+
+            server_conn_t *c = (server_conn_t *) fd;
+
+            if (!conn_update(s, c, events[i].events))
+                conn_close(s, c);
+        }
+    }
+}
+
+void server_stop(server_t *s) {
+    int err = errno;
+    ssize_t ret = write(s->stop_fds[1], "", 1);
+    (void) ret;
+    errno = err;
+}
+
+#ifdef MKBUNDLE_TEST
+// A param file record of an extension block.
+#define EXTENSION TEST_EXTENSION(1, 8, 4) "\n"
+
+// A bundle spec with a primary block and an extension block.
+#define SPEC "[" TEST_PRIMARY ", {" EXTENSION ", \"payload\": \"test\"}]"
+
+static const char *REQUESTS[] = {
+    EXTENSION EXTENSION,
+    SPEC,
+    "\"extension\": {\"type\": 1}",
+    "",
+};
+
+TEST test_server_respond(void) {
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    server_respond(&batch, REQUESTS[0], strlen(REQUESTS[0]), &sb);
+
+    static const uint8_t BLOCK[] = {0x01, 0x08, 0x04};
+
+    ASSERT_EQ(sb->pos, SERVER_HEADER_SIZE + 2 * sizeof(BLOCK));
+    ASSERT_EQ(memcmp(sb->buf, "\x00\x00\x00\x00\x06", 5), 0);
+    ASSERT_EQ(memcmp(&sb->buf[5], BLOCK, sizeof(BLOCK)), 0);
+    ASSERT_EQ(memcmp(&sb->buf[8], BLOCK, sizeof(BLOCK)), 0);
+
+    sb->pos = 0;
+    server_respond(&batch, REQUESTS[1], strlen(REQUESTS[1]), &sb);
+    ASSERT_EQ(sb->buf[0], SERVER_OK);
+    ASSERT_EQ(get_len(&sb->buf[1]), 15 + 3 + 4);
+    ASSERT_EQ(memcmp(&sb->buf[sb->pos - 7], BLOCK, sizeof(BLOCK)), 0);
+
+    sb->pos = 0;
+    server_respond(&batch, REQUESTS[2], strlen(REQUESTS[2]), &sb);
+    ASSERT_EQ(sb->buf[0], SERVER_ERROR);
+    ASSERT_EQ(get_len(&sb->buf[1]), sb->pos - SERVER_HEADER_SIZE);
+    ASSERT_EQ(memcmp(&sb->buf[5], "1 of 1 records failed", sb->pos - 5), 0);
+
+    sb->pos = 0;
+    server_respond(&batch, "[]", 2, &sb);
+    ASSERT_EQ(sb->buf[0], SERVER_ERROR);
+
+    // Clients can't have the server read files for them.
+    static const char FILE_SPEC[] =
+        "[" TEST_PRIMARY ", {" EXTENSION ", \"payload-file\": \"test\"}]";
+
+    FILE *f = fopen("test", "w");
+    fputs("secret", f);
+    fclose(f);
+
+    sb->pos = 0;
+    server_respond(&batch, FILE_SPEC, sizeof(FILE_SPEC) - 1, &sb);
+    ASSERT_EQ(sb->buf[0], SERVER_ERROR);
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+static void *serve(void *arg) {
+    return server_run(arg) ? arg : NULL;
+}
+
+TEST test_server_run(void) {
+    static const char PATH[] = "test.sock";
+
+    unlink(PATH);
+
+    server_t server;
+    ASSERT(server_init(&server, PATH));
+
+    pthread_t thread;
+    ASSERT_EQ(pthread_create(&thread, NULL, serve, &server), 0);
+
+    // Frame every request into one stream and build the expected responses.
+    strbuf_t *reqs;
+    strbuf_init(&reqs, 1);
+
+    strbuf_t *expect;
+    strbuf_init(&expect, 1);
+
+    batch_t batch;
+    batch_init(&batch, NULL, NULL);
+
+    for (size_t round = 0; round < 100; round += 1) {
+        for (size_t i = 0; i < ASIZE(REQUESTS); i += 1) {
+            size_t len = strlen(REQUESTS[i]);
+            uint8_t header[SERVER_LEN_SIZE];
+
+            put_len(header, (uint32_t) len);
+            strbuf_append(&reqs, (const char *) header, sizeof(header));
+            strbuf_append(&reqs, REQUESTS[i], len);
+
+            server_respond(&batch, REQUESTS[i], len, &expect);
+        }
+    }
+
+    // Connect several clients at once, each splitting its requests at a
+    // different point.
+    enum { CLIENTS = 4 };
+    int fds[CLIENTS];
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+
+    strcpy(addr.sun_path, PATH);
+
+    for (size_t i = 0; i < CLIENTS; i += 1) {
+        fds[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+        ASSERT(fds[i] >= 0);
+        ASSERT_EQ(connect(fds[i], (const struct sockaddr *) &addr,
+                          sizeof(addr)), 0);
+    }
+
+    for (size_t i = 0; i < CLIENTS; i += 1) {
+        size_t split = reqs->pos / (i + 2) + i;
+
+        ASSERT(write_all(fds[i], reqs->buf, split));
+        ASSERT(write_all(fds[i], &reqs->buf[split], reqs->pos - split));
+        ASSERT_EQ(shutdown(fds[i], SHUT_WR), 0);
+    }
+
+    strbuf_t *got;
+    strbuf_init(&got, expect->pos);
+
+    for (size_t i = 0; i < CLIENTS; i += 1) {
+        got->pos = 0;
+
+        for (;;) {
+            strbuf_expect(&got, 1 << 12);
+
+            ssize_t len = read(fds[i], &got->buf[got->pos], 1 << 12);
+            ASSERT(len >= 0);
+
+            if (!len)
+                break;
+
+            got->pos += (size_t) len;
+        }
+
+        ASSERT_EQ(got->pos, expect->pos);
+        ASSERT_EQ(memcmp(got->buf, expect->buf, got->pos), 0);
+
+        close(fds[i]);
+    }
+
+    server_stop(&server);
+
+    void *ret;
+    pthread_join(thread, &ret);
+    ASSERT_EQ(ret, &server);
+
+    server_destroy(&server);
+    unlink(PATH);
+
+    strbuf_destroy(got);
+    strbuf_destroy(expect);
+    strbuf_destroy(reqs);
+
+    PASS();
+}
+
+SUITE(server_suite) {
+    RUN_TEST(test_server_respond);
+    RUN_TEST(test_server_run);
+}
+#endif
@@ -0,0 +1,84 @@
+// See copyright notice in Copying.
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "strbuf.h"
+
+enum {
+    // Size of the length prefix on requests and responses.
+    SERVER_LEN_SIZE = 4,
+    // Size of the status and length prefix on responses.
+    SERVER_HEADER_SIZE = 1 + SERVER_LEN_SIZE,
+    // Largest request accepted before the connection is dropped.
+    SERVER_REQUEST_MAX = 1 << 24,
+};
+
+// Status byte that starts each response.
+typedef enum {
+    SERVER_OK = 0,
+    SERVER_ERROR = 1,
+} server_status_t;
+
+// A client connection. Its parser, arena and buffers live as long as the
+// connection and are reused for every request on it.
+typedef struct server_conn {
+    // Must be first, since epoll events point at it.
+    int fd;
+    // Events currently waited for.
+    uint32_t events;
+    // Whether the client has stopped sending.
+    bool eof;
+    batch_t batch;
+    // Holds the blocks of each request, released after each one.
+    arena_t arena;
+    // Received bytes not yet handled.
+    strbuf_t *in;
+    // Responses not yet sent, starting at sent.
+    strbuf_t *out;
+    size_t sent;
+
+    struct server_conn *prev, *next;
+} server_conn_t;
+
+// Serves compile requests over a Unix socket. Each request is a 4-byte
+// big-endian length followed by either a params file, whose records are
+// compiled as with the compile command, or a bundle spec, which is built as
+// with the build command. Each response is a status byte, a 4-byte big-endian
+// length, and then either the binary output or an error message. Responses on
+// a connection come back in the order of its requests.
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    // Written to by server_stop to wake the event loop.
+    int stop_fds[2];
+
+    server_conn_t *conns;
+    size_t conn_count;
+} server_t;
+
+// Start listening on a Unix socket bound to the given path. Return true on
+// success and false otherwise, with errno set.
+bool server_init(server_t *s, const char *path);
+
+// Close the listening socket and every connection.
+void server_destroy(server_t *s);
+
+// Handle connections until server_stop is called. Return false if the event
+// loop failed.
+bool server_run(server_t *s);
+
+// Make server_run return. This is safe to call from a signal handler or
+// another thread.
+void server_stop(server_t *s);
+
+// Handle the request and append the framed response to the strbuf.
+void server_respond(batch_t *b, const char *req, size_t len, strbuf_t **out);
+
+#endif
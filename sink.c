@@ -0,0 +1,855 @@
+// See copyright notice in Copying.
+
+// For vmsplice.
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "strbuf.h"
+#include "util.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#endif
+
+#ifdef MKBUNDLE_BENCH
+#include <pthread.h>
+
+#include "bench.h"
+#endif
+
+enum {
+    // Room first reserved for formatted output, which covers most lines.
+    PRINTF_GUESS = 1 << 7,
+    // Strbufs shorter than this are copied into the sink, which is cheaper
+    // than draining it to write them on their own.
+    TAKE_MIN = 1 << 12,
+};
+
+// Point the sink at the end of its strbuf.
+static void mem_sync(sink_t *s) {
+    strbuf_t *sb = *s->sbp;
+
+    s->buf = (uint8_t *) sb->buf;
+    s->pos = sb->pos;
+    s->cap = sb->cap;
+}
+
+static bool mem_drain(sink_t *s, size_t len) {
+    (*s->sbp)->pos = s->pos;
+    strbuf_expect(s->sbp, len);
+    mem_sync(s);
+
+    return true;
+}
+
+void sink_init_mem(sink_t *s, strbuf_t **sbp) {
+    *s = (sink_t) {
+        .drain = mem_drain,
+        .sbp = sbp,
+    };
+
+    mem_sync(s);
+}
+
+static bool buf_drain(sink_t *s, size_t len) {
+    bool spilled = s->spill && s->buf == s->spill;
+
+    // Spilled bytes are copied over only if they all fit, and once anything
+    // has been dropped the caller's buffer is left alone.
+    if (!spilled) {
+        s->dest_len = s->pos;
+    } else {
+        if (s->pos && s->dest_len <= s->dest_cap &&
+            s->pos <= s->dest_cap - s->dest_len)
+        {
+            memcpy(&s->dest[s->dest_len], s->spill, s->pos);
+        }
+
+        s->dest_len += s->pos;
+    }
+
+    if (s->dest_len <= s->dest_cap && len <= s->dest_cap - s->dest_len) {
+        s->buf = s->dest;
+        s->pos = s->dest_len;
+        s->cap = s->dest_cap;
+
+        return true;
+    }
+
+    if (len > s->spill_cap) {
+        free(s->spill);
+        s->spill = malloc(len);
+        s->spill_cap = s->spill ? len : 0;
+
+        if (!s->spill)
+            return false;
+    }
+
+    s->buf = s->spill;
+    s->pos = 0;
+    s->cap = s->spill_cap;
+
+    return true;
+}
+
+void sink_init_buf(sink_t *s, void *buf, size_t cap) {
+    *s = (sink_t) {
+        .buf = buf,
+        .cap = cap,
+        .drain = buf_drain,
+        .dest = buf,
+        .dest_cap = cap,
+    };
+}
+
+void sink_reset_buf(sink_t *s, void *buf, size_t cap) {
+    uint8_t *spill = s->spill;
+    size_t spill_cap = s->spill_cap;
+
+    sink_init_buf(s, buf, cap);
+    s->spill = spill;
+    s->spill_cap = spill_cap;
+}
+
+size_t sink_len(const sink_t *s) {
+    return s->spill && s->buf == s->spill ? s->dest_len + s->pos : s->pos;
+}
+
+// Make sure the buffer can hold len bytes once it's been written out.
+static void grow(sink_t *s, size_t len) {
+    if (len <= s->cap)
+        return;
+
+    free(s->buf);
+    s->buf = malloc(len);
+    assert(s->buf);
+    s->cap = len;
+}
+
+// Round the length up to a whole number of pages.
+static size_t page_round(size_t len) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    return (len + page - 1) / page * page;
+}
+
+// Map fresh pages for gifting, aligned so the kernel can back them with
+// transparent huge pages. Gifted pages are never reused, so every one has to be
+// faulted in and zeroed, which huge pages make much cheaper. Return NULL if the
+// pages can't be mapped.
+static uint8_t *map_pages(size_t len) {
+    uint8_t *mem = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    size_t head = -(uintptr_t) mem % HUGE_PAGE_SIZE;
+
+    if (head)
+        munmap(mem, head);
+
+    munmap(&mem[head + len], HUGE_PAGE_SIZE - head);
+    madvise(&mem[head], len, MADV_HUGEPAGE);
+
+    return &mem[head];
+}
+
+// Point the buffer at pages of the map past any that were gifted, with room
+// for at least len bytes. Return false if no more pages can be mapped.
+static bool carve(sink_t *s, size_t len) {
+    size_t need = len > SINK_BUF ? len : SINK_BUF;
+    size_t off = s->map ? page_round((size_t) (&s->buf[s->pos] - s->map)) : 0;
+
+    if (!s->map || s->map_len - off < need) {
+        // The pipe holds its own references to gifted pages, so the old map
+        // can go even if they haven't been read yet.
+        if (s->map)
+            munmap(s->map, s->map_len);
+
+        size_t huge = (need + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+        s->map_len = huge * HUGE_PAGE_SIZE > SINK_MAP ?
+            huge * HUGE_PAGE_SIZE : SINK_MAP;
+        s->map = map_pages(s->map_len);
+        off = 0;
+
+        if (!s->map)
+            return false;
+    }
+
+    s->buf = &s->map[off];
+    s->pos = 0;
+    s->cap = need;
+
+    return true;
+}
+
+// Stop gifting and trade any map for a plain buffer with room for len bytes.
+static void stop_gift(sink_t *s, size_t len) {
+    if (s->map)
+        munmap(s->map, s->map_len);
+
+    s->gift = false;
+    s->map = NULL;
+    s->buf = NULL;
+    s->pos = 0;
+    s->cap = 0;
+    grow(s, len > SINK_BUF ? len : SINK_BUF);
+}
+
+// Hand the pending bytes to the pipe. If the kernel won't splice to the file
+// descriptor, write them instead and stop gifting.
+static bool gift(sink_t *s) {
+    struct iovec iov = {
+        .iov_base = s->buf,
+        .iov_len = s->pos,
+    };
+
+    while (iov.iov_len) {
+        ssize_t ret = vmsplice(s->fd, &iov, 1, SPLICE_F_GIFT);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            s->gift = false;
+
+            return write_all(s->fd, iov.iov_base, iov.iov_len);
+        }
+
+        iov.iov_base = (uint8_t *) iov.iov_base + ret;
+        iov.iov_len -= (size_t) ret;
+    }
+
+    return true;
+}
+
+static bool fd_drain(sink_t *s, size_t len) {
+    if (!s->gift) {
+        if (!write_all(s->fd, s->buf, s->pos))
+            return false;
+
+        s->pos = 0;
+        grow(s, len);
+
+        return true;
+    }
+
+    if (!gift(s))
+        return false;
+
+    // Write from now on if the kernel won't take gifts or no pages are left
+    // to map.
+    if (!s->gift || !carve(s, len))
+        stop_gift(s, len);
+
+    return true;
+}
+
+static bool stdio_drain(sink_t *s, size_t len) {
+    // Anything already buffered in the stream must come first.
+    return fflush(s->stream) == 0 && fd_drain(s, len);
+}
+
+// Check if the file descriptor is a pipe.
+static bool is_pipe(int fd) {
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// Initialize a sink that owns its buffer and writes to the file descriptor,
+// gifting buffers to it if requested.
+static void init_fd(sink_t *s, int fd, sink_drain_fn drain, bool gift) {
+    *s = (sink_t) {
+        .drain = drain,
+        .fd = fd,
+        .gift = gift,
+    };
+
+    if (!gift || !carve(s, SINK_BUF))
+        stop_gift(s, SINK_BUF);
+}
+
+void sink_init_fd(sink_t *s, int fd) {
+    init_fd(s, fd, fd_drain, is_pipe(fd));
+}
+
+void sink_init_stdio(sink_t *s, FILE *stream) {
+    int fd = fileno(stream);
+
+    init_fd(s, fd, stdio_drain, is_pipe(fd));
+    s->stream = stream;
+}
+
+static bool uring_drain(sink_t *s, size_t len) {
+    if (fflush(s->stream) != 0 || !uring_write(s->uring, s->uring_buf, s->pos))
+        return false;
+
+    // Fill the other buffer while this one is written.
+    if (s->pos)
+        s->uring_buf = (s->uring_buf + 1) % URING_BUFS;
+
+    s->pos = 0;
+
+    // Only sink_flush drains nothing, and it must leave nothing in flight.
+    if (!len && !uring_wait(s->uring))
+        return false;
+
+    if (len > s->uring->buf_cap && !uring_grow(s->uring, len))
+        return false;
+
+    // Even a flush moves on to the other buffer.
+    s->buf = s->uring->bufs[s->uring_buf];
+    s->cap = s->uring->buf_cap;
+
+    return true;
+}
+
+void sink_init_uring(sink_t *s, FILE *stream) {
+    uring_t *u = malloc(sizeof(uring_t));
+    assert(u);
+
+    if (!uring_init(u, fileno(stream), SINK_BUF)) {
+        free(u);
+        sink_init_stdio(s, stream);
+
+        return;
+    }
+
+    *s = (sink_t) {
+        .buf = u->bufs[0],
+        .cap = u->buf_cap,
+        .drain = uring_drain,
+        .stream = stream,
+        .fd = fileno(stream),
+        .uring = u,
+    };
+}
+
+void sink_destroy(sink_t *s) {
+    // A uring sink's buffers belong to its ring.
+    if (s->uring) {
+        uring_destroy(s->uring);
+        free(s->uring);
+    } else if (s->map) {
+        munmap(s->map, s->map_len);
+    } else if (s->drain == buf_drain) {
+        free(s->spill);
+    } else if (s->drain != mem_drain) {
+        free(s->buf);
+    }
+
+    s->buf = NULL;
+    s->map = NULL;
+    s->spill = NULL;
+    s->uring = NULL;
+}
+
+bool sink_write(sink_t *s, const void *buf, size_t len) {
+    uint8_t *cur = sink_reserve(s, len);
+
+    if (!cur)
+        return false;
+
+    memcpy(cur, buf, len);
+    sink_commit(s, len);
+
+    return true;
+}
+
+bool sink_take(sink_t *s, strbuf_t **sbp) {
+    strbuf_t *sb = *sbp;
+    strbuf_t *own = s->drain == mem_drain ? *s->sbp : NULL;
+
+    // Strbufs can only trade places if they're both on the heap.
+    if (own && !s->pos && !own->arena && !own->fixed && !sb->arena &&
+        !sb->fixed)
+    {
+        *s->sbp = sb;
+        mem_sync(s);
+
+        own->pos = 0;
+        *sbp = own;
+
+        return true;
+    }
+
+    bool ret;
+
+    // Only sinks that write to a file descriptor can write from the strbuf.
+    if (own || s->drain == buf_drain || sb->pos < TAKE_MIN) {
+        ret = sink_write(s, sb->buf, sb->pos);
+    } else {
+        // Everything pending goes first.
+        ret = sink_flush(s) && write_all(s->fd, sb->buf, sb->pos);
+        s->error = !ret;
+    }
+
+    sb->pos = 0;
+
+    return ret;
+}
+
+bool sink_puts(sink_t *s, const char *str) {
+    return sink_write(s, str, strlen(str));
+}
+
+bool sink_putc(sink_t *s, char c) {
+    return sink_write(s, &c, 1);
+}
+
+bool sink_printf(sink_t *s, const char *fmt, ...) {
+    size_t room = PRINTF_GUESS;
+
+    for (;;) {
+        // Room for the terminator written by vsnprintf is reserved but not
+        // committed.
+        uint8_t *cur = sink_reserve(s, room);
+
+        if (!cur)
+            return false;
+
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf((char *) cur, room, fmt, args);
+        va_end(args);
+
+        if (len < 0)
+            return false;
+
+        if ((size_t) len < room) {
+            sink_commit(s, (size_t) len);
+            return true;
+        }
+
+        room = (size_t) len + 1;
+    }
+}
+
+bool sink_flush(sink_t *s) {
+    if (!s->error && !s->drain(s, 0))
+        s->error = true;
+
+    return !s->error;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_sink_mem(void) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 4);
+    strbuf_append(&sb, "x", 1);
+
+    sink_t sink;
+    sink_init_mem(&sink, &sb);
+
+    uint8_t *cur = sink_reserve(&sink, 2);
+    ASSERT_EQ((char *) cur, &sb->buf[1]);
+    memcpy(cur, "ab", 2);
+    sink_commit(&sink, 2);
+
+    // Growing the strbuf keeps what was committed.
+    ASSERT(sink_printf(&sink, "%s-%d", "long enough to grow", 42));
+    ASSERT(sink_putc(&sink, '!'));
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    static const char EXPECT[] = "xablong enough to grow-42!";
+    ASSERT_EQ(sb->pos, sizeof(EXPECT) - 1);
+    ASSERT_EQ(memcmp(sb->buf, EXPECT, sb->pos), 0);
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_sink_buf(void) {
+    uint8_t buf[8];
+    sink_t sink;
+    sink_init_buf(&sink, buf, sizeof(buf));
+
+    // Committed bytes land in place, and a reservation too big for what's left
+    // still fits if less is committed.
+    ASSERT_EQ(sink_reserve(&sink, 4), buf);
+    memcpy(buf, "abc", 3);
+    sink_commit(&sink, 3);
+
+    uint8_t *cur = sink_reserve(&sink, 16);
+    ASSERT(cur);
+    memcpy(cur, "defgh", 5);
+    sink_commit(&sink, 5);
+
+    ASSERT(sink_flush(&sink));
+    ASSERT_EQ(sink_len(&sink), 8);
+    ASSERT_EQ(memcmp(buf, "abcdefgh", 8), 0);
+
+    // Output that doesn't fit is counted, and the buffer is left as it was.
+    ASSERT(sink_puts(&sink, "ij"));
+    ASSERT(sink_flush(&sink));
+    ASSERT_EQ(sink_len(&sink), 10);
+    ASSERT_EQ(memcmp(buf, "abcdefgh", 8), 0);
+
+    // Without a buffer, only the length is kept, and the spill buffer is
+    // reused.
+    size_t before = util_alloc_count();
+    sink_reset_buf(&sink, NULL, 0);
+    ASSERT(sink_puts(&sink, "abc"));
+    ASSERT(sink_flush(&sink));
+    ASSERT_EQ(sink_len(&sink), 3);
+    ASSERT_EQ(util_alloc_count(), before);
+    sink_destroy(&sink);
+
+    PASS();
+}
+
+TEST test_sink_stdio(void) {
+    FILE *f = fopen("test", "w+");
+
+    // Anything buffered in the stream comes first.
+    fputc('x', f);
+
+    sink_t sink;
+    sink_init_stdio(&sink, f);
+
+    ASSERT(sink_puts(&sink, "abc"));
+
+    // Writes larger than the buffer go out whole.
+    static char big[SINK_BUF + 1];
+    memset(big, 'y', sizeof(big));
+    ASSERT(sink_write(&sink, big, sizeof(big)));
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    rewind(f);
+
+    char buf[8];
+    ASSERT_EQ(fread(buf, 1, 5, f), 5);
+    ASSERT_EQ(memcmp(buf, "xabcy", 5), 0);
+
+    ASSERT_EQ(fseek(f, 0, SEEK_END), 0);
+    ASSERT_EQ(ftell(f), 4 + SINK_BUF + 1);
+
+    fclose(f);
+
+    PASS();
+}
+
+TEST test_sink_error(void) {
+    sink_t sink;
+    sink_init_fd(&sink, -1);
+
+    // Nothing is written until the buffer fills or is flushed.
+    ASSERT(sink_puts(&sink, "abc"));
+    ASSERT(!sink_flush(&sink));
+
+    // The error sticks.
+    ASSERT(!sink_reserve(&sink, 1));
+    ASSERT(!sink_puts(&sink, "abc"));
+
+    sink_destroy(&sink);
+
+    PASS();
+}
+
+TEST test_sink_pipe(void) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    sink_t sink;
+    sink_init_fd(&sink, fds[1]);
+    ASSERT(sink.gift);
+
+    ASSERT(sink_puts(&sink, "abc"));
+    uint8_t *gifted = sink.buf;
+    ASSERT(sink_flush(&sink));
+
+    // Gifted pages aren't written again.
+    ASSERT(sink.buf >= gifted + sysconf(_SC_PAGESIZE));
+
+    // Enough to carve more than one buffer, but less than the pipe holds.
+    static char big[SINK_BUF / 2];
+    memset(big, 'y', sizeof(big));
+    ASSERT(sink_write(&sink, big, sizeof(big)));
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+    close(fds[1]);
+
+    static char got[3 + sizeof(big) + 1];
+    size_t pos = 0;
+    ssize_t ret;
+
+    while ((ret = read(fds[0], &got[pos], sizeof(got) - pos)) > 0)
+        pos += (size_t) ret;
+
+    close(fds[0]);
+
+    ASSERT_EQ(pos, 3 + sizeof(big));
+    ASSERT_EQ(memcmp(got, "abc", 3), 0);
+    ASSERT_EQ(memcmp(&got[3], big, sizeof(big)), 0);
+
+    PASS();
+}
+
+TEST test_sink_uring(void) {
+    FILE *f = tmpfile();
+    fputc('x', f);
+
+    sink_t sink;
+    sink_init_uring(&sink, f);
+
+    // Enough to cycle through the buffers, and more than fits in one.
+    for (size_t i = 0; i < 3 * SINK_BUF / 4; i += 1)
+        ASSERT(sink_puts(&sink, "abcd"));
+
+    static char big[2 * SINK_BUF];
+    memset(big, 'y', sizeof(big));
+    ASSERT(sink_write(&sink, big, sizeof(big)));
+    ASSERT(sink_putc(&sink, 'z'));
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    ASSERT_EQ(fseek(f, 0, SEEK_END), 0);
+    ASSERT_EQ(ftell(f), 1 + 3 * SINK_BUF + sizeof(big) + 1);
+
+    char got[5];
+    rewind(f);
+    ASSERT_EQ(fread(got, 1, 5, f), 5);
+    ASSERT_EQ(memcmp(got, "xabcd", 5), 0);
+
+    ASSERT_EQ(fseek(f, 1 + 3 * SINK_BUF, SEEK_SET), 0);
+    ASSERT_EQ(fgetc(f), 'y');
+    ASSERT_EQ(fseek(f, -1, SEEK_END), 0);
+    ASSERT_EQ(fgetc(f), 'z');
+
+    fclose(f);
+
+    PASS();
+}
+
+TEST test_sink_uring_flushes(void) {
+    FILE *f = tmpfile();
+
+    sink_t sink;
+    sink_init_uring(&sink, f);
+
+    // Each write after a flush goes out in order, in whichever buffer is next.
+    ASSERT(sink_puts(&sink, "AAAA"));
+    ASSERT(sink_flush(&sink));
+    ASSERT(sink_puts(&sink, "BBBB"));
+    ASSERT(sink_flush(&sink));
+    ASSERT(sink_puts(&sink, "CCCC"));
+    ASSERT(sink_flush(&sink));
+
+    sink_destroy(&sink);
+
+    char got[16] = {0};
+    rewind(f);
+    ASSERT_EQ(fread(got, 1, sizeof(got), f), 12);
+    ASSERT_STR_EQ(got, "AAAABBBBCCCC");
+
+    fclose(f);
+
+    PASS();
+}
+
+TEST test_sink_take(void) {
+    strbuf_t *sb, *out;
+    strbuf_init(&sb, 1);
+    strbuf_init(&out, 1);
+    strbuf_append(&sb, "abc", 3);
+
+    // An empty memory sink takes the strbuf's buffer as its own.
+    sink_t sink;
+    sink_init_mem(&sink, &out);
+
+    strbuf_t *given = sb;
+    ASSERT(sink_take(&sink, &sb));
+    ASSERT_EQ(out, given);
+    ASSERT_EQ(sb->pos, 0);
+
+    // Once it has something, the strbuf is copied.
+    strbuf_append(&sb, "de", 2);
+    ASSERT(sink_take(&sink, &sb));
+    ASSERT_EQ(sb->pos, 0);
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    ASSERT_EQ(out->pos, 5);
+    ASSERT_EQ(memcmp(out->buf, "abcde", 5), 0);
+
+    // A large strbuf is written straight to the file, after what's pending.
+    FILE *f = tmpfile();
+    sink_init_fd(&sink, fileno(f));
+    ASSERT(sink_puts(&sink, "x"));
+
+    static char big[TAKE_MIN];
+    memset(big, 'y', sizeof(big));
+    strbuf_append(&sb, big, sizeof(big));
+    ASSERT(sink_take(&sink, &sb));
+    ASSERT(sink_puts(&sink, "z"));
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    ASSERT_EQ(fseek(f, 0, SEEK_END), 0);
+    ASSERT_EQ(ftell(f), 1 + TAKE_MIN + 1);
+    rewind(f);
+    ASSERT_EQ(fgetc(f), 'x');
+    ASSERT_EQ(fgetc(f), 'y');
+    ASSERT_EQ(fseek(f, -1, SEEK_END), 0);
+    ASSERT_EQ(fgetc(f), 'z');
+
+    fclose(f);
+    strbuf_destroy(out);
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_sink_take_uring(void) {
+    FILE *f = tmpfile();
+
+    sink_t sink;
+    sink_init_uring(&sink, f);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    static char big[TAKE_MIN];
+    memset(big, 'y', sizeof(big));
+
+    // Each large strbuf flushes the ring, and what's written after it must
+    // still land in order.
+    static char expect[3 + 2 * TAKE_MIN];
+    char *cur = expect;
+
+    for (size_t i = 0; i < 2; i += 1) {
+        char c = (char)('a' + i);
+        ASSERT(sink_putc(&sink, c));
+        PUT(cur, &c, 1);
+
+        strbuf_append(&sb, big, sizeof(big));
+        ASSERT(sink_take(&sink, &sb));
+        PUT(cur, big, sizeof(big));
+    }
+
+    ASSERT(sink_putc(&sink, 'z'));
+    PUT(cur, "z", 1);
+
+    ASSERT(sink_flush(&sink));
+    sink_destroy(&sink);
+
+    static char got[sizeof(expect) + 1];
+    rewind(f);
+    ASSERT_EQ(fread(got, 1, sizeof(got), f), sizeof(expect));
+    ASSERT_EQ(memcmp(got, expect, sizeof(expect)), 0);
+
+    fclose(f);
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+SUITE(sink_suite) {
+    RUN_TEST(test_sink_mem);
+    RUN_TEST(test_sink_buf);
+    RUN_TEST(test_sink_stdio);
+    RUN_TEST(test_sink_error);
+    RUN_TEST(test_sink_pipe);
+    RUN_TEST(test_sink_uring);
+    RUN_TEST(test_sink_uring_flushes);
+    RUN_TEST(test_sink_take);
+    RUN_TEST(test_sink_take_uring);
+}
+#endif
+
+#ifdef MKBUNDLE_BENCH
+// Pipe to benchmark and how its reader drains it.
+typedef struct {
+    int fds[2];
+    bool splice;
+} bench_pipe_t;
+
+// Drain the pipe until it's closed, either reading into a buffer or splicing
+// to /dev/null.
+static void *bench_reader(void *arg) {
+    const bench_pipe_t *p = arg;
+    static char buf[1 << 16];
+
+    if (!p->splice) {
+        while (read(p->fds[0], buf, sizeof(buf)) > 0)
+            ;
+
+        return NULL;
+    }
+
+    int null = open("/dev/null", O_WRONLY);
+
+    while (splice(p->fds[0], NULL, null, NULL, sizeof(buf), 0) > 0)
+        ;
+
+    close(null);
+
+    return NULL;
+}
+
+// Measure the rate of writing to a pipe drained by another thread.
+static void bench_pipe(const char *name, bool gift, bool splice) {
+    enum { CHUNK = 1 << 12, TOTAL = 1 << 28 };
+
+    bench_pipe_t p = {.splice = splice};
+
+    if (pipe(p.fds) != 0)
+        return;
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, bench_reader, &p);
+
+    sink_t sink;
+    init_fd(&sink, p.fds[1], fd_drain, gift);
+
+    double start = bench_now();
+
+    for (size_t i = 0; i < TOTAL / CHUNK; i += 1) {
+        uint8_t *cur = sink_reserve(&sink, CHUNK);
+
+        if (!cur)
+            break;
+
+        memset(cur, (int) i, CHUNK);
+        sink_commit(&sink, CHUNK);
+    }
+
+    sink_flush(&sink);
+    sink_destroy(&sink);
+    close(p.fds[1]);
+    pthread_join(reader, NULL);
+
+    bench_report(name, TOTAL, "B", bench_now() - start);
+    close(p.fds[0]);
+}
+
+BENCH_SUITE(sink_bench) {
+    bench_pipe("pipe write, read", false, false);
+    bench_pipe("pipe vmsplice, read", true, false);
+    bench_pipe("pipe write, splice", false, true);
+    bench_pipe("pipe vmsplice, splice", true, true);
+}
+#endif
@@ -0,0 +1,140 @@
+// See copyright notice in Copying.
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "strbuf.h"
+#include "uring.h"
+
+enum {
+    // Size of the buffer held by fd and stdio sinks.
+    SINK_BUF = 1 << 16,
+    // Size of the mappings a pipe sink carves its buffers from.
+    SINK_MAP = 1 << 22,
+};
+
+typedef struct sink sink_t;
+
+// Move pending bytes out of the sink's buffer, or grow it, so at least len
+// bytes are free past pos. Return false on error.
+typedef bool (*sink_drain_fn)(sink_t *s, size_t len);
+
+// A destination for encoded output. Writers reserve room in the sink's buffer,
+// encode straight into it, and commit what they wrote, so output reaches its
+// destination in large batches without going through stdio.
+struct sink {
+    // Buffer writers encode into, with pos bytes pending.
+    uint8_t *buf;
+    size_t pos;
+    size_t cap;
+
+    sink_drain_fn drain;
+    // Set once draining fails, after which nothing more is accepted.
+    bool error;
+
+    // Strbuf a memory sink appends to.
+    strbuf_t **sbp;
+    // Caller's buffer a buffer sink fills, and the length of the output so
+    // far, which can run past dest_cap. Output reserved where it might not fit
+    // goes to the spill buffer and is copied over once committed.
+    uint8_t *dest;
+    size_t dest_cap;
+    size_t dest_len;
+    uint8_t *spill;
+    size_t spill_cap;
+    // Stream a stdio sink flushes before each drain.
+    FILE *stream;
+    // File descriptor an fd or stdio sink writes to.
+    int fd;
+
+    // Whether the file descriptor is a pipe that buffers are gifted to with
+    // vmsplice. The pipe keeps reading from gifted pages, so they're never
+    // written again: each buffer is carved from the map after the last one.
+    bool gift;
+    uint8_t *map;
+    size_t map_len;
+
+    // Ring that a uring sink writes through, and which of its buffers is
+    // being filled.
+    uring_t *uring;
+    size_t uring_buf;
+};
+
+// Initialize the sink to append to the strbuf, growing it as needed. The
+// strbuf's position is only brought up to date by sink_flush.
+void sink_init_mem(sink_t *s, strbuf_t **sbp);
+
+// Initialize the sink to fill the caller's buffer of cap bytes. Output past
+// the end is counted but dropped, so sink_len tells how much room it needs.
+void sink_init_buf(sink_t *s, void *buf, size_t cap);
+
+// Point the buffer sink at another buffer, as if newly initialized, but keep
+// its spill buffer for reuse.
+void sink_reset_buf(sink_t *s, void *buf, size_t cap);
+
+// Get the number of bytes written to a buffer sink, including any that
+// didn't fit.
+size_t sink_len(const sink_t *s);
+
+// Initialize the sink to write to the file descriptor. If it's a pipe, full
+// buffers are gifted to it with vmsplice instead of being copied by write,
+// falling back to write if the kernel refuses.
+void sink_init_fd(sink_t *s, int fd);
+
+// Initialize the sink to write to the stream's file descriptor, like an fd
+// sink, after anything already buffered in the stream.
+void sink_init_stdio(sink_t *s, FILE *stream);
+
+// Initialize the sink to write to the stream's file descriptor through
+// io_uring, after anything already buffered in the stream. Each full buffer is
+// written in the background while the next one is filled. Without kernel
+// support this falls back to a stdio sink.
+void sink_init_uring(sink_t *s, FILE *stream);
+
+// Free the sink's buffer. Pending bytes are dropped, so flush first.
+void sink_destroy(sink_t *s);
+
+// Get room for len bytes at the end of the sink's buffer. Return NULL if the
+// sink has failed.
+static inline uint8_t *sink_reserve(sink_t *s, size_t len) {
+    if (s->cap - s->pos < len && !s->error && !s->drain(s, len))
+        s->error = true;
+
+    return s->error ? NULL : &s->buf[s->pos];
+}
+
+// Commit len bytes written to the room given by sink_reserve.
+static inline void sink_commit(sink_t *s, size_t len) {
+    s->pos += len;
+}
+
+// Append the buffer to the sink. Return false if the sink has failed.
+bool sink_write(sink_t *s, const void *buf, size_t len);
+
+// Append the strbuf's contents to the sink, leaving the strbuf empty, without
+// copying them where possible: an empty memory sink swaps buffers with the
+// strbuf, and other sinks write large contents straight from it. Return false
+// if the sink has failed.
+bool sink_take(sink_t *s, strbuf_t **sbp);
+
+// Append the string, without its terminator, to the sink. Return false if the
+// sink has failed.
+bool sink_puts(sink_t *s, const char *str);
+
+// Append the character to the sink. Return false if the sink has failed.
+bool sink_putc(sink_t *s, char c);
+
+// Append formatted output to the sink. Return false if the sink has failed.
+__attribute__((format(printf, 2, 3)))
+bool sink_printf(sink_t *s, const char *fmt, ...);
+
+// Send everything pending to the sink's destination. Return false if any write
+// to the sink has failed.
+bool sink_flush(sink_t *s);
+
+#endif
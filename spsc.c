@@ -0,0 +1,211 @@
+// See copyright notice in Copying.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "spsc.h"
+
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#endif
+
+void spsc_init(spsc_t *q, size_t cap) {
+    assert(cap && !(cap & (cap - 1)));
+
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->waiters, 0);
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+
+    q->mask = cap - 1;
+    q->slots = calloc(cap, sizeof(q->slots[0]));
+    assert(q->slots);
+
+    q->push_count = 0;
+    q->occupancy_sum = 0;
+    q->occupancy_max = 0;
+    q->full_waits = 0;
+    q->empty_waits = 0;
+}
+
+void spsc_destroy(spsc_t *q) {
+    free(q->slots);
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+}
+
+bool spsc_try_push(spsc_t *q, void *item) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail - head > q->mask)
+        return false;
+
+    q->slots[tail & q->mask] = item;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    size_t occupancy = tail + 1 - head;
+
+    q->push_count += 1;
+    q->occupancy_sum += occupancy;
+
+    if (occupancy > q->occupancy_max)
+        q->occupancy_max = occupancy;
+
+    return true;
+}
+
+bool spsc_try_pop(spsc_t *q, void **item) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    *item = q->slots[head & q->mask];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+// Wake the other side of the queue if it's blocked.
+static void wake(spsc_t *q) {
+    // Pairs with the waiter registering itself before checking the queue
+    // again, so either it sees the change or this sees it waiting.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!atomic_load(&q->waiters))
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void spsc_push(spsc_t *q, void *item) {
+    if (!spsc_try_push(q, item)) {
+        q->full_waits += 1;
+
+        pthread_mutex_lock(&q->lock);
+        atomic_fetch_add(&q->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        while (!spsc_try_push(q, item))
+            pthread_cond_wait(&q->cond, &q->lock);
+
+        atomic_fetch_sub(&q->waiters, 1);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    wake(q);
+}
+
+void *spsc_pop(spsc_t *q) {
+    void *item;
+
+    if (!spsc_try_pop(q, &item)) {
+        q->empty_waits += 1;
+
+        pthread_mutex_lock(&q->lock);
+        atomic_fetch_add(&q->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        while (!spsc_try_pop(q, &item))
+            pthread_cond_wait(&q->cond, &q->lock);
+
+        atomic_fetch_sub(&q->waiters, 1);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    wake(q);
+
+    return item;
+}
+
+void spsc_print_stats(const spsc_t *q, const char *name, FILE *stream) {
+    fprintf(stream, "%-14s %4zu %10zu %6.2f %4zu %10zu %11zu\n",
+        name,
+        q->mask + 1,
+        q->push_count,
+        q->push_count ? (double) q->occupancy_sum / (double) q->push_count : 0,
+        q->occupancy_max,
+        q->full_waits,
+        q->empty_waits
+    );
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_spsc_try(void) {
+    spsc_t q;
+    spsc_init(&q, 4);
+
+    int items[5];
+    void *item;
+
+    ASSERT(!spsc_try_pop(&q, &item));
+
+    for (size_t i = 0; i < 4; i += 1)
+        ASSERT(spsc_try_push(&q, &items[i]));
+
+    ASSERT(!spsc_try_push(&q, &items[4]));
+    ASSERT_EQ(q.occupancy_max, 4);
+
+    for (size_t i = 0; i < 4; i += 1) {
+        ASSERT(spsc_try_pop(&q, &item));
+        ASSERT_EQ(item, &items[i]);
+    }
+
+    ASSERT(!spsc_try_pop(&q, &item));
+    ASSERT(spsc_try_push(&q, &items[4]));
+    ASSERT(spsc_try_pop(&q, &item));
+    ASSERT_EQ(item, &items[4]);
+
+    spsc_destroy(&q);
+
+    PASS();
+}
+
+enum { THREAD_COUNT = 100000 };
+
+static void *produce(void *arg) {
+    spsc_t *q = arg;
+
+    for (size_t i = 1; i <= THREAD_COUNT; i += 1)
+        spsc_push(q, (void *) i);
+
+    return NULL;
+}
+
+TEST test_spsc_threads(void) {
+    spsc_t q;
+    spsc_init(&q, 2);
+
+    pthread_t thread;
+    ASSERT_EQ(pthread_create(&thread, NULL, produce, &q), 0);
+
+    // Items must arrive in order even though both sides block.
+    for (size_t i = 1; i <= THREAD_COUNT; i += 1)
+        ASSERT_EQ((size_t) spsc_pop(&q), i);
+
+    pthread_join(thread, NULL);
+    ASSERT_EQ(q.push_count, THREAD_COUNT);
+    ASSERT(q.occupancy_max <= 2);
+
+    spsc_destroy(&q);
+
+    PASS();
+}
+
+SUITE(spsc_suite) {
+    RUN_TEST(test_spsc_try);
+    RUN_TEST(test_spsc_threads);
+}
+#endif
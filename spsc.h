@@ -0,0 +1,63 @@
+// See copyright notice in Copying.
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A bounded lock-free queue of pointers between a single producer thread and a
+// single consumer thread. Pushing to a full queue or popping from an empty one
+// blocks, which gives backpressure between pipeline stages. The blocking slow
+// path uses a mutex, but the fast path never does.
+typedef struct {
+    // Next slot to pop, written only by the consumer.
+    alignas(64) _Atomic size_t head;
+    // Next slot to push, written only by the producer.
+    alignas(64) _Atomic size_t tail;
+    // Number of threads blocked on the queue.
+    alignas(64) _Atomic unsigned waiters;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t mask;
+    void **slots;
+
+    // Occupancy stats, written only by the producer.
+    size_t push_count;
+    size_t occupancy_sum;
+    size_t occupancy_max;
+    size_t full_waits;
+    // Written only by the consumer.
+    size_t empty_waits;
+} spsc_t;
+
+// Initialize the queue with the given capacity, which must be a power of 2.
+void spsc_init(spsc_t *q, size_t cap);
+
+// Free memory held by the queue.
+void spsc_destroy(spsc_t *q);
+
+// Push the item if there's room. Return true on success and false if the queue
+// is full.
+bool spsc_try_push(spsc_t *q, void *item);
+
+// Pop the oldest item if there is one. Return true on success and false if the
+// queue is empty.
+bool spsc_try_pop(spsc_t *q, void **item);
+
+// Push the item, waiting for room if the queue is full.
+void spsc_push(spsc_t *q, void *item);
+
+// Pop the oldest item, waiting for one if the queue is empty.
+void *spsc_pop(spsc_t *q);
+
+// Write a line of occupancy stats for the queue with the given name.
+void spsc_print_stats(const spsc_t *q, const char *name, FILE *stream);
+
+#endif
@@ -7,29 +7,66 @@
 
 #include "strbuf.h"
 
-static strbuf_t *alloc(strbuf_t *sb, size_t cap) {
-    sb = realloc(sb, sizeof(strbuf_t) + cap);
-    assert(sb);
+#ifdef MKBUNDLE_TEST
+#include "greatest.h"
+#include "util.h"
+#endif
+
+#ifdef MKBUNDLE_BENCH
+#include <stdio.h>
+
+#include "bench.h"
+#endif
+
+static strbuf_t *alloc(strbuf_t *sb, size_t cap, arena_t *arena) {
+    if (arena) {
+        sb = arena_realloc(arena, sb, sb ? sizeof(strbuf_t) + sb->cap : 0,
+                           sizeof(strbuf_t) + cap);
+    } else {
+        sb = realloc(sb, sizeof(strbuf_t) + cap);
+        assert(sb);
+    }
 
     sb->cap = cap;
+    sb->arena = arena;
+    sb->fixed = false;
 
     return sb;
 }
 
 void strbuf_init(strbuf_t **sbp, size_t cap) {
+    strbuf_init_arena(sbp, cap, NULL);
+}
+
+void strbuf_init_arena(strbuf_t **sbp, size_t cap, arena_t *arena) {
     strbuf_t *sb;
 
-    sb = alloc(NULL, cap);
+    sb = alloc(NULL, cap, arena);
     sb->pos = 0;
     sb->buf[0] = 0;
 
     *sbp = sb;
 }
 
+void strbuf_init_fixed(strbuf_t **sbp, void *mem, size_t size) {
+    assert(size > sizeof(strbuf_t));
+
+    strbuf_t *sb = mem;
+
+    *sb = (strbuf_t) {
+        .cap = size - sizeof(strbuf_t),
+        .fixed = true,
+    };
+
+    sb->buf[0] = 0;
+
+    *sbp = sb;
+}
+
 void strbuf_init_buf(strbuf_t **sbp, const char *buf, size_t len) {
     strbuf_t *sb;
 
-    sb = alloc(NULL, len + 1);
+    sb = alloc(NULL, len + 1, NULL);
     sb->pos = len;
     memcpy(sb->buf, buf, len);
     sb->buf[len] = 0;
@@ -38,19 +75,33 @@ void strbuf_init_buf(strbuf_t **sbp, const char *buf, size_t len) {
 }
 
 void strbuf_destroy(strbuf_t *sb) {
-    free(sb);
+    if (sb && !sb->arena && !sb->fixed)
+        free(sb);
 }
 
 void strbuf_destroy_buf(char *buf) {
     if (buf)
-        free(buf - sizeof(strbuf_t));
+        strbuf_destroy((strbuf_t *)(buf - sizeof(strbuf_t)));
 }
 
 void strbuf_expect(strbuf_t **sbp, size_t len) {
     strbuf_t *sb = *sbp;
 
-    if (sb->pos + len > sb->cap)
-        *sbp = alloc(sb, sb->cap + len);
+    if (sb->pos + len > sb->cap) {
+        assert(!sb->fixed);
+
+        size_t cap = 2 * sb->cap;
+        *sbp = alloc(sb, sb->pos + len > cap ? sb->pos + len : cap, sb->arena);
+    }
+}
+
+void strbuf_reserve(strbuf_t **sbp, size_t len) {
+    strbuf_t *sb = *sbp;
+
+    if (sb->pos + len > sb->cap) {
+        assert(!sb->fixed);
+        *sbp = alloc(sb, sb->pos + len, sb->arena);
+    }
 }
 
 void strbuf_append(strbuf_t **sbp, const char *buf, size_t len) {
@@ -76,3 +127,176 @@ static void strbuf_append_char(strbuf_t **sbp, char c) {
 void strbuf_finish(strbuf_t **sbp) {
     strbuf_append_char(sbp, 0);
 }
+
+void strbuf_discard(strbuf_t *sb, size_t len) {
+    assert(len <= sb->pos);
+
+    memmove(sb->buf, &sb->buf[len], sb->pos - len);
+    sb->pos -= len;
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_strbuf_growth(void) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    size_t before = util_alloc_count();
+
+    for (size_t i = 0; i < 1 << 16; i += 1)
+        strbuf_append(&sb, "x", 1);
+
+    // Doubling from 1 to 2^16 bytes.
+    ASSERT(util_alloc_count() - before <= 16);
+    ASSERT_EQ(sb->pos, 1 << 16);
+
+    // A bigger append than doubling allows grows to fit it.
+    static char big[1 << 18];
+    strbuf_append(&sb, big, sizeof(big));
+    ASSERT_EQ(sb->cap, (1 << 16) + sizeof(big));
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_strbuf_reserve(void) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 4);
+    strbuf_append(&sb, "abc", 3);
+
+    // Reserving grows to exactly what's asked for, once.
+    strbuf_reserve(&sb, 100);
+    ASSERT_EQ(sb->cap, 103);
+
+    size_t before = util_alloc_count();
+
+    for (size_t i = 0; i < 100; i += 1)
+        strbuf_append(&sb, "x", 1);
+
+    ASSERT_EQ(util_alloc_count(), before);
+
+    // Reserving what already fits does nothing.
+    strbuf_reserve(&sb, 0);
+    ASSERT_EQ(sb->cap, 103);
+
+    strbuf_destroy(sb);
+
+    PASS();
+}
+
+TEST test_strbuf_arena(void) {
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    strbuf_t *sb;
+    strbuf_init_arena(&sb, 1, &arena);
+
+    for (size_t i = 0; i < 1000; i += 1)
+        strbuf_append(&sb, "0123456789", 10);
+
+    ASSERT_EQ(sb->pos, 10000);
+    ASSERT_EQ(memcmp(&sb->buf[9990], "0123456789", 10), 0);
+    ASSERT_EQ(sb->arena, &arena);
+
+    strbuf_destroy(sb);
+    arena_destroy(&arena);
+
+    PASS();
+}
+
+SUITE(strbuf_suite) {
+    RUN_TEST(test_strbuf_growth);
+    RUN_TEST(test_strbuf_reserve);
+    RUN_TEST(test_strbuf_arena);
+}
+#endif
+
+#ifdef MKBUNDLE_BENCH
+enum {
+    // EIDs in a big dictionary.
+    BENCH_EIDS = 10000,
+    BENCH_ROUNDS = 256,
+};
+
+// Fill the dictionary with null-terminated IPN EIDs, starting from the given
+// capacity, and reserving room for all of them first if reserve is nonzero.
+static void fill_eids(strbuf_t **sbp, size_t reserve) {
+    if (reserve)
+        strbuf_reserve(sbp, reserve);
+
+    for (size_t i = 0; i < BENCH_EIDS; i += 1) {
+        char eid[32];
+        int len = snprintf(eid, sizeof(eid), "ipn:%zu.%zu", 100 + i, i % 7);
+
+        strbuf_append(sbp, eid, (size_t) len);
+        strbuf_finish(sbp);
+    }
+}
+
+BENCH_SUITE(strbuf_bench) {
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+    fill_eids(&sb, 0);
+
+    // Enough room for every EID, as a reserve hint would give.
+    size_t total = sb->pos;
+    strbuf_destroy(sb);
+
+    double start = bench_now();
+
+    for (size_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        strbuf_init(&sb, 1);
+        fill_eids(&sb, 0);
+        bench_keep(sb->pos);
+        strbuf_destroy(sb);
+    }
+
+    bench_report("10k EIDs, growing from 1 byte",
+                 (double) BENCH_EIDS * BENCH_ROUNDS, "EID",
+                 bench_now() - start);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        strbuf_init(&sb, 1);
+        fill_eids(&sb, total);
+        bench_keep(sb->pos);
+        strbuf_destroy(sb);
+    }
+
+    bench_report("10k EIDs, reserved up front",
+                 (double) BENCH_EIDS * BENCH_ROUNDS, "EID",
+                 bench_now() - start);
+
+    arena_t arena;
+    arena_init(&arena, ARENA_CHUNK, 0);
+
+    start = bench_now();
+
+    for (size_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        strbuf_init_arena(&sb, 1, &arena);
+        fill_eids(&sb, 0);
+        bench_keep(sb->pos);
+        arena_reset(&arena);
+    }
+
+    bench_report("10k EIDs, growing in an arena",
+                 (double) BENCH_EIDS * BENCH_ROUNDS, "EID",
+                 bench_now() - start);
+
+    arena_destroy(&arena);
+
+    enum { BYTES = 1 << 24 };
+
+    start = bench_now();
+    strbuf_init(&sb, 1);
+
+    for (size_t i = 0; i < BYTES; i += 1)
+        strbuf_append(&sb, "x", 1);
+
+    bench_keep(sb->pos);
+    strbuf_destroy(sb);
+
+    bench_report("1-byte appends", BYTES, "B", bench_now() - start);
+}
+#endif
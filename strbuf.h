@@ -4,14 +4,22 @@
 #define STRBUF_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
+#include "arena.h"
+
 // A string buffer that can grow dynamically.
 typedef struct {
     // The maximum capacity of the buffer.
     size_t cap;
     // The current position in the buffer.
     size_t pos;
+    // The arena the strbuf was allocated from, or NULL if on the heap.
+    arena_t *arena;
+    // Whether the strbuf lives in storage owned by someone else and can't
+    // grow.
+    bool fixed;
     // The buffer itself.
     char buf[];
 } strbuf_t;
@@ -19,6 +27,16 @@ typedef struct {
 // Initialize the strbuf to have the given capacity.
 void strbuf_init(strbuf_t **sbp, size_t cap);
 
+// Initialize the strbuf to have the given capacity and to grow within the
+// given arena, or on the heap if it's NULL. Destroying a strbuf in an arena
+// does nothing: its memory is released with the arena.
+void strbuf_init_arena(strbuf_t **sbp, size_t cap, arena_t *arena);
+
+// Initialize the strbuf inside the given storage of size bytes, which must be
+// aligned for a strbuf_t. The strbuf can't grow past the storage, so callers
+// must check strbuf_fits before appending, and destroying it does nothing.
+void strbuf_init_fixed(strbuf_t **sbp, void *mem, size_t size);
+
 // Initialize the strbuf with a copy of the given character buffer with the
 // given length.
 void strbuf_init_buf(strbuf_t **sbp, const char *buf, size_t len);
@@ -29,13 +47,28 @@ void strbuf_destroy(strbuf_t *sb);
 // Destroy the strbuf that wraps the given character buffer.
 void strbuf_destroy_buf(char *buf);
 
-// Ensure the strbuf can hold len more bytes.
+// Check if len more bytes fit without growing the strbuf.
+static inline bool strbuf_fits(const strbuf_t *sb, size_t len) {
+    return len <= sb->cap - sb->pos;
+}
+
+// Ensure the strbuf can hold len more bytes. The capacity at least doubles
+// whenever it grows, so a run of appends reallocates a logarithmic number of
+// times.
 void strbuf_expect(strbuf_t **sbp, size_t len);
 
+// Ensure the strbuf can hold len more bytes, growing it to exactly that if
+// needed. For callers that know how much is coming, this avoids the slack left
+// by strbuf_expect.
+void strbuf_reserve(strbuf_t **sbp, size_t len);
+
 // Append the given string to the strbuf. Note that no null-termination is done.
 void strbuf_append(strbuf_t **sbp, const char *buf, size_t len);
 
 // Add a null-terminator to the current position in the strbuf.
 void strbuf_finish(strbuf_t **sbp);
 
+// Remove the first len bytes from the strbuf, moving the rest to the front.
+void strbuf_discard(strbuf_t *sb, size_t len);
+
 #endif
@@ -0,0 +1,19 @@
+// See copyright notice in Copying.
+
+#ifndef TEST_PARAMS_H
+#define TEST_PARAMS_H
+
+// Element of a bundle spec holding the params of a primary block with no EIDs.
+#define TEST_PRIMARY \
+    "{\"primary\": {\"version\": 6, \"flags\": 0, \"length\": 0," \
+    " \"dest\": [0, 0], \"src\": [0, 0], \"report-to\": [0, 0]," \
+    " \"custodian\": [0, 0], \"creation-ts\": 1, \"creation-seq\": 2," \
+    " \"lifetime\": 3, \"eids-size\": 0, \"eids\": []}}"
+
+// Params of an extension block with the given type, flags, and payload
+// length, as a record of a param file or a member of a bundle spec element.
+#define TEST_EXTENSION(type, flags, len) \
+    "\"extension\": {\"type\": " #type ", \"flags\": " #flags "," \
+    " \"payload-length\": " #len ", \"ref-count\": 0, \"refs\": []}"
+
+#endif
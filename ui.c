@@ -20,6 +20,8 @@ cmd_t parse_cmd(const char *str) {
         {CMD_PRIMARY, "primary"},
         {CMD_EXTENSION, "extension"},
         {CMD_COMPILE, "compile"},
+        {CMD_BUILD, "build"},
+        {CMD_SERVE, "serve"},
     };
 
     uint32_t cmd = sym_parse(str, MAP, ASIZE(MAP));
@@ -98,6 +100,14 @@ uint32_t parse_report(const char *str) {
     return report;
 }
 
+primary_field_t parse_primary_field(const char *str) {
+    for (size_t f = 0; f < PRIMARY_FIELD_MAX; f += 1)
+        if (strcmp(primary_field_names[f], str) == 0)
+            return (primary_field_t) f;
+
+    return PRIMARY_FIELD_INVALID;
+}
+
 ext_block_type_t parse_ext_block_type(const char *str) {
     static const sym_t MAP[] = {
         {EXT_BLOCK_PAYLOAD, "payload"},
@@ -113,6 +123,15 @@ ext_block_type_t parse_ext_block_type(const char *str) {
 }
 
 #ifdef MKBUNDLE_TEST
+TEST test_parse_primary_field(void) {
+    ASSERT_EQ(parse_primary_field("creation-ts"), PRIMARY_FIELD_CREATION_TS);
+    ASSERT_EQ(parse_primary_field("lifetime"), PRIMARY_FIELD_LIFETIME);
+    ASSERT_EQ(parse_primary_field("version"), PRIMARY_FIELD_INVALID);
+
+    PASS();
+}
+
 SUITE(ui_suite) {
+    RUN_TEST(test_parse_primary_field);
 }
 #endif
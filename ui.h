@@ -6,6 +6,7 @@
 #include <inttypes.h>
 
 #include "ext-block.h"
+#include "primary-block.h"
 
 // Signatures of command and help functions.
 typedef void (*cmd_fn)(const char *name, int argc, char **argv);
@@ -16,6 +17,8 @@ typedef enum {
     CMD_PRIMARY,
     CMD_EXTENSION,
     CMD_COMPILE,
+    CMD_BUILD,
+    CMD_SERVE,
 
     CMD_INVALID,
 } cmd_t;
@@ -33,6 +36,10 @@ uint32_t parse_prio(const char *str);
 // Parse the string into a status report flag. Return FLAG_INVALID on error.
 uint32_t parse_report(const char *str);
 
+// Parse the string into a fixed-width primary block field. Return
+// PRIMARY_FIELD_INVALID on error.
+primary_field_t parse_primary_field(const char *str);
+
 // Parse the string into an extension block type. Return EXT_BLOCK_INVALID
 // on error.
 ext_block_type_t parse_ext_block_type(const char *str);
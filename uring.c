@@ -0,0 +1,292 @@
+// See copyright notice in Copying.
+
+// For syscall.
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#ifdef MKBUNDLE_TEST
+#include <stdio.h>
+
+#include "greatest.h"
+#endif
+
+enum {
+    // Entries in the submission queue. Only one write is in flight at a time.
+    URING_ENTRIES = 4,
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, const void *arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, fd, op, arg, count);
+}
+
+// Map one of the regions the kernel shares with the ring.
+static void *map_ring(int fd, size_t len, off_t off) {
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, off);
+
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+// Allocate the buffers and register them with the kernel.
+static bool alloc_bufs(uring_t *u, size_t buf_cap) {
+    struct iovec iov[URING_BUFS];
+
+    for (size_t i = 0; i < URING_BUFS; i += 1) {
+        u->bufs[i] = malloc(buf_cap);
+        assert(u->bufs[i]);
+
+        iov[i] = (struct iovec) {
+            .iov_base = u->bufs[i],
+            .iov_len = buf_cap,
+        };
+    }
+
+    u->buf_cap = buf_cap;
+
+    return sys_register(u->ring_fd, IORING_REGISTER_BUFFERS, iov,
+                        URING_BUFS) == 0;
+}
+
+static void free_bufs(uring_t *u) {
+    for (size_t i = 0; i < URING_BUFS; i += 1) {
+        free(u->bufs[i]);
+        u->bufs[i] = NULL;
+    }
+}
+
+// Tear down whatever parts of the ring were set up.
+static void teardown(uring_t *u) {
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_len);
+
+    if (u->cq_map)
+        munmap(u->cq_map, u->cq_map_len);
+
+    if (u->sq_map)
+        munmap(u->sq_map, u->sq_map_len);
+
+    if (u->ring_fd >= 0)
+        close(u->ring_fd);
+
+    free_bufs(u);
+}
+
+bool uring_init(uring_t *u, int fd, size_t buf_cap) {
+    *u = (uring_t) {
+        .ring_fd = -1,
+    };
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    u->ring_fd = sys_setup(URING_ENTRIES, &p);
+
+    // Writing at the file's position needs Linux 5.6 or later.
+    if (u->ring_fd < 0 || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        teardown(u);
+        return false;
+    }
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_map = map_ring(u->ring_fd, u->sq_map_len, IORING_OFF_SQ_RING);
+    u->cq_map = map_ring(u->ring_fd, u->cq_map_len, IORING_OFF_CQ_RING);
+    u->sqes = map_ring(u->ring_fd, u->sqes_len, IORING_OFF_SQES);
+
+    if (!u->sq_map || !u->cq_map || !u->sqes ||
+        sys_register(u->ring_fd, IORING_REGISTER_FILES, &fd, 1) != 0 ||
+        !alloc_bufs(u, buf_cap))
+    {
+        teardown(u);
+        return false;
+    }
+
+    uint8_t *sq = u->sq_map;
+    u->sq_head = (_Atomic unsigned *)(void *) &sq[p.sq_off.head];
+    u->sq_tail = (_Atomic unsigned *)(void *) &sq[p.sq_off.tail];
+    u->sq_mask = *(unsigned *)(void *) &sq[p.sq_off.ring_mask];
+    u->sq_array = (unsigned *)(void *) &sq[p.sq_off.array];
+
+    uint8_t *cq = u->cq_map;
+    u->cq_head = (_Atomic unsigned *)(void *) &cq[p.cq_off.head];
+    u->cq_tail = (_Atomic unsigned *)(void *) &cq[p.cq_off.tail];
+    u->cq_mask = *(unsigned *)(void *) &cq[p.cq_off.ring_mask];
+    u->cqes = (struct io_uring_cqe *)(void *) &cq[p.cq_off.cqes];
+
+    return true;
+}
+
+void uring_destroy(uring_t *u) {
+    uring_wait(u);
+    teardown(u);
+}
+
+// Submit a write of the rest of the busy buffer.
+static bool submit(uring_t *u) {
+    unsigned tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    unsigned idx = tail & u->sq_mask;
+
+    u->sqes[idx] = (struct io_uring_sqe) {
+        .opcode = IORING_OP_WRITE_FIXED,
+        .flags = IOSQE_FIXED_FILE,
+        // Index of the registered file.
+        .fd = 0,
+        // Write at the file's position, like write does.
+        .off = UINT64_MAX,
+        .addr = (uint64_t)(uintptr_t) &u->bufs[u->busy_buf][u->busy_pos],
+        .len = u->busy_len > UINT32_MAX ? UINT32_MAX : (uint32_t) u->busy_len,
+        .buf_index = (uint16_t) u->busy_buf,
+    };
+
+    u->sq_array[idx] = idx;
+    atomic_store_explicit(u->sq_tail, tail + 1, memory_order_release);
+
+    int ret;
+
+    do
+        ret = sys_enter(u->ring_fd, 1, 0, 0);
+    while (ret < 0 && errno == EINTR);
+
+    return ret == 1;
+}
+
+bool uring_wait(uring_t *u) {
+    while (u->busy) {
+        unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+
+        if (head == atomic_load_explicit(u->cq_tail, memory_order_acquire)) {
+            if (sys_enter(u->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR)
+            {
+                u->busy = false;
+                return false;
+            }
+
+            continue;
+        }
+
+        int res = u->cqes[head & u->cq_mask].res;
+        atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+
+        if (res == -EINTR || res == -EAGAIN)
+            res = 0;
+        else if (res <= 0) {
+            u->busy = false;
+            return false;
+        }
+
+        // Write whatever's left after a short write.
+        u->busy_pos += (size_t) res;
+        u->busy_len -= (size_t) res;
+
+        if (!u->busy_len)
+            u->busy = false;
+        else if (!submit(u)) {
+            u->busy = false;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool uring_write(uring_t *u, size_t buf, size_t len) {
+    assert(buf < URING_BUFS && len <= u->buf_cap);
+
+    if (!uring_wait(u))
+        return false;
+
+    if (!len)
+        return true;
+
+    u->busy = true;
+    u->busy_buf = buf;
+    u->busy_pos = 0;
+    u->busy_len = len;
+
+    if (submit(u))
+        return true;
+
+    u->busy = false;
+
+    return false;
+}
+
+bool uring_grow(uring_t *u, size_t buf_cap) {
+    if (!uring_wait(u))
+        return false;
+
+    sys_register(u->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    free_bufs(u);
+
+    return alloc_bufs(u, buf_cap);
+}
+
+#ifdef MKBUNDLE_TEST
+TEST test_uring(void) {
+    FILE *f = tmpfile();
+    fputs("x", f);
+    fflush(f);
+
+    uring_t u;
+
+    // Nothing to test without kernel support.
+    if (!uring_init(&u, fileno(f), 4)) {
+        fclose(f);
+        SKIP();
+    }
+
+    memcpy(u.bufs[0], "abcd", 4);
+    ASSERT(uring_write(&u, 0, 4));
+
+    // The other buffer can be filled while the first is written.
+    memcpy(u.bufs[1], "ef", 2);
+    ASSERT(uring_write(&u, 1, 2));
+
+    ASSERT(uring_grow(&u, 16));
+    memcpy(u.bufs[0], "ghijklmnop", 10);
+    ASSERT(uring_write(&u, 0, 10));
+    ASSERT(uring_wait(&u));
+
+    uring_destroy(&u);
+
+    // Writes land at the file's position, in order.
+    char got[32] = {0};
+    rewind(f);
+    ASSERT_EQ(fread(got, 1, sizeof(got), f), 17);
+    ASSERT_STR_EQ(got, "xabcdefghijklmnop");
+
+    fclose(f);
+
+    PASS();
+}
+
+SUITE(uring_suite) {
+    RUN_TEST(test_uring);
+}
+#endif
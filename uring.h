@@ -0,0 +1,76 @@
+// See copyright notice in Copying.
+
+#ifndef URING_H
+#define URING_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+enum {
+    // Number of registered buffers: one being filled while the other is
+    // written.
+    URING_BUFS = 2,
+};
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Writes to a single file descriptor through io_uring, made with raw system
+// calls. The file and a pair of buffers are registered with the kernel up
+// front, so a buffer can be written out in the background while the other is
+// being filled, without the kernel looking either up on every write.
+typedef struct {
+    int ring_fd;
+
+    // Submission queue, shared with the kernel.
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Completion queue, shared with the kernel.
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+
+    uint8_t *bufs[URING_BUFS];
+    size_t buf_cap;
+
+    // Write in flight, if any: the rest of a buffer still to be written.
+    bool busy;
+    size_t busy_buf;
+    size_t busy_pos;
+    size_t busy_len;
+} uring_t;
+
+// Set up a ring that writes to the file descriptor at its current position,
+// with buffers of the given size. Return false if the kernel doesn't support
+// io_uring, in which case nothing needs to be destroyed.
+bool uring_init(uring_t *u, int fd, size_t buf_cap);
+
+// Wait for any write in flight, then tear down the ring and free its buffers.
+void uring_destroy(uring_t *u);
+
+// Start writing len bytes of the given buffer. A write already in flight is
+// waited for first, so writes land in order. The buffer must not be touched
+// until the write completes. Return false on error.
+bool uring_write(uring_t *u, size_t buf, size_t len);
+
+// Wait for the write in flight, if any, to complete. Return false on error.
+bool uring_wait(uring_t *u);
+
+// Replace the buffers with bigger ones of the given size, after waiting for any
+// write in flight. Their contents are lost. Return false on error.
+bool uring_grow(uring_t *u, size_t buf_cap);
+
+#endif
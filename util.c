@@ -1,11 +1,21 @@
 // See copyright notice in Copying.
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
 #include <inttypes.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "util.h"
 
 #ifdef MKBUNDLE_TEST
+#include <stdatomic.h>
+#include <stdlib.h>
+
 #include "greatest.h"
 #endif
 
@@ -35,15 +45,84 @@ TEST test_sym_parse(void) {
 }
 #endif
 
+enum {
+    // Least amount to grow the buffer by once it's full.
+    COLLECT_MIN = 1 << 12,
+};
+
+// Guess how many more bytes can be read from the stream: the rest of a regular
+// file, or what's waiting in a pipe.
+static size_t read_hint(FILE *stream) {
+    int fd = fileno(stream);
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return 0;
+
+    if (S_ISREG(st.st_mode)) {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+
+        return pos >= 0 && st.st_size > pos ? (size_t)(st.st_size - pos) : 0;
+    }
+
+    int avail;
+
+    return ioctl(fd, FIONREAD, &avail) == 0 && avail > 0 ? (size_t) avail : 0;
+}
+
 void collect(strbuf_t **buf, FILE *stream) {
-    char next[BUFSIZ];
+    // Room for the hinted amount, and a byte more so reaching the end doesn't
+    // need more.
+    strbuf_reserve(buf, read_hint(stream) + 1);
+
+    while (!feof(stream) && !ferror(stream)) {
+        if ((*buf)->pos == (*buf)->cap)
+            strbuf_expect(buf, COLLECT_MIN);
 
-    while (!feof(stream)) {
-        size_t size = fread(next, sizeof(char), ASIZE(next), stream);
-        strbuf_append(buf, next, size);
+        // Read straight into the buffer rather than through a copy.
+        strbuf_t *sb = *buf;
+        sb->pos += fread(&sb->buf[sb->pos], sizeof(char), sb->cap - sb->pos,
+                         stream);
     }
 }
 
+bool map_input(mapped_t *m, FILE *stream) {
+    int fd = fileno(stream);
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    // Start where the stream is, after anything it has already buffered.
+    off_t pos = ftello(stream);
+
+    if (pos < 0 || st.st_size <= pos)
+        return false;
+
+    // Mappings start on a page boundary.
+    off_t page = (off_t) sysconf(_SC_PAGESIZE);
+    off_t start = pos / page * page;
+
+    m->map_len = (size_t)(st.st_size - start);
+    m->map = mmap(NULL, m->map_len, PROT_READ, MAP_PRIVATE, fd, start);
+
+    if (m->map == MAP_FAILED)
+        return false;
+
+    posix_madvise(m->map, m->map_len, POSIX_MADV_SEQUENTIAL);
+
+    m->buf = &((const char *) m->map)[pos - start];
+    m->len = (size_t)(st.st_size - pos);
+
+    return true;
+}
+
+void unmap_input(mapped_t *m) {
+    munmap(m->map, m->map_len);
+    m->map = NULL;
+    m->buf = NULL;
+}
+
 #ifdef MKBUNDLE_TEST
 TEST test_collect(void) {
     FILE *f = fopen("test", "w+");
@@ -68,11 +147,171 @@ TEST test_collect(void) {
 
     PASS();
 }
+
+TEST test_collect_growth(void) {
+    enum { LEN = 1 << 20 };
+
+    FILE *f = fopen("test", "w+");
+
+    for (size_t i = 0; i < LEN; i += 1)
+        fputc('a' + (int)(i % 26), f);
+
+    strbuf_t *sb;
+    strbuf_init(&sb, 1);
+
+    // The file's size is known, so the buffer grows just once.
+    rewind(f);
+    size_t before = util_alloc_count();
+    collect(&sb, f);
+    ASSERT(util_alloc_count() - before <= 1);
+
+    ASSERT_EQ(sb->pos, LEN);
+    ASSERT_EQ(sb->buf[LEN - 1], 'a' + (LEN - 1) % 26);
+
+    // A pipe hints at what is waiting in it.
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT(write_all(fds[1], sb->buf, 1 << 14));
+    close(fds[1]);
+
+    FILE *p = fdopen(fds[0], "r");
+    sb->pos = 0;
+    collect(&sb, p);
+    ASSERT_EQ(sb->pos, 1 << 14);
+
+    fclose(p);
+    strbuf_destroy(sb);
+    fclose(f);
+
+    PASS();
+}
+
+TEST test_map_input(void) {
+    FILE *f = fopen("test", "w+");
+    fputs("skip the rest", f);
+    rewind(f);
+
+    // Mapping starts after what's been read from the stream.
+    ASSERT_EQ(fgetc(f), 's');
+    ASSERT_EQ(fgetc(f), 'k');
+
+    mapped_t m;
+    ASSERT(map_input(&m, f));
+    ASSERT_EQ(m.len, 11);
+    ASSERT_EQ(memcmp(m.buf, "ip the rest", m.len), 0);
+    unmap_input(&m);
+
+    // Nothing is left to map.
+    fseek(f, 0, SEEK_END);
+    ASSERT(!map_input(&m, f));
+    fclose(f);
+
+    // Pipes can only be read.
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FILE *p = fdopen(fds[0], "r");
+    ASSERT(!map_input(&m, p));
+    fclose(p);
+    close(fds[1]);
+
+    PASS();
+}
 #endif
 
+bool write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *pos = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, pos, len);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        pos += ret;
+        len -= (size_t) ret;
+    }
+
+    return true;
+}
+
+bool write_stream(FILE *stream, const void *buf, size_t len) {
+    // Anything already buffered in the stream must come first.
+    return fflush(stream) == 0 && write_all(fileno(stream), buf, len);
+}
+
 #ifdef MKBUNDLE_TEST
+TEST test_write_all(void) {
+    FILE *f = fopen("test", "w+");
+
+    static const char S[] = "abc";
+    ASSERT(write_all(fileno(f), S, sizeof(S)));
+
+    char buf[8] = {0};
+    rewind(f);
+    ASSERT_EQ(fread(buf, sizeof(buf[0]), ASIZE(buf), f), sizeof(S));
+    ASSERT_STR_EQ(buf, S);
+
+    fclose(f);
+
+    PASS();
+}
+#endif
+
+#ifdef MKBUNDLE_TEST
+// The test build links with --wrap for each of these, so calls to them from
+// the program land here and the originals are reached through __real_*.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static atomic_size_t alloc_count;
+static atomic_bool alloc_fail;
+
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return alloc_fail ? NULL : __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return alloc_fail ? NULL : __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return alloc_fail ? NULL : __real_realloc(ptr, size);
+}
+
+size_t util_alloc_count(void) {
+    return atomic_load_explicit(&alloc_count, memory_order_relaxed);
+}
+
+void util_fail_allocs(bool fail) {
+    alloc_fail = fail;
+}
+
+TEST test_alloc_count(void) {
+    size_t before = util_alloc_count();
+
+    // Volatile so the pair isn't optimized out.
+    void *volatile p = malloc(1);
+    free(p);
+
+    ASSERT_EQ(util_alloc_count(), before + 1);
+
+    PASS();
+}
+
 SUITE(util_suite) {
     RUN_TEST(test_sym_parse);
     RUN_TEST(test_collect);
+    RUN_TEST(test_collect_growth);
+    RUN_TEST(test_map_input);
+    RUN_TEST(test_write_all);
+    RUN_TEST(test_alloc_count);
 }
 #endif
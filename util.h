@@ -7,10 +7,17 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "strbuf.h"
 #include "sdnv.h"
 
+enum {
+    // Size of a huge page on common platforms. Memory meant to be backed by
+    // huge pages is rounded up to it.
+    HUGE_PAGE_SIZE = 1 << 21,
+};
+
 // Get the number of elements in the array.
 #define ASIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -28,20 +35,75 @@ uint32_t sym_parse(const char *str, const sym_t *syms, size_t sym_count);
 // Read an entire file into the given buffer.
 void collect(strbuf_t **buf, FILE *stream);
 
-#define WRITE(stream, buf, len) do { \
-    size_t ret = fwrite((buf), sizeof(uint8_t), (len), (stream)); \
-    assert(ret == (len)); \
+// The rest of a file mapped into memory.
+typedef struct {
+    const char *buf;
+    size_t len;
+    // The whole mapping, which starts on a page boundary before buf.
+    void *map;
+    size_t map_len;
+} mapped_t;
+
+// Map the rest of the stream into memory, if it's a non-empty regular file, so
+// it can be parsed in place. Return false if it can't be mapped, in which case
+// it should be read instead.
+bool map_input(mapped_t *m, FILE *stream);
+
+// Unmap the input.
+void unmap_input(mapped_t *m);
+
+// Write the entire buffer to the file descriptor, retrying on partial writes.
+// Return true on success and false otherwise.
+bool write_all(int fd, const void *buf, size_t len);
+
+// Flush the stream and then write the entire buffer to its file descriptor, so
+// the buffer goes out in as few syscalls as possible. Return true on success
+// and false otherwise.
+bool write_stream(FILE *stream, const void *buf, size_t len);
+
+#ifdef MKBUNDLE_TEST
+// Get the number of calls to malloc, calloc, and realloc so far. The test
+// build is linked to count them.
+size_t util_alloc_count(void);
+
+// Make every call to malloc, calloc, and realloc fail while fail is set, to
+// test how running out of memory is handled.
+void util_fail_allocs(bool fail);
+#endif
+
+// Get a cursor to the free space at the end of the strbuf.
+#define STRBUF_CURSOR(sb) ((uint8_t *) &(sb)->buf[(sb)->pos])
+
+// Copy len bytes to the cursor and advance it.
+#define PUT(cur, buf, len) do { \
+    memcpy((cur), (buf), (len)); \
+    (cur) += (len); \
 } while (0)
 
-#define WRITE_SDNV(stream, val) do { \
-    sdnv_t *sdnv = SDNV_ENCODE(val); \
-    WRITE(stream, sdnv->bytes, sdnv->len); \
-    sdnv_destroy(sdnv); \
+// Encode the given native integer as an SDNV at the cursor and advance it.
+#define PUT_SDNV(cur, val) \
+    ((cur) += sdnv_encode_u64((val), (cur)))
+
+// Encode the given native integer as an SDNV padded to the given width, or as
+// a minimal SDNV if the width is zero.
+#define PUT_SDNV_FIXED(cur, val, width) do { \
+    size_t sdnv_count = (width); \
+    if (sdnv_count) { \
+        bool sdnv_fits = sdnv_encode_u64_fixed((val), sdnv_count, (cur)); \
+        assert(sdnv_fits); \
+        (cur) += sdnv_count; \
+    } else { \
+        PUT_SDNV(cur, val); \
+    } \
 } while (0)
 
-#define WRITE_EID(stream, eid) do { \
-    WRITE_SDNV(stream, SWAP32((eid)->scheme)); \
-    WRITE_SDNV(stream, SWAP32((eid)->ssp)); \
+// Copy an SDNV precomputed with SDNV_CONST to the cursor.
+#define PUT_SDNV_CONST(cur, sdnv) \
+    PUT(cur, (sdnv)->bytes, (sdnv)->len)
+
+#define PUT_EID(cur, eid) do { \
+    PUT_SDNV(cur, (eid)->scheme); \
+    PUT_SDNV(cur, (eid)->ssp); \
 } while(0)
 
 // Determine if on a little-endian platform.